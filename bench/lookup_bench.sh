@@ -0,0 +1,36 @@
+#!/bin/bash
+# Mede buscas pontuais pelo id (select where id = k) com ids aleatórios, que
+# passam pela busca de chave dos nós internos e das folhas, com o cache grande o
+# bastante para a tabela toda ficar na memória.
+# Uso: bench/lookup_bench.sh [linhas] [buscas]
+ROWS=${1:-200000}
+LOOKUPS=${2:-500000}
+
+EXECUTABLE="./rql"
+DB_FILE="bench.db"
+
+if [ ! -x $EXECUTABLE ]; then
+    echo "Compile o rql antes de rodar o benchmark"
+    exit 1
+fi
+
+rm -f $DB_FILE
+for i in $(seq 1 $ROWS); do
+    echo "insert $i user$i person$i@example.com"
+done > bench_insert.sql
+$EXECUTABLE $DB_FILE -f bench_insert.sql > /dev/null 2>&1
+rm -f bench_insert.sql
+
+# mesmos ids nas duas versões: a do comando interpretado e a do comando preparado
+awk -v rows=$ROWS -v n=$LOOKUPS 'BEGIN { srand(42); for (i = 0; i < n; i++) print int(rand() * rows) + 1 }' > bench_ids.txt
+sed 's/^/select where id = /' bench_ids.txt > bench_lookup.sql
+(echo ".prepare busca select where id = ?"; sed 's/^/.exec busca /' bench_ids.txt) > bench_prepared.sql
+rm -f bench_ids.txt
+
+TIMEFORMAT="%R s"
+echo -n "$LOOKUPS buscas em $ROWS linhas: "
+time ($EXECUTABLE $DB_FILE --cache 100000 -f bench_lookup.sql > /dev/null 2>&1)
+echo -n "$LOOKUPS buscas com .prepare/.exec: "
+time ($EXECUTABLE $DB_FILE --cache 100000 -f bench_prepared.sql > /dev/null 2>&1)
+
+rm -f bench_lookup.sql bench_prepared.sql $DB_FILE
@@ -0,0 +1,52 @@
+#!/bin/bash
+# Compara o pager com buffer pool (lseek/read), o modo --mmap e o banco com
+# páginas comprimidas (--compress), que é criado em um arquivo separado.
+# Uso: bench/pager_bench.sh [linhas] [varreduras]
+ROWS=${1:-20000}
+SCANS=${2:-20}
+
+EXECUTABLE="./rql"
+DB_FILE="bench.db"
+COMPRESSED_DB_FILE="bench-compress.db"
+
+if [ ! -x $EXECUTABLE ]; then
+    echo "Compile o rql antes de rodar o benchmark"
+    exit 1
+fi
+
+rm -f $DB_FILE $COMPRESSED_DB_FILE
+for i in $(seq 1 $ROWS); do
+    echo "insert $i user$i person$i@example.com"
+done > bench_insert.sql
+echo ".exit" >> bench_insert.sql
+$EXECUTABLE $DB_FILE < bench_insert.sql > /dev/null
+$EXECUTABLE $COMPRESSED_DB_FILE --compress < bench_insert.sql > /dev/null
+rm -f bench_insert.sql
+echo "tamanho sem compressão: $(stat -c %s $DB_FILE) bytes"
+echo "tamanho comprimido: $(stat -c %s $COMPRESSED_DB_FILE) bytes"
+
+# varreduras repetidas dentro de um único processo (leitura intensa)
+for i in $(seq 1 $SCANS); do
+    echo "select"
+done > bench_scan.sql
+echo ".exit" >> bench_scan.sql
+
+TIMEFORMAT="%R s"
+for MODE in "" "--cache 100000" "--mmap" "--compress"; do
+    echo "modo: ${MODE:-read()}"
+    FILE=$DB_FILE
+    if [ "$MODE" = "--compress" ]; then
+        FILE=$COMPRESSED_DB_FILE
+    fi
+
+    # abre o banco e faz uma varredura por processo (partida a frio do cache)
+    echo -n "  partida a frio ($SCANS processos): "
+    time (for i in $(seq 1 $SCANS); do
+        echo -e "select\n.exit" | $EXECUTABLE $FILE $MODE > /dev/null
+    done)
+
+    echo -n "  $SCANS varreduras em um processo: "
+    time ($EXECUTABLE $FILE $MODE < bench_scan.sql > /dev/null)
+done
+
+rm -f bench_scan.sql $DB_FILE $COMPRESSED_DB_FILE
@@ -1,15 +1,39 @@
 #!/bin/bash
-# gcc -o ./rql ./src/rql.c
+# gcc -O2 -pthread -o ./rql ./src/repl.c ./src/rql.c
+# ./compile.sh      compila o rql e executa com o banco de dados de teste
+# ./compile.sh lib  compila só a biblioteca, librql.a e librql.so
 # Diretório do código-fonte
 SRC_DIR="src"
 SRC_FILE="rql.c"
+REPL_FILE="repl.c"
 
-# Diretório de saída do executável
+# Diretório de saída do executável e das bibliotecas
 BIN_DIR="."
 EXECUTABLE="rql"
+LIB_DIR="."
 
-# Compilação
-gcc -o $BIN_DIR/$EXECUTABLE $SRC_DIR/$SRC_FILE
+# Biblioteca: só as funções marcadas com RQL_API ficam visíveis, na .so e na .a
+compile_lib() {
+    gcc -O2 -pthread -fPIC -fvisibility=hidden -c -o $LIB_DIR/rql.o $SRC_DIR/$SRC_FILE &&
+    objcopy --localize-hidden $LIB_DIR/rql.o &&
+    ar rcs $LIB_DIR/librql.a $LIB_DIR/rql.o &&
+    gcc -shared -pthread -o $LIB_DIR/librql.so $LIB_DIR/rql.o
+    local result=$?
+    rm -f $LIB_DIR/rql.o
+    return $result
+}
+
+if [ "$1" == "lib" ]; then
+    if compile_lib; then
+        echo "Bibliotecas $LIB_DIR/librql.a e $LIB_DIR/librql.so compiladas"
+    else
+        echo "Erro na compilação"
+    fi
+    exit
+fi
+
+# Compilação; sem otimização os intrinsics dos filtros passam pela pilha e perdem para o código escalar
+gcc -O2 -pthread -o $BIN_DIR/$EXECUTABLE $SRC_DIR/$REPL_FILE $SRC_DIR/$SRC_FILE
 
 # Verificação de erro na compilação
 if [ $? -eq 0 ]; then
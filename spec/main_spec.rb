@@ -1,11 +1,13 @@
 describe 'database' do
   before do
-      `rm -rf test.db`
+      `rm -rf test.db test.db-wal test.csv test.sql test_api test_api.c`
   end
 
-  def run_script(commands)
+  def run_script(commands, options = "")
     raw_output = nil
-    IO.popen("./rql test.db", "r+") do |pipe|
+    IO.popen("./rql test.db #{options}", "r+") do |pipe|
+      # lê a saída enquanto escreve: scripts longos enchem o buffer do pipe
+      reader = Thread.new { pipe.read }
       commands.each do |command|
         begin
           pipe.puts command
@@ -17,7 +19,7 @@ describe 'database' do
       pipe.close_write
 
       # Read entire output
-      raw_output = pipe.gets(nil)
+      raw_output = reader.value
     end
     raw_output.split("\n")
   end
@@ -57,16 +59,21 @@ describe 'database' do
     ])
   end
 
-  it 'erro de tabela cheia' do
-    script = (1..1401).map do |i|
-      "insert #{i} user#{i} person#{i}@example.com"
+  it 'divide os nos internos quando a tabela cresce' do
+    # emails longos deixam poucas linhas por folha
+    email = "x" * 240
+    script = (1..10000).map do |i|
+      "insert #{i} user#{i} person#{i}@#{email}"
     end
     script << ".exit"
-    result = run_script(script)
-    expect(result.last(2)).to match_array([
-      "rql > Executado.",
-      "rql > Falta implementar a divisao de nodes internos",
-    ])
+    run_script(script)
+
+    result = run_script(["select", ".btree", ".exit"])
+    rows = result.select { |line| line.include?("person") }
+    expect(rows.length).to eq(10000)
+    expect(rows.last).to eq("(10000, user10000, person10000@#{email})")
+    # com ids crescentes o nó dividido fica quase cheio
+    expect(result).to include("- internal (size 1)", "  - internal (size 338)")
   end
 
   it 'permite inserir string no tamanho maximo' do
@@ -127,10 +134,10 @@ describe 'database' do
           "rql > Constantes:",
           "ROW_SIZE: 293",
           "COMMON_NODE_HEADER_SIZE: 6",
-          "LEAF_NODE_HEADER_SIZE: 14",
-          "LEAF_NODE_CELL_SIZE: 297",
-          "LEAF_NODE_SPACE_FOR_CELLS: 4082",
-          "LEAF_NODE_MAX_CELLS: 13",
+          "LEAF_NODE_HEADER_SIZE: 24",
+          "LEAF_NODE_SLOT_SIZE: 6",
+          "LEAF_NODE_SPACE_FOR_CELLS: 4072",
+          "INTERNAL_NODE_MAX_CELLS: 339",
           "rql > ",
       ])
   end
@@ -174,36 +181,622 @@ describe 'database' do
   end
 
   it 'printa a estrutura de 3-leaf-node btree' do
-      script = (1..14).map do |i|
+      script = (1..108).map do |i|
         "insert #{i} user#{i} person#{i}@example.com"
       end
       script << ".btree"
-      script << "insert 15 user15 person15@example.com"
+      script << "insert 109 user109 person109@example.com"
       script << ".exit"
       result = run_script(script)
   
-      expect(result[14...(result.length)]).to match_array([
+      expect(result[108...(result.length)]).to match_array([
         "rql > Tree:",
         "- internal (size 1)",
-        "  - leaf (size 7)",
+        "  - leaf (size 107)",
         "    - 1",
         "    - 2",
         "    - 3",
-        "    - 4",
-        "    - 5",
-        "    - 6",
-        "    - 7",
-        "  - key 7",
-        "  - leaf (size 7)",
-        "    - 8",
-        "    - 9",
-        "    - 10",
-        "    - 11",
-        "    - 12",
-        "    - 13",
-        "    - 14",
+        "    - ...",
+        "    - 105",
+        "    - 106",
+        "    - 107",
+        "  - key 107",
+        "  - leaf (size 1)",
+        "    - 108",
         "rql > Executado.",
         "rql > ",
       ])
     end
-end
\ No newline at end of file
+
+  it 'mantem os dados com um cache menor que a tabela' do
+    script = (1..30).map do |i|
+      "insert #{i} user#{i} person#{i}@example.com"
+    end
+    script << ".exit"
+    run_script(script, "--cache 2")
+
+    result = run_script(["select", ".exit"], "--cache 2")
+    expect(result.length).to eq(32)
+    expect(result.first).to eq("rql > (1, user1, person1@example.com)")
+    expect(result[29]).to eq("(30, user30, person30@example.com)")
+  end
+
+  it 'grava as paginas alteradas com .flush sem sair' do
+    result1 = run_script([
+      "insert 1 usuario usuario@email.com",
+      ".flush",
+    ])
+    expect(result1.first(2)).to match_array([
+      "rql > Executado.",
+      "rql > Executado.",
+    ])
+
+    result2 = run_script([
+      "select",
+      ".exit",
+    ])
+    expect(result2).to match_array([
+      "rql > (1, usuario, usuario@email.com)",
+      "Executado.",
+      "rql > ",
+    ])
+  end
+
+  it 'nao grava paginas que foram apenas lidas' do
+    script = (1..30).map do |i|
+      "insert #{i} user#{i} person#{i}@example.com"
+    end
+    script << ".exit"
+    run_script(script)
+
+    result = run_script(["select", ".cache", ".exit"])
+    expect(result).to include("paginas gravadas: 0")
+  end
+
+  it 'le e grava os dados no modo mmap' do
+    script = (1..30).map do |i|
+      "insert #{i} user#{i} person#{i}@example.com"
+    end
+    script << ".exit"
+    run_script(script, "--mmap")
+
+    expected = (1..30).map { |i| "(#{i}, user#{i}, person#{i}@example.com)" }
+    ["--mmap", ""].each do |options|
+      result = run_script(["select", ".exit"], options)
+      expect(result.length).to eq(32)
+      expect(result.first).to eq("rql > #{expected.first}")
+      expect(result[1...30]).to eq(expected[1...30])
+    end
+  end
+
+  it 'recupera os commits do WAL depois de uma interrupcao' do
+    script = (1..20).map do |i|
+      "insert #{i} user#{i} person#{i}@example.com"
+    end
+    run_script(script)
+    expect(File.exist?("test.db-wal")).to eq(true)
+
+    result = run_script(["select", ".exit"])
+    expect(result.length).to eq(22)
+    expect(result.first).to eq("rql > (1, user1, person1@example.com)")
+    expect(result[19]).to eq("(20, user20, person20@example.com)")
+    expect(File.exist?("test.db-wal")).to eq(false)
+  end
+
+  it 'agrupa os commits no modo synchronous normal' do
+    script = [".synchronous normal"]
+    script += (1..20).map do |i|
+      "insert #{i} user#{i} person#{i}@example.com"
+    end
+    script << ".exit"
+    run_script(script)
+
+    result = run_script(["select", ".exit"])
+    expect(result.length).to eq(22)
+    expect(result[19]).to eq("(20, user20, person20@example.com)")
+  end
+
+  it 'reaproveita as paginas liberadas pelos deletes' do
+    script = (1..200).map do |i|
+      "insert #{i} user#{i} person#{i}@example.com"
+    end
+    script += (1..150).map { |i| "delete #{i}" }
+    script << ".pages"
+    script << ".exit"
+    result = run_script(script)
+    expect(result).to include("total: 8", "em uso: 3", "livres: 5")
+
+    script = (201..350).map do |i|
+      "insert #{i} user#{i} person#{i}@example.com"
+    end
+    script += [".pages", "select", ".exit"]
+    result = run_script(script)
+    expect(result).to include("total: 9", "em uso: 9", "livres: 0")
+    expect(result).to include("(350, user350, person350@example.com)")
+  end
+
+  it 'une as folhas que ficam com poucas linhas depois dos deletes' do
+    script = (1..216).map do |i|
+      "insert #{i} user#{i} person#{i}@example.com"
+    end
+    script += (1..216).reject { |i| i % 3 == 0 }.map { |i| "delete #{i}" }
+    script += [".btree", ".pages", "select", ".exit"]
+    result = run_script(script)
+
+    expect(result).to include("- leaf (size 72)", "em uso: 3", "livres: 6")
+    expect(result).to include("(216, user216, person216@example.com)")
+  end
+
+  it 'grava as paginas comprimidas com --compress' do
+    script = (1..500).map do |i|
+      "insert #{i} user#{i} person#{i}@example.com"
+    end
+    script << ".exit"
+    run_script(script, "--compress")
+    expect(File.size("test.db") < 17 * 4096 / 2).to eq(true)
+
+    # o formato é reconhecido sem a opção
+    result = run_script([".compression", "select", ".exit"])
+    expect(result).to include("paginas no arquivo: 17")
+    expect(result).to include("(500, user500, person500@example.com)")
+    expect(result.select { |line| line.include?("person") }.length).to eq(500)
+  end
+
+  it 'busca pelo indice de username depois de reabrir o banco' do
+    script = (1..1200).map do |i|
+      "insert #{i} user#{i % 100} person#{i}@example.com"
+    end
+    script << ".exit"
+    run_script(script)
+
+    result = run_script([
+      "delete 542",
+      "select where username = user42",
+      "select where username = ninguem",
+      ".exit",
+    ]).map { |line| line.sub("rql > ", "") }
+    expected = (0...12).map { |j| 42 + 100 * j }.reject { |id| id == 542 }
+    expect(result[1..11]).to eq(expected.map { |id| "(#{id}, user42, person#{id}@example.com)" })
+    expect(result[13]).to eq("Registro não encontrado.")
+  end
+
+  it 'descarta com o filtro de bloom os ids e usernames que nao existem' do
+    script = (1..100).map do |i|
+      "insert #{i} user#{i} person#{i}@example.com"
+    end
+    script << ".exit"
+    run_script(script)
+
+    script = (1..20).map { |i| "select where username = ninguem#{i}" }
+    script += ["delete 5000", "select where username = user7", ".bloom", ".exit"]
+    result = run_script(script)
+    expect(result).to include("rql > (7, user7, person7@example.com)")
+    expect(result).to include("id: 10240 bits, 100 itens", "id consultas: 1")
+    expect(result).to include("username: 10240 bits, 100 itens", "username consultas: 21")
+    descartadas = result.find { |line| line.start_with?("username descartadas:") }
+    expect(descartadas.split(": ").last.to_i >= 19).to eq(true)
+  end
+
+  it 'importa um csv fora de ordem junto com as linhas que ja existem' do
+    rows = (3..400).to_a.reverse.map { |i| "#{i},user#{i % 10},person#{i}@example.com" }
+    File.write("test.csv", "id,username,email\n" + rows.join("\n") + "\n")
+    result = run_script([
+      "insert 1 user1 person1@example.com",
+      "insert 2 user2 person2@example.com",
+      ".import test.csv 70",
+      ".exit",
+    ])
+    expect(result).to include("rql > 398 linhas importadas.")
+
+    result = run_script([
+      "select",
+      "select where username = user7",
+      ".exit",
+    ]).map { |line| line.sub("rql > ", "") }
+    expect(result[0..399]).to eq((1..400).map { |i| "(#{i}, user#{i % 10}, person#{i}@example.com)" })
+    expect(result[401..440]).to eq((0...40).map { |j| 7 + 10 * j }.map { |i| "(#{i}, user7, person#{i}@example.com)" })
+
+    File.write("test.csv", "500,a,a@a\n501,b\n")
+    result = run_script([".import test.csv", "select where id between 400 and 600", ".exit"])
+    expect(result).to include("rql > Linha 2 inválida em 'test.csv'.")
+    expect(result).to include("rql > (400, user0, person400@example.com)")
+    expect(result).not_to include("(500, a, a@a)")
+  end
+
+  it 'refaz o indice com uma varredura em varios threads' do
+    rows = (1..6000).map { |i| "#{i},user#{i % 50},person#{i}@example.com" }
+    File.write("test.csv", rows.join("\n") + "\n")
+    run_script([".import test.csv", ".exit"])
+
+    result = run_script([
+      ".threads 0",
+      ".threads 4",
+      ".threads",
+      "delete 7",
+      ".reindex",
+      "select where username = user7",
+      ".exit",
+    ]).map { |line| line.gsub("rql > ", "") }
+    expect(result[0]).to eq("Uso: .threads [1 a 16]")
+    expect(result[1]).to eq("threads de varredura: 4")
+    expect(result[4..122]).to eq((1...120).map { |j| 7 + 50 * j }.map { |i| "(#{i}, user7, person#{i}@example.com)" })
+  end
+
+  it 'filtra por email e por like sem indice, com os kernels simd e escalares' do
+    script = (1..300).map do |i|
+      domain = i % 3 == 0 ? "empresa.com.br" : "example.com"
+      "insert #{i} user#{i % 20} person#{i}@#{domain}"
+    end
+    queries = [
+      "select where email like %@empresa.com.br",
+      "select where email like person1_@%",
+      "select where username like %er1%",
+      "select where email = person42@empresa.com.br",
+      "select where email like %nada%",
+    ]
+    script += queries + [".simd scalar", ".simd"] + queries + [".simd mmx", ".exit"]
+    result = run_script(script).map { |line| line.gsub("rql > ", "") }.drop(300)
+
+    empresa = (1..300).select { |i| i % 3 == 0 }
+    expected = empresa.map { |i| "(#{i}, user#{i % 20}, person#{i}@empresa.com.br)" } + ["Executado."]
+    expected += (10..19).map { |i| "(#{i}, user#{i % 20}, person#{i}@#{i % 3 == 0 ? "empresa.com.br" : "example.com"})" } + ["Executado."]
+    expected += (1..300).select { |i| (i % 20).to_s.start_with?("1") }.map do |i|
+      "(#{i}, user#{i % 20}, person#{i}@#{i % 3 == 0 ? "empresa.com.br" : "example.com"})"
+    end + ["Executado."]
+    expected += ["(42, user2, person42@empresa.com.br)", "Executado.", "Executado."]
+    expect(result[0...expected.length]).to eq(expected)
+    expect(result[expected.length]).to eq("kernels dos filtros: scalar")
+    expect(result[expected.length + 1, expected.length]).to eq(expected)
+    expect(result.last(2).first).to eq("Erro: Kernels 'mmx' indisponíveis, use avx2, sse2 ou scalar.")
+  end
+
+  it 'busca ids por igualdade e por intervalo' do
+    script = (1..200).map do |i|
+      "insert #{i * 2} user#{i} person#{i}@example.com"
+    end
+    script += [
+      "select where id = 40",
+      "select where id = 41",
+      "select where id between 21 and 29",
+      "select where id between 380 and 1000",
+      ".exit",
+    ]
+    result = run_script(script).map { |line| line.sub("rql > ", "") }
+    expect(result[200..-1]).to eq([
+      "(40, user20, person20@example.com)",
+      "Executado.",
+      "Executado.",
+      "(22, user11, person11@example.com)",
+      "(24, user12, person12@example.com)",
+      "(26, user13, person13@example.com)",
+      "(28, user14, person14@example.com)",
+      "Executado.",
+    ] + (190..200).map { |i| "(#{i * 2}, user#{i}, person#{i}@example.com)" } + [
+      "Executado.",
+      "",
+    ])
+  end
+
+  it 'conta, pagina e acha a posicao de um id pelos totais dos nos internos' do
+    # emails longos deixam poucas linhas por folha; os deletes unem e redistribuem folhas
+    email = "x" * 200
+    script = (1..3000).map do |i|
+      "insert #{i * 2} user#{i} person#{i}@#{email}"
+    end
+    script += (1..300).map { |i| "delete #{i * 20}" }
+    script << ".exit"
+    run_script(script)
+
+    result = run_script([
+      "select count(*)",
+      "select count(*) where id between 0 and 1000",
+      "select limit 2 offset 2000",
+      "select where id between 101 and 200 limit 3 offset 10",
+      ".prepare pagina select limit ? offset ?",
+      ".exec pagina 1 2699",
+      ".exec pagina 1 2700",
+      ".exit",
+    ]).map { |line| line.gsub("rql > ", "") }
+    expect(result).to eq([
+      "2700",
+      "Executado.",
+      "450",
+      "Executado.",
+      "(4446, user2223, person2223@#{email})",
+      "(4448, user2224, person2224@#{email})",
+      "Executado.",
+      "(124, user62, person62@#{email})",
+      "(126, user63, person63@#{email})",
+      "(128, user64, person64@#{email})",
+      "Executado.",
+      "(5998, user2999, person2999@#{email})",
+      "Executado.",
+      "Executado.",
+      "",
+    ])
+
+    # sem o .exit os totais alterados pelas folhas não vão para o log: a abertura os refaz
+    run_script((1..50).map { |i| "insert #{i * 2 + 1001} user#{i} person#{i}@example.com" })
+    result = run_script(["select count(*)", "select count(*) where id between 0 and 1100", ".exit"])
+    expect(result).to eq(["rql > 2750", "Executado.", "rql > 544", "Executado.", "rql > "])
+  end
+
+  it 'escreve os selects em csv, tsv e binario com o .mode' do
+    result = run_script([
+      "insert 1 user1 person1@example.com",
+      "insert (2, us\"er2, person2@example.com)",
+      ".mode csv",
+      "select",
+      ".mode tsv",
+      "select where id = 1",
+      ".mode xml",
+      ".mode",
+      ".exit",
+    ])
+    expect(result).to eq([
+      "rql > Executado.",
+      "rql > Executado.",
+      "rql > rql > id,username,email",
+      "1,user1,person1@example.com",
+      "2,\"us\"\"er2\",person2@example.com",
+      "Executado.",
+      "rql > rql > id\tusername\temail",
+      "1\tuser1\tperson1@example.com",
+      "Executado.",
+      "rql > Uso: .mode tuple|csv|tsv|binary",
+      "rql > tsv",
+      "rql > ",
+    ])
+
+    output = IO.popen(["./rql", "test.db"], "r+b") do |pipe|
+      pipe.write(".mode binary\nselect where id = 1\n.exit\n")
+      pipe.close_write
+      pipe.read
+    end
+    expect(output).to include([1, 5, "user1", 19, "person1@example.com"].pack("VCa5Ca19"))
+  end
+
+  it 'usa o banco direto pela biblioteca, sem o repl' do
+    File.write("test_api.c", <<~C)
+      #include <stdio.h>
+      #include "src/rql.h"
+
+      int main() {
+        Table* table = rql_open("test.db", 0, DB_OPEN_DEFAULT);
+        PreparedStatement* statement;
+        rql_prepare(table, "insert (2, user2, person2@example.com), (1, user1, person1@example.com)", &statement);
+        printf("%d\\n", rql_step(statement) == EXECUTE_SUCCESS);
+        rql_finalize(statement);
+        printf("%d\\n", rql_prepare(table, "select where", &statement) == PREPARE_SYNTAX_ERROR);
+
+        rql_prepare(table, "select where username = ?", &statement);
+        printf("%d\\n", rql_bind_int(statement, 1, 7) == PREPARE_INVALID_PARAMETER);
+        rql_bind_text(statement, 1, "user2", 5);
+        while (rql_step(statement) == EXECUTE_ROW) {
+          printf("%u\\n", rql_column_int(statement, COLUMN_ID));
+        }
+        rql_finalize(statement);
+
+        rql_prepare(table, "select", &statement);
+        while (rql_step(statement) == EXECUTE_ROW) {
+          printf("%u %.*s %u\\n", rql_column_int(statement, COLUMN_ID),
+                 (int)rql_column_bytes(statement, COLUMN_USERNAME), rql_column_text(statement, COLUMN_USERNAME),
+                 rql_column_bytes(statement, COLUMN_EMAIL));
+        }
+        rql_finalize(statement);
+        rql_close(table);
+        return 0;
+      }
+    C
+    system("gcc -pthread -o test_api test_api.c src/rql.c")
+    expect(`./test_api`.lines.map(&:chomp)).to eq(["1", "1", "1", "2", "1 user1 19", "2 user2 19"])
+    expect(run_script(["select where id = 2", ".exit"])).to include("rql > (2, user2, person2@example.com)")
+  end
+
+  it 'le a tabela em varios threads enquanto outro insere' do
+    File.write("test_api.c", <<~C)
+      #include <pthread.h>
+      #include <stdio.h>
+      #include "src/rql.h"
+
+      Table* table;
+      int done = 0;
+      int errors = 0;
+
+      void* reader(void* arg) {
+        while (!__atomic_load_n(&done, __ATOMIC_ACQUIRE)) {
+          PreparedStatement* statement;
+          rql_prepare(table, "select", &statement);
+          uint32_t last_id = 0;
+          while (rql_step(statement) == EXECUTE_ROW) {
+            uint32_t id = rql_column_int(statement, COLUMN_ID);
+            if (id <= last_id) {
+              __atomic_fetch_add(&errors, 1, __ATOMIC_RELAXED);
+            }
+            last_id = id;
+          }
+          rql_finalize(statement);
+        }
+        return NULL;
+      }
+
+      int main() {
+        table = rql_open("test.db", 16, DB_OPEN_DEFAULT);
+        pthread_t readers[4];
+        for (int i = 0; i < 4; i++) {
+          pthread_create(&readers[i], NULL, reader, NULL);
+        }
+        PreparedStatement* insert;
+        rql_prepare(table, "insert ? ? ?", &insert);
+        for (uint32_t id = 1; id <= 2000; id++) {
+          rql_bind_int(insert, 1, id * 7919 % 2003);
+          rql_bind_text(insert, 2, "user", 4);
+          rql_bind_text(insert, 3, "person@example.com", 18);
+          rql_step(insert);
+        }
+        rql_finalize(insert);
+        __atomic_store_n(&done, 1, __ATOMIC_RELEASE);
+        for (int i = 0; i < 4; i++) {
+          pthread_join(readers[i], NULL);
+        }
+
+        PreparedStatement* statement;
+        rql_prepare(table, "select", &statement);
+        int rows = 0;
+        while (rql_step(statement) == EXECUTE_ROW) {
+          rows++;
+        }
+        rql_finalize(statement);
+        rql_close(table);
+        printf("%d %d\\n", errors, rows);
+        return 0;
+      }
+    C
+    system("gcc -pthread -o test_api test_api.c src/rql.c")
+    expect(`./test_api`.lines.map(&:chomp)).to eq(["0 2000"])
+  end
+
+  it 'insere e apaga em varios threads ao mesmo tempo' do
+    File.write("test_api.c", <<~C)
+      #include <pthread.h>
+      #include <stdio.h>
+      #include "src/rql.h"
+
+      Table* table;
+
+      // cada thread insere os ids i * 4 + w e apaga os múltiplos de 3 entre eles
+      void* writer(void* arg) {
+        uint32_t w = (uint32_t)(long)arg;
+        PreparedStatement* insert;
+        PreparedStatement* delete;
+        rql_prepare(table, "insert ? ? ?", &insert);
+        rql_prepare(table, "delete ?", &delete);
+        for (uint32_t i = 0; i < 1000; i++) {
+          uint32_t id = (i * 7919 % 1000) * 4 + w + 1;
+          rql_bind_int(insert, 1, id);
+          rql_bind_text(insert, 2, id % 2 ? "impar" : "par", id % 2 ? 5 : 3);
+          rql_bind_text(insert, 3, "person@example.com", 18);
+          rql_step(insert);
+          if (id % 3 == 0) {
+            rql_bind_int(delete, 1, id);
+            rql_step(delete);
+          }
+        }
+        rql_finalize(insert);
+        rql_finalize(delete);
+        return NULL;
+      }
+
+      int count(const char* sql) {
+        PreparedStatement* statement;
+        rql_prepare(table, sql, &statement);
+        int rows = 0;
+        while (rql_step(statement) == EXECUTE_ROW) {
+          rows++;
+        }
+        rql_finalize(statement);
+        return rows;
+      }
+
+      int main() {
+        table = rql_open("test.db", 0, DB_OPEN_DEFAULT);
+        rql_meta_command(table, ".synchronous normal");
+        pthread_t writers[4];
+        for (int i = 0; i < 4; i++) {
+          pthread_create(&writers[i], NULL, writer, (void*)(long)i);
+        }
+        for (int i = 0; i < 4; i++) {
+          pthread_join(writers[i], NULL);
+        }
+        printf("%d %d %d\\n", count("select"), count("select where username = par"),
+               count("select where username = impar"));
+        rql_close(table);
+        return 0;
+      }
+    C
+    system("gcc -pthread -o test_api test_api.c src/rql.c")
+    expect(`./test_api`.lines.map(&:chomp)).to eq(["2667 1334 1333"])
+  end
+
+  it 'executa comandos preparados com parametros pelo .prepare e .exec' do
+    result = run_script([
+      ".prepare novo insert ? ? ?",
+      ".exec novo 2 user2 person2@example.com",
+      ".exec novo 1 user1 person1@example.com",
+      ".exec novo 1 user1 person1@example.com",
+      ".exec novo 3 user3",
+      ".prepare busca select where id between ? and ?",
+      ".exec busca 1 2",
+      ".exec outro 1",
+      "delete ?",
+      ".exit",
+    ])
+    expect(result).to eq([
+      "rql > rql > Executado.",
+      "rql > Executado.",
+      "rql > Erro: Chave duplicada.",
+      "rql > O comando 'novo' espera 3 valores.",
+      "rql > rql > (1, user1, person1@example.com)",
+      "(2, user2, person2@example.com)",
+      "Executado.",
+      "rql > Comando preparado 'outro' não encontrado.",
+      "rql > Erro: Parâmetro sem valor.",
+      "rql > ",
+    ])
+  end
+
+  it 'executa um script com -f sem prompt e sem as mensagens de sucesso' do
+    File.write("test.sql", "insert 1 user1 person1@example.com\ninsert 1 user1 person1@example.com\n\nselect")
+    output = `./rql test.db -f test.sql 2>/dev/null`
+    expect(output.lines.map(&:chomp)).to eq([
+      "Erro: Chave duplicada.",
+      "(1, user1, person1@example.com)",
+    ])
+
+    summary = `./rql test.db -f test.sql 2>&1 >/dev/null`
+    expect(summary).to include("3 comandos em")
+    expect(summary).to include("2 erros.")
+  end
+
+  it 'desfaz com rollback e grava com commit as linhas de uma transacao' do
+    result = run_script([
+      "insert 1 user1 person1@example.com",
+      "begin",
+      "insert (5, user5, person5@example.com), (3, user3, person3@example.com)",
+      "delete 1",
+      "rollback",
+      "begin",
+      "insert (4, user4, person4@example.com), (2, user2, person2@example.com)",
+      "insert (6, user6, person6@example.com), (1, user1, person1@example.com)",
+      "commit",
+      "commit",
+      "begin",
+      "insert 7 user7 person7@example.com",
+      ".exit",
+    ])
+    expect(result).to include("rql > Erro: Chave duplicada.")
+    expect(result).to include("rql > Erro: Nenhuma transação em andamento.")
+
+    result = run_script([
+      "select",
+      ".exit",
+    ])
+    expect(result).to eq([
+      "rql > (1, user1, person1@example.com)",
+      "(2, user2, person2@example.com)",
+      "(4, user4, person4@example.com)",
+      "Executado.",
+      "rql > ",
+    ])
+  end
+
+  it 'volta ao tamanho do cache depois do commit de uma transacao grande' do
+    script = ["begin"]
+    script += (1..2000).map do |i|
+      "insert #{i} user#{i} person#{i}@example.com"
+    end
+    script += ["commit", ".cache", ".exit"]
+    result = run_script(script, "--cache 4")
+    expect(result).to include("paginas em cache: 4/4")
+  end
+end
@@ -0,0 +1,666 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "rql.h"
+
+/**
+ * REPL do rql: lê os comandos do stdin e escreve os resultados no stdout, usando
+ * só a API de src/rql.h.
+ */
+
+// Definição do struct que irá receber os comandos
+typedef struct {
+  char* buffer;
+  size_t buffer_length;
+  ssize_t input_length;
+} InputBuffer;
+
+#define OUTPUT_BUFFER_SIZE (64 * 1024)
+#define OUTPUT_MAX_ROW_TEXT 1024 // maior linha formatada: os textos com todas as aspas dobradas
+
+// formato das linhas devolvidas pelos selects, escolhido com o .mode
+typedef enum {
+  OUTPUT_TUPLE, // (id, username, email), o formato padrão
+  OUTPUT_CSV,
+  OUTPUT_TSV,
+  OUTPUT_BINARY // as linhas no formato em que são gravadas nas folhas
+} OutputMode;
+
+/**
+ * Saída dos selects: as linhas são formatadas à mão em um buffer grande, que só
+ * vai para o stdout quando enche ou no fim do comando. Usa o mesmo FILE que o
+ * printf, então a ordem em relação ao prompt e às mensagens é preservada.
+ */
+typedef struct {
+  OutputMode mode;
+  uint32_t length;
+  char buffer[OUTPUT_BUFFER_SIZE];
+} ResultSink;
+
+#define PREPARED_NAME_SIZE 32
+
+// comando guardado com .prepare, executado pelo nome com .exec
+typedef struct {
+  char name[PREPARED_NAME_SIZE];
+  PreparedStatement* statement;
+} NamedStatement;
+
+typedef struct {
+  NamedStatement* statements;
+  uint32_t num_statements;
+} NamedStatements;
+
+// estado do REPL entre os comandos
+typedef struct {
+  Table* table;
+  ResultSink* output;
+  NamedStatements named;
+  bool batch; // -f: sem prompt e sem "Executado.", só as linhas dos selects e os erros
+  uint64_t num_commands;
+  uint64_t num_errors;
+  struct timespec start;
+} Repl;
+
+#define SCRIPT_CHUNK_SIZE (1024 * 1024)
+
+/**
+ * Leitura do script do -f em blocos grandes com read(2), em vez de uma chamada
+ * de getline por comando. As linhas são devolvidas dentro do próprio buffer, com o
+ * '\n' trocado por '\0'; o buffer cresce se uma linha não couber nele.
+ */
+typedef struct {
+  int file_descriptor;
+  char* buffer;
+  size_t capacity;
+  size_t start; // início da próxima linha
+  size_t end; // fim dos bytes lidos
+  bool eof;
+} ScriptReader;
+
+ScriptReader* script_reader_open(const char* path) {
+  int fd = strcmp(path, "-") == 0 ? STDIN_FILENO : open(path, O_RDONLY);
+  if (fd == -1) {
+    printf("Não foi possível abrir o script '%s'.\n", path);
+    exit(EXIT_FAILURE);
+  }
+  ScriptReader* reader = malloc(sizeof(ScriptReader));
+  reader->file_descriptor = fd;
+  reader->capacity = SCRIPT_CHUNK_SIZE;
+  reader->buffer = malloc(reader->capacity + 1);
+  reader->start = 0;
+  reader->end = 0;
+  reader->eof = false;
+  return reader;
+}
+
+// próxima linha, sem o '\n' e o '\r' do fim; NULL no fim do script
+char* script_read_line(ScriptReader* reader) {
+  while (true) {
+    char* line = reader->buffer + reader->start;
+    char* newline = memchr(line, '\n', reader->end - reader->start);
+    if (newline == NULL && reader->eof) {
+      if (reader->start == reader->end) {
+        return NULL;
+      }
+      // última linha sem '\n': o byte extra do buffer guarda o terminador
+      newline = reader->buffer + reader->end;
+      reader->end++;
+    }
+    if (newline != NULL) {
+      *newline = '\0';
+      if (newline > line && newline[-1] == '\r') {
+        newline[-1] = '\0';
+      }
+      reader->start = newline + 1 - reader->buffer;
+      return line;
+    }
+
+    // linha incompleta: vai para o início do buffer e o resto do bloco é lido
+    size_t pending = reader->end - reader->start;
+    memmove(reader->buffer, line, pending);
+    reader->start = 0;
+    reader->end = pending;
+    if (pending == reader->capacity) {
+      reader->capacity *= 2;
+      reader->buffer = realloc(reader->buffer, reader->capacity + 1);
+    }
+    ssize_t bytes_read = read(reader->file_descriptor, reader->buffer + reader->end, reader->capacity - reader->end);
+    if (bytes_read < 0) {
+      printf("Erro ao ler entrada\n");
+      exit(EXIT_FAILURE);
+    }
+    if (bytes_read == 0) {
+      reader->eof = true;
+    }
+    reader->end += bytes_read;
+  }
+}
+
+void script_reader_close(ScriptReader* reader) {
+  if (reader->file_descriptor != STDIN_FILENO) {
+    close(reader->file_descriptor);
+  }
+  free(reader->buffer);
+  free(reader);
+}
+
+double elapsed_seconds(struct timespec* start) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+// Dados do input
+InputBuffer* new_input_buffer() {
+  InputBuffer* input_buffer = malloc(sizeof(InputBuffer));
+  input_buffer->buffer = NULL;
+  input_buffer->buffer_length = 0;
+  input_buffer->input_length = 0;
+
+  return input_buffer;
+}
+
+// iniciando o event loop
+void print_prompt() { printf("rql > "); }
+
+void read_input(InputBuffer* input_buffer) {
+  ssize_t bytes_read =
+      getline(&(input_buffer->buffer), &(input_buffer->buffer_length), stdin);
+
+  if (bytes_read <= 0) {
+    printf("Erro ao ler entrada\n");
+    exit(EXIT_FAILURE);
+  }
+
+  // Ignore trailing newline
+  input_buffer->input_length = bytes_read - 1;
+  input_buffer->buffer[bytes_read - 1] = 0;
+}
+
+void close_input_buffer(InputBuffer* input_buffer) {
+    free(input_buffer->buffer);
+    free(input_buffer);
+}
+
+void output_flush(ResultSink* output) {
+  fwrite(output->buffer, 1, output->length, stdout);
+  output->length = 0;
+}
+
+void output_bytes(ResultSink* output, const void* bytes, uint32_t length) {
+  memcpy(output->buffer + output->length, bytes, length);
+  output->length += length;
+}
+
+void output_char(ResultSink* output, char c) {
+  output->buffer[output->length++] = c;
+}
+
+void output_uint(ResultSink* output, uint32_t value) {
+  char digits[10];
+  uint32_t num_digits = 0;
+  do {
+    digits[num_digits++] = '0' + value % 10;
+    value /= 10;
+  } while (value != 0);
+  while (num_digits > 0) {
+    output_char(output, digits[--num_digits]);
+  }
+}
+
+// campo de csv: entre aspas, com as aspas dobradas, só se tiver separador, aspas ou quebra de linha
+void output_csv_field(ResultSink* output, const char* text, uint32_t length) {
+  bool quote = false;
+  for (uint32_t i = 0; i < length && !quote; i++) {
+    quote = text[i] == ',' || text[i] == '"' || text[i] == '\n' || text[i] == '\r';
+  }
+  if (!quote) {
+    output_bytes(output, text, length);
+    return;
+  }
+  output_char(output, '"');
+  for (uint32_t i = 0; i < length; i++) {
+    if (text[i] == '"') {
+      output_char(output, '"');
+    }
+    output_char(output, text[i]);
+  }
+  output_char(output, '"');
+}
+
+// campo de tsv: tabulação, quebras de linha e a barra invertida são escapadas com barra invertida
+void output_tsv_field(ResultSink* output, const char* text, uint32_t length) {
+  for (uint32_t i = 0; i < length; i++) {
+    switch (text[i]) {
+      case ('\t'):
+        output_bytes(output, "\\t", 2);
+        break;
+      case ('\n'):
+        output_bytes(output, "\\n", 2);
+        break;
+      case ('\r'):
+        output_bytes(output, "\\r", 2);
+        break;
+      case ('\\'):
+        output_bytes(output, "\\\\", 2);
+        break;
+      default:
+        output_char(output, text[i]);
+    }
+  }
+}
+
+// início de um select: o csv e o tsv começam com o cabeçalho, que o .import sabe pular
+void output_begin(ResultSink* output) {
+  if (output->mode == OUTPUT_CSV) {
+    output_bytes(output, "id,username,email\n", 18);
+  } else if (output->mode == OUTPUT_TSV) {
+    output_bytes(output, "id\tusername\temail\n", 18);
+  }
+}
+
+/**
+ * Escreve a linha corrente do comando com os textos lidos direto da página. No modo
+ * binário a linha sai no formato das folhas: id de 4 bytes na ordem da máquina e
+ * cada texto precedido de 1 byte de tamanho.
+ */
+void output_row(ResultSink* output, PreparedStatement* statement) {
+  if (output->length + OUTPUT_MAX_ROW_TEXT > OUTPUT_BUFFER_SIZE) {
+    output_flush(output);
+  }
+
+  uint32_t id = rql_column_int(statement, COLUMN_ID);
+  const char* username = rql_column_text(statement, COLUMN_USERNAME);
+  uint8_t username_length = rql_column_bytes(statement, COLUMN_USERNAME);
+  const char* email = rql_column_text(statement, COLUMN_EMAIL);
+  uint8_t email_length = rql_column_bytes(statement, COLUMN_EMAIL);
+
+  switch (output->mode) {
+    case (OUTPUT_TUPLE):
+      output_char(output, '(');
+      output_uint(output, id);
+      output_bytes(output, ", ", 2);
+      output_bytes(output, username, username_length);
+      output_bytes(output, ", ", 2);
+      output_bytes(output, email, email_length);
+      output_bytes(output, ")\n", 2);
+      break;
+    case (OUTPUT_CSV):
+      output_uint(output, id);
+      output_char(output, ',');
+      output_csv_field(output, username, username_length);
+      output_char(output, ',');
+      output_csv_field(output, email, email_length);
+      output_char(output, '\n');
+      break;
+    case (OUTPUT_TSV):
+      output_uint(output, id);
+      output_char(output, '\t');
+      output_tsv_field(output, username, username_length);
+      output_char(output, '\t');
+      output_tsv_field(output, email, email_length);
+      output_char(output, '\n');
+      break;
+    case (OUTPUT_BINARY):
+      output_bytes(output, &id, sizeof(id));
+      output_char(output, username_length);
+      output_bytes(output, username, username_length);
+      output_char(output, email_length);
+      output_bytes(output, email, email_length);
+      break;
+  }
+}
+
+// a linha do select count(*): só o total, nos 4 bytes do id no modo binário
+void output_count(ResultSink* output, PreparedStatement* statement) {
+  uint32_t count = rql_column_int(statement, COLUMN_ID);
+  if (output->mode == OUTPUT_BINARY) {
+    output_bytes(output, &count, sizeof(count));
+    return;
+  }
+  output_uint(output, count);
+  output_char(output, '\n');
+}
+
+const char* output_mode_name(OutputMode mode) {
+  switch (mode) {
+    case (OUTPUT_CSV):
+      return "csv";
+    case (OUTPUT_TSV):
+      return "tsv";
+    case (OUTPUT_BINARY):
+      return "binary";
+    default:
+      return "tuple";
+  }
+}
+
+void print_prepare_error(Repl* repl, PrepareResult result, const char* sql) {
+  repl->num_errors++;
+  switch (result) {
+    case (PREPARE_SYNTAX_ERROR):
+      printf("Erro de sintaxe. Não foi possível interpretar a operação '%s'.\n", sql);
+      break;
+    case (PREPARE_STRING_TOO_LONG):
+      printf("String ultrapassa o tamanho máximo para o campo.\n");
+      break;
+    case (PREPARE_UNRECOGNIZED_STATEMENT):
+      printf("Palavra chave não reconhecida '%s'.\n", sql);
+      break;
+    case (PREPARE_NEGATIVE_ID):
+      printf("ID tem que ser um inteiro positivo.\n");
+      break;
+    case (PREPARE_INVALID_PARAMETER):
+      printf("Parâmetro inválido.\n");
+      break;
+    default:
+      break;
+  }
+}
+
+// no modo script o sucesso não é anunciado, só os erros
+void print_execute_result(Repl* repl, ExecuteResult result) {
+  if (result != EXECUTE_SUCCESS) {
+    repl->num_errors++;
+  }
+  switch (result) {
+    case (EXECUTE_SUCCESS):
+      if (!repl->batch) {
+        printf("Executado.\n");
+      }
+      break;
+    case (EXECUTE_DUPLICATE_KEY):
+      printf("Erro: Chave duplicada.\n");
+      break;
+    case (EXECUTE_TABLE_FULL):
+      printf("Erro: A tabela está cheia.\n");
+      break;
+    case (EXECUTE_TRANSACTION_ACTIVE):
+      printf("Erro: Já existe uma transação em andamento.\n");
+      break;
+    case (EXECUTE_NO_TRANSACTION):
+      printf("Erro: Nenhuma transação em andamento.\n");
+      break;
+    case (EXECUTE_MISSING_PARAMETER):
+      printf("Erro: Parâmetro sem valor.\n");
+      break;
+
+    default:
+      break;
+  }
+}
+bool statement_is_select(PreparedStatement* statement) {
+  StatementType type = rql_statement_type(statement);
+  return type == STATEMENT_SELECT || type == STATEMENT_SELECT_BY_ID || type == STATEMENT_SELECT_BY_USERNAME ||
+         type == STATEMENT_SELECT_BY_FILTER || type == STATEMENT_SELECT_COUNT;
+}
+
+// executa o comando até o fim, escrevendo as linhas dos selects na saída
+ExecuteResult execute_and_print(PreparedStatement* statement, ResultSink* output) {
+  if (!statement_is_select(statement)) {
+    return rql_step(statement);
+  }
+
+  if (rql_statement_type(statement) == STATEMENT_SELECT_COUNT) {
+    ExecuteResult result;
+    while ((result = rql_step(statement)) == EXECUTE_ROW) {
+      output_count(output, statement);
+    }
+    output_flush(output);
+    return result;
+  }
+
+  output_begin(output);
+  uint32_t num_rows = 0;
+  ExecuteResult result;
+  while ((result = rql_step(statement)) == EXECUTE_ROW) {
+    output_row(output, statement);
+    num_rows++;
+  }
+  output_flush(output);
+
+  // Se nenhuma entrada for encontrada, informa que o registro não foi encontrado
+  if (num_rows == 0 && result == EXECUTE_SUCCESS && rql_statement_type(statement) == STATEMENT_SELECT_BY_USERNAME) {
+    printf("Registro não encontrado.\n");
+  }
+  return result;
+}
+
+NamedStatement* find_named_statement(NamedStatements* named, const char* name) {
+  for (uint32_t i = 0; i < named->num_statements; i++) {
+    if (strcmp(named->statements[i].name, name) == 0) {
+      return &named->statements[i];
+    }
+  }
+  return NULL;
+}
+
+// .prepare <nome> <comando>: o comando é interpretado uma vez e fica guardado; o nome pode ser reutilizado
+void prepare_named_statement(Repl* repl, char* arguments) {
+  char name[PREPARED_NAME_SIZE];
+  int sql_offset = 0;
+  if (sscanf(arguments, " %31s %n", name, &sql_offset) != 1 || arguments[sql_offset] == '\0') {
+    printf("Uso: .prepare <nome> <comando>\n");
+    return;
+  }
+
+  const char* sql = arguments + sql_offset;
+  PreparedStatement* statement;
+  PrepareResult result = rql_prepare(repl->table, sql, &statement);
+  if (result != PREPARE_SUCCESS) {
+    print_prepare_error(repl, result, sql);
+    return;
+  }
+
+  NamedStatements* named = &repl->named;
+  NamedStatement* entry = find_named_statement(named, name);
+  if (entry != NULL) {
+    rql_finalize(entry->statement);
+  } else {
+    named->statements = realloc(named->statements, (named->num_statements + 1) * sizeof(NamedStatement));
+    entry = &named->statements[named->num_statements++];
+    strcpy(entry->name, name);
+  }
+  entry->statement = statement;
+}
+
+// .exec <nome> <valores...>: um valor por parâmetro, separados por espaço, na ordem dos '?'
+void exec_named_statement(Repl* repl, char* arguments) {
+  char* name = strtok(arguments, " ");
+  if (name == NULL) {
+    printf("Uso: .exec <nome> <valores...>\n");
+    return;
+  }
+  NamedStatement* entry = find_named_statement(&repl->named, name);
+  if (entry == NULL) {
+    printf("Comando preparado '%s' não encontrado.\n", name);
+    return;
+  }
+
+  PreparedStatement* statement = entry->statement;
+  uint32_t num_parameters = rql_parameter_count(statement);
+  char** values = malloc((num_parameters + 1) * sizeof(char*));
+  uint32_t num_values = 0;
+  while (num_values <= num_parameters && (values[num_values] = strtok(NULL, " ")) != NULL) {
+    num_values++;
+  }
+  if (num_values != num_parameters) {
+    printf("O comando '%s' espera %u valores.\n", entry->name, num_parameters);
+    free(values);
+    return;
+  }
+
+  for (uint32_t index = 1; index <= num_parameters; index++) {
+    char* value = values[index - 1];
+    PrepareResult result;
+    if (rql_parameter_type(statement, index) == PARAMETER_INT) {
+      char* end;
+      long long id = strtoll(value, &end, 10);
+      if (end == value || *end != '\0' || id > UINT32_MAX) {
+        result = PREPARE_INVALID_PARAMETER;
+      } else if (id < 0) {
+        result = PREPARE_NEGATIVE_ID;
+      } else {
+        result = rql_bind_int(statement, index, id);
+      }
+    } else {
+      result = rql_bind_text(statement, index, value, strlen(value));
+    }
+    if (result != PREPARE_SUCCESS) {
+      print_prepare_error(repl, result, value);
+      free(values);
+      return;
+    }
+  }
+  free(values);
+
+  print_execute_result(repl, execute_and_print(statement, repl->output));
+  rql_reset(statement);
+}
+
+void free_named_statements(NamedStatements* named) {
+  for (uint32_t i = 0; i < named->num_statements; i++) {
+    rql_finalize(named->statements[i].statement);
+  }
+  free(named->statements);
+  named->statements = NULL;
+  named->num_statements = 0;
+}
+
+// fecha o banco e encerra; no modo script informa o total de comandos e o tempo no stderr
+void repl_exit(Repl* repl) {
+  free_named_statements(&repl->named);
+  rql_close(repl->table);
+  if (repl->batch) {
+    fflush(stdout);
+    double seconds = elapsed_seconds(&repl->start);
+    fprintf(stderr, "%llu comandos em %.3f s (%.0f por segundo), %llu erros.\n",
+            (unsigned long long)repl->num_commands, seconds,
+            seconds > 0 ? repl->num_commands / seconds : 0.0, (unsigned long long)repl->num_errors);
+  }
+  exit(EXIT_SUCCESS);
+}
+
+// .exit, .mode, .prepare e .exec são do REPL; os outros comandos de inspeção ficam na biblioteca
+MetaCommandResult do_meta_command(Repl* repl, char* command) {
+  ResultSink* output = repl->output;
+  if (strcmp(command, ".exit") == 0) {
+    repl_exit(repl);
+  } else if (strncmp(command, ".prepare ", 9) == 0) {
+    prepare_named_statement(repl, command + 9);
+    return META_COMMAND_SUCCESS;
+  } else if (strncmp(command, ".exec ", 6) == 0) {
+    exec_named_statement(repl, command + 6);
+    return META_COMMAND_SUCCESS;
+  } else if (strncmp(command, ".mode", 5) == 0) {
+    const char* mode = command + 5;
+    if (strcmp(mode, "") == 0) {
+      printf("%s\n", output_mode_name(output->mode));
+    } else if (strcmp(mode, " tuple") == 0) {
+      output->mode = OUTPUT_TUPLE;
+    } else if (strcmp(mode, " csv") == 0) {
+      output->mode = OUTPUT_CSV;
+    } else if (strcmp(mode, " tsv") == 0) {
+      output->mode = OUTPUT_TSV;
+    } else if (strcmp(mode, " binary") == 0) {
+      output->mode = OUTPUT_BINARY;
+    } else {
+      printf("Uso: .mode tuple|csv|tsv|binary\n");
+    }
+    return META_COMMAND_SUCCESS;
+  }
+  return rql_meta_command(repl->table, command);
+}
+
+void run_command(Repl* repl, char* command) {
+  repl->num_commands++;
+  if (command[0] == '.') {
+    switch (do_meta_command(repl, command)) {
+      case (META_COMMAND_SUCCESS):
+        return;
+      case (META_COMMAND_UNRECOGNIZED_COMMAND):
+        repl->num_errors++;
+        printf("Comando não reconhecido '%s'\n", command);
+        return;
+    }
+  }
+
+  PreparedStatement* statement;
+  PrepareResult prepare_result = rql_prepare(repl->table, command, &statement);
+  if (prepare_result != PREPARE_SUCCESS) {
+    print_prepare_error(repl, prepare_result, command);
+    return;
+  }
+
+  print_execute_result(repl, execute_and_print(statement, repl->output));
+  rql_finalize(statement);
+}
+
+int main(int argc, char* argv[]) {
+  if (argc < 2) {
+    printf("Necessário informar o nome do banco de dados.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  char* filename = argv[1];
+  char* script = NULL;
+  uint32_t cache_pages = 0;
+  uint32_t flags = DB_OPEN_DEFAULT;
+  for (int i = 2; i < argc; i++) {
+    if (strcmp(argv[i], "--cache") == 0 && i + 1 < argc) {
+      cache_pages = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--mmap") == 0) {
+      flags |= DB_OPEN_MMAP;
+    } else if (strcmp(argv[i], "--compress") == 0) {
+      flags |= DB_OPEN_COMPRESS;
+    } else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+      script = argv[++i];
+    } else {
+      printf("Opção desconhecida '%s'.\n", argv[i]);
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  ScriptReader* reader = NULL;
+  if (script != NULL) {
+    reader = script_reader_open(script);
+  }
+
+  Repl repl;
+  repl.table = rql_open(filename, cache_pages, flags);
+  repl.output = malloc(sizeof(ResultSink));
+  repl.output->mode = OUTPUT_TUPLE;
+  repl.output->length = 0;
+  repl.named.statements = NULL;
+  repl.named.num_statements = 0;
+  repl.batch = reader != NULL;
+  repl.num_commands = 0;
+  repl.num_errors = 0;
+  clock_gettime(CLOCK_MONOTONIC, &repl.start);
+
+  // -f: os comandos vêm do script, sem prompt, e o fim do arquivo encerra como o .exit
+  if (repl.batch) {
+    char* line;
+    while ((line = script_read_line(reader)) != NULL) {
+      if (line[0] != '\0') {
+        run_command(&repl, line);
+      }
+    }
+    script_reader_close(reader);
+    repl_exit(&repl);
+  }
+
+  InputBuffer* input_buffer = new_input_buffer();
+  while (true) {
+    print_prompt();
+    read_input(input_buffer);
+    run_command(&repl, input_buffer->buffer);
+  }
+}
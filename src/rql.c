@@ -1,3 +1,4 @@
+#define _GNU_SOURCE // pthread_rwlockattr_setkind_np
 #include <errno.h>
 #include <fcntl.h>
 #include <stdbool.h>
@@ -5,32 +6,36 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#include <inttypes.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/mman.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define FILTER_X86_KERNELS // SSE2 sempre existe no x86-64; o AVX2 é testado na abertura
+#endif
 
+#include "rql.h"
 
 
-// Definição do struct que irá receber os comandos
-typedef struct {
-  char* buffer;
-  size_t buffer_length;
-  ssize_t input_length;
-} InputBuffer;
 
 // Definição dos tipos de nós
 typedef enum {
   NODE_INTERNAL,
-  NODE_LEAF
+  NODE_LEAF,
+  NODE_FREE // página na lista de páginas livres
 } NodeType;
 
 // Definição do tipo de nós para o índice
+// os valores continuam os de NodeType para que o tipo de qualquer página seja reconhecível
 typedef enum {
-  INDEX_NODE_INTERNAL,
-  INDEX_NODE_LEAF
+  INDEX_NODE_INTERNAL = NODE_FREE + 1,
+  INDEX_NODE_LEAF,
+  INDEX_NODE_BLOOM // página com os bits dos filtros de Bloom
 } IndexNodeType;
 
 // Tabela fake
-#define COLUMN_EMAIL_SIZE 255
-#define COLUMN_USERNAME_SIZE 32
 typedef struct {
   uint32_t id;
   char username[COLUMN_USERNAME_SIZE + 1]; // +1 para o character null no final do String
@@ -43,63 +48,295 @@ const uint32_t ID_SIZE = size_of_attribute(Row, id); // 4 bytes de ID
 const uint32_t USERNAME_SIZE = size_of_attribute(Row, username); // 32 bytes
 const uint32_t EMAIL_SIZE = size_of_attribute(Row, email); // 255 bytes
 const uint32_t ID_OFFSET = 0; // offset 0 para alocação em memória
-const uint32_t USERNAME_OFFSET = ID_OFFSET + ID_SIZE; // offset 4
-const uint32_t EMAIL_OFFSET = USERNAME_OFFSET + USERNAME_SIZE; // offset 36
-const uint32_t ROW_SIZE = ID_SIZE + USERNAME_SIZE + EMAIL_SIZE; // resto
+const uint32_t USERNAME_OFFSET = ID_OFFSET + ID_SIZE; // offset 4, tamanho seguido dos bytes
+const uint32_t COLUMN_LENGTH_SIZE = sizeof(uint8_t); // cada texto é gravado com 1 byte de tamanho
+// maior linha serializada: id + os dois textos no tamanho máximo
+const uint32_t ROW_SIZE = ID_SIZE + COLUMN_LENGTH_SIZE + COLUMN_USERNAME_SIZE +
+                          COLUMN_LENGTH_SIZE + COLUMN_EMAIL_SIZE;
 
 // informações da tabela
 const uint32_t PAGE_SIZE = 4096; // uma página inteira usada pela memoria virtual do SO
-#define TABLE_MAX_PAGES 100
+#define PAGER_DEFAULT_CACHE_PAGES 256 // orçamento padrão do buffer pool (1 MB)
+#define PAGER_NO_FRAME UINT32_MAX
+#define PAGER_FRAME_CHUNK_SIZE 1024 // quadros por bloco; os blocos nunca mudam de lugar
+#define PAGER_MAX_FRAME_CHUNKS 4096
+#define PAGE_TABLE_CHUNK_BITS 16 // a tabela de páginas tem dois níveis de 2^16 entradas
+#define PAGE_TABLE_CHUNK_SIZE (1 << PAGE_TABLE_CHUNK_BITS)
+#define FRAME_EVICTING UINT32_MAX // pin_count de um quadro sendo despejado
+#define PAGER_MMAP_RESERVE (1ULL << 36) // espaço de endereçamento reservado no modo mmap (64 GB)
+#define PAGER_MMAP_CHUNK_PAGES 256 // o mapeamento cresce de 1 MB em 1 MB
+
+#define COMPRESSED_MAGIC 0x5a4c5152 // "RQLZ"
+#define COMPRESSED_SECTOR_SIZE 256 // unidade de alocação das páginas comprimidas
+#define COMPRESSED_SUPERBLOCKS 2 // setores 0 e 1, gravados de forma alternada
+#define COMPRESSED_SUPERBLOCK_FIELDS 7 // campos cobertos pelo checksum do superbloco
+#define COMPRESSED_CHUNK_PAGES 512 // entradas do mapa de páginas gravadas juntas
+#define COMPRESSED_CHUNK_SIZE (COMPRESSED_CHUNK_PAGES * sizeof(PageExtent))
+
+// Onde uma página está no arquivo comprimido; length 0 é uma página nunca gravada
+typedef struct {
+  uint32_t sector;
+  uint32_t length; // PAGE_SIZE quando a página não comprimiu e foi guardada inteira
+} PageExtent;
+
+/**
+ * Estado de um arquivo com páginas comprimidas. O mapa de páginas fica inteiro em
+ * memória; o lock protege mapa e alocação, porque o checkpoint grava páginas na
+ * thread do WAL enquanto a thread principal lê.
+ */
+typedef struct {
+  int file_descriptor;
+  pthread_mutex_t lock;
+  uint32_t generation; // do último superbloco gravado
+  uint32_t num_pages;
+  PageExtent* map;
+  uint32_t map_capacity;
+  uint32_t* chunk_sectors; // onde está cada bloco do mapa, 0 se nunca gravado
+  bool* dirty_chunks;
+  uint32_t chunk_capacity;
+  uint32_t directory_sector;
+  uint32_t directory_sectors;
+  uint8_t* sector_bitmap; // setores em uso
+  uint32_t bitmap_capacity;
+  uint32_t num_sectors;
+  uint32_t allocation_hint;
+  uint32_t* pending_free; // pares (setor, quantidade) liberados no próximo commit
+  uint32_t num_pending_free;
+  uint32_t pending_free_capacity;
+  uint64_t bytes_uncompressed; // páginas gravadas e o espaço que ocupam no arquivo
+  uint64_t bytes_compressed;
+} CompressedFile;
+
+#define WAL_SUFFIX "-wal"
+#define WAL_MAGIC 0x57514c52 // "RLQW"
+#define WAL_HEADER_SIZE 16
+#define WAL_FRAME_HEADER_SIZE 16
+#define WAL_FRAME_SIZE (WAL_FRAME_HEADER_SIZE + PAGE_SIZE)
+#define WAL_GROUP_COMMIT_MS 2 // janela de sincronização no modo SYNC_NORMAL
+#define WAL_CHECKPOINT_BYTES (4 * 1024 * 1024) // o checkpoint começa quando o log passa disso
+#define WAL_MAX_BYTES (16 * 1024 * 1024) // acima disso os commits esperam o checkpoint
+
+// Quando o commit de um comando é considerado concluído
+typedef enum {
+  SYNC_NORMAL, // ao entrar no buffer do log; o fsync acontece na próxima janela
+  SYNC_FULL    // depois do fsync do grupo de commits em que entrou
+} SyncMode;
+
+/**
+ * Estado do write-ahead log. Posições são offsets no arquivo do log:
+ * [WAL_HEADER_SIZE, written) está no arquivo, [written, end) ainda no buffer.
+ */
+typedef struct {
+  char* path;
+  int file_descriptor;
+  int db_file_descriptor;
+  CompressedFile* compressed; // NULL se o banco guarda as páginas inteiras
+  uint32_t salt;     // muda a cada reinício do log
+  uint32_t checksum; // checksum acumulado até o último quadro
+  off_t end;
+  off_t written;
+  off_t synced;
+  off_t backfilled; // já copiado para o banco pelo checkpoint
+  char* buffer;
+  size_t buffer_length;
+  size_t buffer_capacity;
+  off_t* index; // page_num -> offset do quadro mais recente, 0 se a página não está no log
+  uint32_t index_capacity;
+  SyncMode sync_mode;
+  bool busy; // fsync ou checkpoint rodando sem o lock
+  bool checkpoint_requested;
+  bool shutdown;
+  uint64_t commits;
+  uint64_t synced_commits;
+  uint64_t syncs;
+  uint64_t checkpoints;
+  uint64_t pages_checkpointed;
+  uint64_t pages_recovered;
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t work;
+  pthread_cond_t done;
+} Wal;
+
+/**
+ * Quadro (frame) do buffer pool: guarda uma página do arquivo em memória.
+ * Quadros fixados (pin_count > 0) nunca são escolhidos para despejo. O pin_count
+ * é alterado com operações atômicas por qualquer thread; o despejo o troca de 0
+ * para FRAME_EVICTING, e quem encontrar esse valor espera a troca no lock do pool.
+ */
+typedef struct {
+  uint32_t page_num;
+  uint32_t pin_count;
+  bool referenced; // bit de referência do algoritmo CLOCK
+  bool dirty; // página alterada desde a última gravação no disco
+  void* data;
+} Frame;
 
-// Representação de uma página na memória
+/**
+ * Representação do buffer pool de páginas em memória.
+ * No modo mmap o arquivo é mapeado com MAP_PRIVATE em uma região reservada de
+ * endereço fixo: ler uma página é aritmética de ponteiro e as alterações ficam
+ * privadas até o flush, que as grava com pwrite como no buffer pool.
+ *
+ * Vários threads leem páginas ao mesmo tempo. Um acerto não trava nada: a tabela de
+ * páginas é lida com loads atômicos e o quadro é fixado com compare-and-swap. Faltas,
+ * despejos e o crescimento do pool passam pelo lock. Cada thread tem a própria lista
+ * de quadros fixados, liberada por pager_release.
+ */
 typedef struct {
   int file_descriptor;
-  uint32_t file_length;
+  off_t file_length;
   uint32_t num_pages;
-  void* pages[TABLE_MAX_PAGES];
+  bool use_mmap;
+  CompressedFile* compressed; // páginas comprimidas em extensões, NULL no formato normal
+  char* map;
+  uint32_t mapped_pages;
+  bool* dirty_pages; // bits de alteração por página no modo mmap
+  uint32_t dirty_pages_capacity;
+  uint32_t* dirty_list; // páginas alteradas pelo comando corrente, na ordem
+  uint32_t num_dirty;
+  uint32_t dirty_capacity;
+  Wal* wal;
+  pthread_mutex_t lock;
+  Frame** frame_chunks;
+  uint32_t num_frames;
+  uint32_t max_frames; // orçamento de memória, em páginas
+  uint32_t clock_hand;
+  uint32_t** page_table; // page_num -> quadro, PAGER_NO_FRAME se não está em cache
+  uint64_t cache_hits; // somados por thread em pager_release
+  uint64_t cache_misses;
+  uint64_t cache_evictions;
+  uint64_t pages_written;
 } Pager;
 
-// Representação da tabela
+#define BLOOM_BITS_PER_ITEM 10 // com 7 funções de hash dá cerca de 1% de falsos positivos
+#define BLOOM_NUM_HASHES 7
+#define BLOOM_MIN_ITEMS 1024
+
+/**
+ * Filtro de Bloom: responde "com certeza não existe" ou "talvez exista".
+ * Não aceita remoções, então os deletes deixam bits sobrando; num_items conta tudo o
+ * que já foi adicionado e, quando passa da capacidade, o filtro é reconstruído.
+ */
 typedef struct {
-  uint32_t root_page_num;
-  Pager* pager;
-} Table;
+  uint8_t* bits;
+  uint32_t num_bits;
+  uint32_t num_items;
+  uint64_t lookups;
+  uint64_t negatives; // consultas respondidas sem ler nenhuma página
+  uint64_t false_positives; // "talvez" que a árvore desmentiu
+} BloomFilter;
+
+#define PAGE_LATCH_STRIPES 1024
+#define SCAN_MAX_THREADS 16 // limite do .threads
+#define SCAN_DEFAULT_MAX_THREADS 8 // sem o .threads, um por núcleo até este limite
+#define SCAN_MIN_LEAVES_PER_THREAD 16 // tabelas menores são varridas pelo próprio thread
+
+/**
+ * Latch das folhas, um por faixa de páginas (page_num % PAGE_LATCH_STRIPES). Com o
+ * latch da tabela compartilhado os nós internos não mudam: um insert ou delete que
+ * cabe numa folha trava só ela e a folha do índice, em modo exclusivo, e um select
+ * trava em modo compartilhado a folha que está lendo.
+ */
+typedef struct {
+  pthread_rwlock_t lock;
+  uint32_t writers_waiting; // o select que segura a folha entre os passos a solta
+} PageLatch;
 
-typedef enum { 
-  EXECUTE_SUCCESS, 
-  EXECUTE_DUPLICATE_KEY,
-  EXECUTE_TABLE_FULL 
-} ExecuteResult;
+#define FILTER_PADDING 32 // bytes zerados antes e depois de um padrão, lidos pelos vetores
 
-// enum de sucesso ou erro para comandos nao sql
-typedef enum {
-  META_COMMAND_SUCCESS,
-  META_COMMAND_UNRECOGNIZED_COMMAND
-} MetaCommandResult;
+/**
+ * Pedaço de um padrão like entre dois '%' (ou o valor inteiro de um '='). A máscara
+ * care tem 0xFF nos bytes fixos e 0 no lugar dos '_', que aceitam qualquer byte; o
+ * preenchimento em volta também tem máscara 0, então um vetor pode começar antes do
+ * pedaço sem comparar nada a mais.
+ */
+typedef struct {
+  uint8_t bytes[FILTER_PADDING + COLUMN_EMAIL_SIZE + FILTER_PADDING];
+  uint8_t care[FILTER_PADDING + COLUMN_EMAIL_SIZE + FILTER_PADDING];
+  uint32_t length;
+  bool literal; // tem algum byte fixo
+  uint32_t first_literal; // posições do primeiro e do último byte fixo, que acham os candidatos
+  uint32_t last_literal;
+} FilterSegment;
 
+/**
+ * Funções dos filtros sobre os textos das páginas, escolhidas na abertura conforme a
+ * CPU: AVX2, SSE2 ou escalares. O match compara um pedaço com o texto na posição dada;
+ * o find procura a primeira posição entre from e last em que o pedaço aparece.
+ */
+typedef struct {
+  const char* name;
+  bool (*match)(const uint8_t* text, const FilterSegment* segment);
+  int64_t (*find)(const uint8_t* text, uint32_t from, uint32_t last, const FilterSegment* segment);
+} FilterKernels;
 
-// enum de sucesso ou erro para comandos sql
+// Representação da tabela
+struct Table {
+  uint32_t root_page_num;
+  uint32_t index_root_page_num; // raíz do índice de username
+  uint32_t rightmost_leaf_page_num; // última folha vista no fim da tabela, 0 se nenhuma
+  bool in_transaction; // entre o begin e o commit/rollback nada vai para o WAL
+  uint32_t transaction_num_pages; // tamanho do arquivo no begin
+  bool transaction_bloom_rebuilt; // a reconstrução pode ter perdido ids removidos na transação
+  BloomFilter id_filter;
+  BloomFilter username_filter;
+  Pager* pager;
+  pthread_rwlock_t latch; // compartilhado pelos passos de leitura, exclusivo para alterar
+  uint64_t version; // conta os comandos que alteraram a tabela, para os selects se reposicionarem
+  uint32_t writers_waiting; // escritores parados no latch: os selects o soltam no próximo passo
+  PageLatch* page_latches; // PAGE_LATCH_STRIPES latches das folhas
+  uint32_t scan_threads; // threads das varreduras da tabela inteira
+  const FilterKernels* filter_kernels; // .simd
+  pthread_mutex_t counts_lock; // totais dos nós internos mudados pelos inserts e deletes pelas folhas
+  uint32_t* counts_pending; // nós com totais alterados pelas folhas que ainda não foram para o WAL
+  uint32_t num_counts_pending;
+  uint32_t counts_pending_capacity;
+  bool* counts_pending_pages; // bit por página dos que estão na lista
+  uint32_t counts_pending_pages_capacity;
+};
+
+// destino do valor de um parâmetro '?' dentro do Statement
 typedef enum {
-  PREPARE_SUCCESS,
-  PREPARE_SYNTAX_ERROR,
-  PREPARE_NEGATIVE_ID,
-  PREPARE_STRING_TOO_LONG,
-  PREPARE_UNRECOGNIZED_STATEMENT
-} PrepareResult;
-
+  PARAMETER_ROW_ID,
+  PARAMETER_ROW_USERNAME,
+  PARAMETER_ROW_EMAIL,
+  PARAMETER_DELETE_ID,
+  PARAMETER_SELECT_ID, // select where id = ?, os dois limites do intervalo
+  PARAMETER_RANGE_START,
+  PARAMETER_RANGE_END,
+  PARAMETER_FIND_USERNAME,
+  PARAMETER_FILTER_PATTERN,
+  PARAMETER_LIMIT,
+  PARAMETER_OFFSET
+} ParameterTarget;
+
+#define PARAMETER_SINGLE_ROW UINT32_MAX // parâmetro do row_to_insert, não de uma das rows_to_insert
 
-// enum de comandos sql
-typedef enum { 
-    STATEMENT_INSERT, 
-    STATEMENT_SELECT,
-    STATEMENT_DELETE 
-} StatementType;
+typedef struct {
+  ParameterTarget target;
+  uint32_t row; // linha do insert com várias linhas
+  bool bound;
+} StatementParameter;
 
 // sql statement
 typedef struct {
   StatementType type;
   Row row_to_insert; //usado na inserção
+  Row* rows_to_insert; // usado no insert com várias linhas, liberado por statement_free
+  uint32_t num_rows_to_insert;
   uint32_t id_to_delete; // usado na exclusão
+  char username_to_find[COLUMN_USERNAME_SIZE + 1]; // usado no select por username
+  Column filter_column; // select where <coluna> like <padrão> e select where email = <valor>
+  bool filter_like;
+  char filter_pattern[COLUMN_EMAIL_SIZE + 1];
+  uint32_t id_range_start; // usados no select por id, os dois limites inclusos
+  uint32_t id_range_end;
+  uint32_t limit; // select ... limit <L> offset <O>; UINT32_MAX é sem limite
+  uint32_t offset;
+  StatementParameter* parameters; // os '?' na ordem em que aparecem, liberados por statement_free
+  uint32_t num_parameters;
+  uint32_t hint_page_num; // folha da execução anterior, onde a próxima busca começa
 } Statement;
 
 typedef struct{
@@ -109,23 +346,39 @@ typedef struct{
   bool end_of_table;
 } Cursor;
 
-// Definição do struct para o índice
+// Chave do índice de username: o texto completado com zeros, sem o terminador, e o id da linha
 typedef struct {
+  char username[COLUMN_USERNAME_SIZE];
   uint32_t id;
-  char username[COLUMN_USERNAME_SIZE + 1];
-} IndexEntry;
+} IndexKey;
 
-typedef struct {
-  IndexEntry entries[1000]; // Tamanho fixo para evitar problemas de escopo
-  uint32_t size;
-} Index;
+/**
+ * Comando preparado da API. Os selects guardam entre os passos a posição da
+ * varredura: o cursor da tabela, ou a folha e a célula do índice de username.
+ * Enquanto há uma linha corrente o select segura o latch compartilhado da tabela;
+ * se outro comando alterou a tabela entre dois passos, a varredura recomeça depois
+ * do último id devolvido.
+ */
+typedef struct FilterResult FilterResult;
 
-// Inicialização do índice
-Index* initialize_index() {
-  Index* index = malloc(sizeof(Index));
-  index->size = 0;
-  return index;
-}
+struct PreparedStatement {
+  Table* table;
+  Statement statement;
+  bool started;
+  bool done;
+  Cursor* cursor;
+  uint32_t index_page_num;
+  IndexKey index_key; // próxima entrada do índice a procurar, a partir de index_page_num
+  uint32_t num_rows; // linhas devolvidas até agora
+  void* record; // linha corrente, serializada dentro de uma página fixada
+  uint32_t last_id; // id da linha corrente
+  uint64_t version; // versão da tabela no último passo
+  bool latched;
+  uint64_t latch_epoch;
+  bool leaf_kept; // a folha da linha corrente ficou travada desde o passo anterior
+  FilterResult* filter_result; // linhas copiadas pelo primeiro passo de um select com filtro
+  uint32_t count; // resultado do select count(*)
+};
 
 // Definição do HEADER de um nó (node)
 const uint32_t NODE_TYPE_SIZE = sizeof(uint8_t);
@@ -142,30 +395,40 @@ const uint32_t LEAF_NODE_NUM_CELLS_SIZE = sizeof(uint32_t);
 const uint32_t LEAF_NODE_NUM_CELLS_OFFSET = COMMON_NODE_HEADER_SIZE;
 const uint32_t LEAF_NODE_NEXT_LEAF_SIZE = sizeof(uint32_t);
 const uint32_t LEAF_NODE_NEXT_LEAF_OFFSET = LEAF_NODE_NUM_CELLS_OFFSET + LEAF_NODE_NUM_CELLS_SIZE;
-const uint32_t LEAF_NODE_HEADER_SIZE = COMMON_NODE_HEADER_SIZE +
-                                       LEAF_NODE_NUM_CELLS_SIZE +
-                                       LEAF_NODE_NEXT_LEAF_SIZE;
+const uint32_t LEAF_NODE_CONTENT_START_SIZE = sizeof(uint32_t);
+const uint32_t LEAF_NODE_CONTENT_START_OFFSET = LEAF_NODE_NEXT_LEAF_OFFSET + LEAF_NODE_NEXT_LEAF_SIZE;
+const uint32_t LEAF_NODE_FRAGMENTED_SIZE = sizeof(uint32_t);
+const uint32_t LEAF_NODE_FRAGMENTED_OFFSET = LEAF_NODE_CONTENT_START_OFFSET + LEAF_NODE_CONTENT_START_SIZE;
+// dois bytes de enchimento deixam as chaves, logo depois do header, alinhadas em 4 bytes
+const uint32_t LEAF_NODE_HEADER_SIZE = (COMMON_NODE_HEADER_SIZE +
+                                        LEAF_NODE_NUM_CELLS_SIZE +
+                                        LEAF_NODE_NEXT_LEAF_SIZE +
+                                        LEAF_NODE_CONTENT_START_SIZE +
+                                        LEAF_NODE_FRAGMENTED_SIZE + 3) & ~3u;
 uint32_t* leaf_node_next_leaf(void* node) {
   return node + LEAF_NODE_NEXT_LEAF_OFFSET;
 }
 
 /**
- * Layout do corpo da folha (leaf node body)
- * o corpo é composto por um array de celulas e 
- * cada celula é uma chave seguida de um valor (uma linha serializada)
+ * Layout do corpo da folha (leaf node body): página com slots
+ * logo depois do header fica o diretório de slots, ordenado pela chave e dividido em
+ * dois arrays: primeiro todas as chaves, contíguas, depois as posições das linhas
+ * serializadas na mesma ordem. A busca só lê o array das chaves, que numa folha cheia
+ * ocupa poucas linhas de cache. As linhas têm tamanho variável e são gravadas a partir
+ * do fim da página em direção ao diretório.
+ * Linhas removidas deixam buracos (fragmented) que só são recuperados quando a
+ * folha é compactada, no momento em que falta espaço contíguo para uma inserção.
  */
 const uint32_t LEAF_NODE_KEY_SIZE = sizeof(uint32_t);
-const uint32_t LEAF_NODE_KEY_OFFSET = 0;
-const uint32_t LEAF_NODE_VALUE_SIZE = ROW_SIZE;
-const uint32_t LEAF_NODE_VALUE_OFFSET =
-    LEAF_NODE_KEY_OFFSET + LEAF_NODE_KEY_SIZE;
-const uint32_t LEAF_NODE_CELL_SIZE = LEAF_NODE_KEY_SIZE + LEAF_NODE_VALUE_SIZE;
+const uint32_t LEAF_NODE_VALUE_POSITION_SIZE = sizeof(uint16_t);
+const uint32_t LEAF_NODE_SLOT_SIZE = LEAF_NODE_KEY_SIZE + LEAF_NODE_VALUE_POSITION_SIZE;
 const uint32_t LEAF_NODE_SPACE_FOR_CELLS = PAGE_SIZE - LEAF_NODE_HEADER_SIZE;
-const uint32_t LEAF_NODE_MAX_CELLS = LEAF_NODE_SPACE_FOR_CELLS / LEAF_NODE_CELL_SIZE;
-//const uint32_t LEAF_NODE_MAX_CELLS = 3;
 
-const uint32_t LEAF_NODE_RIGHT_SPLIT_COUNT = (LEAF_NODE_MAX_CELLS + 1) / 2;
-const uint32_t LEAF_NODE_LEFT_SPLIT_COUNT = (LEAF_NODE_MAX_CELLS + 1) - LEAF_NODE_RIGHT_SPLIT_COUNT;
+// limite de células de uma folha, com todas as linhas de textos vazios
+const uint32_t LEAF_NODE_MAX_CELLS =
+    LEAF_NODE_SPACE_FOR_CELLS / (LEAF_NODE_SLOT_SIZE + ID_SIZE + 2 * COLUMN_LENGTH_SIZE);
+// abaixo desse uso a folha recebe linhas de uma irmã ou é unida a ela
+const uint32_t LEAF_NODE_MIN_USED = LEAF_NODE_SPACE_FOR_CELLS / 2;
 
 // Layout do HEADER de um nó interno
 const uint32_t INTERNAL_NODE_NUM_KEYS_SIZE = sizeof(uint32_t);
@@ -173,25 +436,99 @@ const uint32_t INTERNAL_NODE_NUM_KEYS_OFFSET = COMMON_NODE_HEADER_SIZE;
 const uint32_t INTERNAL_NODE_RIGHT_CHILD_SIZE = sizeof(uint32_t);
 const uint32_t INTERNAL_NODE_RIGHT_CHILD_OFFSET = INTERNAL_NODE_NUM_KEYS_OFFSET + 
                                                   INTERNAL_NODE_NUM_KEYS_SIZE;
-const uint32_t INTERNAL_NODE_HEADER_SIZE = COMMON_NODE_HEADER_SIZE +
-                                           INTERNAL_NODE_NUM_KEYS_SIZE +
-                                           INTERNAL_NODE_RIGHT_CHILD_SIZE;
+/**
+ * Os totais são somados com operações atômicas, que num endereço desalinhado podem
+ * atravessar duas linhas de cache e travar o barramento: dois bytes de enchimento
+ * deixam o total do filho da direita e as células alinhados em 4 bytes.
+ */
+const uint32_t INTERNAL_NODE_RIGHT_COUNT_SIZE = sizeof(uint32_t);
+const uint32_t INTERNAL_NODE_RIGHT_COUNT_OFFSET = (INTERNAL_NODE_RIGHT_CHILD_OFFSET +
+                                                   INTERNAL_NODE_RIGHT_CHILD_SIZE + 3) & ~3u;
+const uint32_t INTERNAL_NODE_HEADER_SIZE = INTERNAL_NODE_RIGHT_COUNT_OFFSET +
+                                           INTERNAL_NODE_RIGHT_COUNT_SIZE;
 
-// Layout do corpo de um nó interno
+/**
+ * Layout do corpo de um nó interno
+ * cada célula tem o filho, a maior chave dele e quantas linhas há na subárvore do
+ * filho; o total do filho da direita fica no header. Com os totais, count(*), offset e
+ * a posição de um id descem pela árvore sem ler as folhas.
+ * As células não ficam juntas: o corpo tem três arrays de INTERNAL_NODE_MAX_CELLS
+ * posições, primeiro as chaves, depois os filhos e os totais, e a busca lê só as chaves.
+ */
 const uint32_t INTERNAL_NODE_KEY_SIZE = sizeof(uint32_t);
 const uint32_t INTERNAL_NODE_CHILD_SIZE = sizeof(uint32_t);
-const uint32_t INTERNAL_NODE_CELL_SIZE = INTERNAL_NODE_CHILD_SIZE + INTERNAL_NODE_KEY_SIZE;
-const uint32_t INTERNAL_NODE_MAX_CELLS = 3;
+const uint32_t INTERNAL_NODE_COUNT_SIZE = sizeof(uint32_t);
+const uint32_t INTERNAL_NODE_CELL_SIZE = INTERNAL_NODE_CHILD_SIZE + INTERNAL_NODE_KEY_SIZE +
+                                         INTERNAL_NODE_COUNT_SIZE;
+// quantas células cabem na página: com 4 KB são 339 chaves e 340 filhos
+const uint32_t INTERNAL_NODE_MAX_CELLS =
+    (PAGE_SIZE - INTERNAL_NODE_HEADER_SIZE) / INTERNAL_NODE_CELL_SIZE;
+// abaixo disso o nó interno pega um filho emprestado de um irmão ou é unido a ele
+const uint32_t INTERNAL_NODE_MIN_KEYS = INTERNAL_NODE_MAX_CELLS / 2;
+
+/**
+ * Layout dos nós do índice de username
+ * As chaves têm tamanho fixo, então folhas e nós internos são arrays simples
+ * depois do header: a folha guarda só as chaves, o nó interno pares (filho, chave).
+ */
+const uint32_t INDEX_KEY_SIZE = sizeof(IndexKey);
+const uint32_t INDEX_LEAF_NODE_NUM_CELLS_OFFSET = COMMON_NODE_HEADER_SIZE;
+const uint32_t INDEX_LEAF_NODE_NEXT_LEAF_OFFSET = INDEX_LEAF_NODE_NUM_CELLS_OFFSET + sizeof(uint32_t);
+const uint32_t INDEX_LEAF_NODE_HEADER_SIZE = INDEX_LEAF_NODE_NEXT_LEAF_OFFSET + sizeof(uint32_t);
+const uint32_t INDEX_LEAF_NODE_MAX_CELLS = (PAGE_SIZE - INDEX_LEAF_NODE_HEADER_SIZE) / INDEX_KEY_SIZE;
+const uint32_t INDEX_LEAF_NODE_MIN_CELLS = INDEX_LEAF_NODE_MAX_CELLS / 2;
+const uint32_t INDEX_INTERNAL_NODE_NUM_KEYS_OFFSET = COMMON_NODE_HEADER_SIZE;
+const uint32_t INDEX_INTERNAL_NODE_RIGHT_CHILD_OFFSET = INDEX_INTERNAL_NODE_NUM_KEYS_OFFSET + sizeof(uint32_t);
+const uint32_t INDEX_INTERNAL_NODE_HEADER_SIZE = INDEX_INTERNAL_NODE_RIGHT_CHILD_OFFSET + sizeof(uint32_t);
+const uint32_t INDEX_INTERNAL_NODE_CHILD_SIZE = sizeof(uint32_t);
+const uint32_t INDEX_INTERNAL_NODE_CELL_SIZE = INDEX_INTERNAL_NODE_CHILD_SIZE + sizeof(IndexKey);
+// com 4 KB são 113 chaves por folha e 102 por nó interno
+const uint32_t INDEX_INTERNAL_NODE_MAX_CELLS =
+    (PAGE_SIZE - INDEX_INTERNAL_NODE_HEADER_SIZE) / INDEX_INTERNAL_NODE_CELL_SIZE;
+const uint32_t INDEX_INTERNAL_NODE_MIN_KEYS = INDEX_INTERNAL_NODE_MAX_CELLS / 2;
+#define BULK_LOAD_DEFAULT_FILL 90 // preenchimento das páginas montadas pela carga em lote, em %
+#define BULK_LOAD_COMMIT_PAGES 128 // páginas por commit durante a carga em lote
+#define INDEX_MAX_DEPTH 16 // folhas com metade das chaves já dão mais de 51^15 entradas
+#define TABLE_MAX_DEPTH 16 // nós internos da tabela pela metade já dão mais de 170^15 folhas
+#define KEY_SEARCH_BLOCK 16 // chaves que sobram da busca binária para a comparação em bloco
+
+/**
+ * Layout da página 0, o cabeçalho do banco
+ * guarda a raíz da árvore, a raíz do índice de username, os filtros de Bloom e a lista
+ * de páginas livres. Cada página livre aponta para a próxima, então alocar uma
+ * página lê só a página que será reusada.
+ */
+const uint32_t DB_HEADER_MAGIC = 0x334c5152; // "RQL3": chaves separadas das posições e dos filhos
+const uint32_t DB_HEADER_PAGE_NUM = 0;
+const uint32_t DB_HEADER_MAGIC_OFFSET = 0;
+const uint32_t DB_HEADER_ROOT_PAGE_OFFSET = DB_HEADER_MAGIC_OFFSET + sizeof(uint32_t);
+const uint32_t DB_HEADER_FREE_HEAD_OFFSET = DB_HEADER_ROOT_PAGE_OFFSET + sizeof(uint32_t);
+const uint32_t DB_HEADER_FREE_COUNT_OFFSET = DB_HEADER_FREE_HEAD_OFFSET + sizeof(uint32_t);
+const uint32_t DB_HEADER_INDEX_ROOT_OFFSET = DB_HEADER_FREE_COUNT_OFFSET + sizeof(uint32_t);
+const uint32_t DB_HEADER_BLOOM_PAGE_OFFSET = DB_HEADER_INDEX_ROOT_OFFSET + sizeof(uint32_t);
+const uint32_t DB_HEADER_BLOOM_CLEAN_OFFSET = DB_HEADER_BLOOM_PAGE_OFFSET + sizeof(uint32_t);
+// páginas dos filtros de Bloom: uma lista encadeada com os bytes dos dois filtros em sequência
+const uint32_t BLOOM_PAGE_NEXT_OFFSET = COMMON_NODE_HEADER_SIZE;
+const uint32_t BLOOM_PAGE_HEADER_SIZE = BLOOM_PAGE_NEXT_OFFSET + sizeof(uint32_t);
+const uint32_t FREE_PAGE_NEXT_OFFSET = COMMON_NODE_HEADER_SIZE;
 
 
 // Prototypes das funçõesa
 void set_node_type(void* node, NodeType type);
 void set_node_root(void* node, bool is_root);
 void leaf_node_split_and_insert(Cursor* cursor, uint32_t key, Row* value);
-void pager_flush(Pager* pager, uint32_t page_num);
-void create_index(Table* table, Index* index);
+void pager_mark_dirty(Pager* pager, uint32_t page_num);
+void pager_commit(Pager* pager);
 Cursor* table_find(Table* table, uint32_t key);
+Cursor* table_find_from_hint(Table* table, uint32_t hint_page_num, uint32_t key);
 void leaf_node_delete(Cursor* cursor, uint32_t key);
+void leaf_node_rebalance(Table* table, uint32_t parent_page_num, uint32_t index);
+void internal_node_insert(Table* table, uint32_t parent_page_num, uint32_t child_page_num);
+void internal_node_rebalance(Table* table, uint32_t parent_page_num, uint32_t index);
+uint32_t internal_node_child_index(void* node, uint32_t child_page_num);
+void table_counts_add(Table* table, uint32_t page_num, uint32_t key, int32_t delta);
+void table_counts_flush(Table* table);
+uint32_t node_row_count(void* node);
 ExecuteResult execute_delete(Statement* statement, Table* table);
 void* get_page(Pager* pager, uint32_t page_num);
 NodeType get_node_type(void* node);
@@ -204,394 +541,2381 @@ uint32_t* internal_node_right_child(void* node);
 void print_leaf_node(void* node, uint32_t indentation_level);
 void print_internal_node(Pager* pager, void* node, uint32_t indentation_level, uint32_t depth_limit);
 void print_tree(Pager* pager, uint32_t page_num, uint32_t indentation_level, uint32_t depth_limit);
+void index_insert(Table* table, const char* username, uint32_t id);
+void index_delete(Table* table, const char* username, uint32_t id);
+void index_build(Table* table);
+void print_index(Table* table);
+void bloom_filters_open(Table* table);
+void bloom_filters_save(Table* table);
+void bloom_filters_touch(Table* table);
+void print_bloom_stats(Table* table);
+void table_bulk_load(Table* table, const char* filename, uint32_t fill_factor);
+void table_reindex(Table* table);
+uint8_t* record_column_length(void* record, Column column);
+const FilterKernels* filter_kernels_named(const char* name);
+const FilterKernels* filter_kernels_best();
+void table_rollback(Table* table);
+uint32_t wal_checksum(uint32_t seed, const void* data, size_t length);
+void wal_pwrite(int file_descriptor, const void* buffer, size_t length, off_t offset);
+void wal_fsync(int file_descriptor);
 
 
-void* get_page(Pager* pager, uint32_t page_num) {
-  if (page_num > TABLE_MAX_PAGES) {
-    printf("Tentativa de recuperar uma pagina fora dos limites. %d > %d\n", page_num, TABLE_MAX_PAGES);
-    exit(EXIT_FAILURE);
+/**
+ * Compressão de páginas
+ * Codec LZ no estilo do LZ4: sequências de literais seguidas de uma cópia de até
+ * 64 KB para trás. As repetições de uma página (zeros do espaço livre, domínios de
+ * email, prefixos de username) viram cópias de poucos bytes.
+ * Cada sequência começa com um token: 4 bits para o número de literais e 4 bits
+ * para o tamanho da cópia menos LZ_MIN_MATCH; o valor 15 continua em bytes extras.
+ */
+#define LZ_HASH_BITS 12
+#define LZ_MIN_MATCH 4
+#define LZ_NO_POSITION UINT16_MAX
+
+uint32_t lz_read32(const uint8_t* source) {
+  uint32_t value;
+  memcpy(&value, source, sizeof(value));
+  return value;
+}
+
+bool lz_write_length(uint8_t* destination, uint32_t* out, uint32_t capacity, uint32_t length) {
+  while (length >= 255) {
+    if (*out >= capacity) {
+      return false;
+    }
+    destination[(*out)++] = 255;
+    length -= 255;
+  }
+  if (*out >= capacity) {
+    return false;
   }
+  destination[(*out)++] = length;
+  return true;
+}
+
+// grava uma sequência; match_length 0 marca a última, só com literais
+bool lz_write_sequence(uint8_t* destination, uint32_t* out, uint32_t capacity,
+                       const uint8_t* literals, uint32_t literal_length,
+                       uint32_t match_offset, uint32_t match_length) {
+  if (*out >= capacity) {
+    return false;
+  }
+  uint32_t match_code = match_length ? match_length - LZ_MIN_MATCH : 0;
+  uint8_t* token = &destination[(*out)++];
+  *token = ((literal_length < 15 ? literal_length : 15) << 4) | (match_code < 15 ? match_code : 15);
+
+  if (literal_length >= 15 && !lz_write_length(destination, out, capacity, literal_length - 15)) {
+    return false;
+  }
+  if (*out + literal_length > capacity) {
+    return false;
+  }
+  memcpy(destination + *out, literals, literal_length);
+  *out += literal_length;
 
-  if (pager->pages[page_num] == NULL) {
-    // não encontrou no cache. Aloca memória e faz a leitura do arquivo
-    void* page = malloc(PAGE_SIZE);
-    uint32_t num_pages = pager->file_length / PAGE_SIZE;
+  if (match_length == 0) {
+    return true;
+  }
+  if (*out + 2 > capacity) {
+    return false;
+  }
+  destination[(*out)++] = match_offset & 0xff;
+  destination[(*out)++] = match_offset >> 8;
+  if (match_code >= 15 && !lz_write_length(destination, out, capacity, match_code - 15)) {
+    return false;
+  }
+  return true;
+}
 
-    // salva uma página parcial no fim do arquivo
-    if (pager->file_length % PAGE_SIZE) {
-      num_pages += 1;
+// Devolve o tamanho comprimido, ou 0 se não couber em capacity
+uint32_t lz_compress(const uint8_t* source, uint32_t length, uint8_t* destination, uint32_t capacity) {
+  uint16_t table[1 << LZ_HASH_BITS];
+  memset(table, 0xff, sizeof(table));
+
+  uint32_t anchor = 0;
+  uint32_t position = 0;
+  uint32_t out = 0;
+  while (position + LZ_MIN_MATCH <= length) {
+    uint32_t sequence = lz_read32(source + position);
+    uint32_t hash = (sequence * 2654435761u) >> (32 - LZ_HASH_BITS);
+    uint32_t candidate = table[hash];
+    table[hash] = position;
+
+    if (candidate == LZ_NO_POSITION || lz_read32(source + candidate) != sequence) {
+      position++;
+      continue;
+    }
+    uint32_t match_length = LZ_MIN_MATCH;
+    while (position + match_length < length &&
+           source[candidate + match_length] == source[position + match_length]) {
+      match_length++;
     }
+    if (!lz_write_sequence(destination, &out, capacity, source + anchor, position - anchor,
+                           position - candidate, match_length)) {
+      return 0;
+    }
+    position += match_length;
+    anchor = position;
+  }
 
-    if (page_num <= num_pages) {
-      lseek(pager->file_descriptor, page_num * PAGE_SIZE, SEEK_SET);
-      ssize_t bytes_read = read(pager->file_descriptor, page, PAGE_SIZE);
-      if (bytes_read == -1) {
-        printf("Erro ao ler o arquivo: %d\n", errno);
-        exit(EXIT_FAILURE);
-      }
+  if (!lz_write_sequence(destination, &out, capacity, source + anchor, length - anchor, 0, 0)) {
+    return 0;
+  }
+  return out;
+}
+
+bool lz_read_length(const uint8_t* source, uint32_t* in, uint32_t length, uint32_t* value) {
+  uint8_t byte;
+  do {
+    if (*in >= length) {
+      return false;
     }
+    byte = source[(*in)++];
+    *value += byte;
+  } while (byte == 255);
+  return true;
+}
 
-    pager->pages[page_num] = page;
+// Descomprime exatamente capacity bytes; devolve false se os dados estiverem corrompidos
+bool lz_decompress(const uint8_t* source, uint32_t length, uint8_t* destination, uint32_t capacity) {
+  uint32_t in = 0;
+  uint32_t out = 0;
+  while (in < length) {
+    uint8_t token = source[in++];
+    uint32_t literal_length = token >> 4;
+    if (literal_length == 15 && !lz_read_length(source, &in, length, &literal_length)) {
+      return false;
+    }
+    if (in + literal_length > length || out + literal_length > capacity) {
+      return false;
+    }
+    memcpy(destination + out, source + in, literal_length);
+    in += literal_length;
+    out += literal_length;
+    if (in == length) {
+      break; // última sequência, sem cópia
+    }
 
-    if (page_num >= pager->num_pages) {
-      pager->num_pages = page_num + 1;
+    if (in + 2 > length) {
+      return false;
+    }
+    uint32_t match_offset = source[in] | (source[in + 1] << 8);
+    in += 2;
+    uint32_t match_length = token & 0x0f;
+    if (match_length == 15 && !lz_read_length(source, &in, length, &match_length)) {
+      return false;
+    }
+    match_length += LZ_MIN_MATCH;
+    if (match_offset == 0 || match_offset > out || out + match_length > capacity) {
+      return false;
     }
+    // a cópia pode se sobrepor ao que está sendo escrito (sequências repetidas)
+    for (uint32_t i = 0; i < match_length; i++) {
+      destination[out + i] = destination[out - match_offset + i];
+    }
+    out += match_length;
   }
-
-  return pager->pages[page_num];
+  return out == capacity;
 }
 
-// Funções de acesso aos campos dos nós
-uint32_t* leaf_node_num_cells(void* node) {
-  return node + LEAF_NODE_NUM_CELLS_OFFSET;
+/**
+ * Arquivo comprimido
+ * As páginas comprimidas ficam em extensões de tamanho variável, contadas em setores
+ * de COMPRESSED_SECTOR_SIZE bytes. O mapa página -> extensão é dividido em blocos de
+ * COMPRESSED_CHUNK_PAGES entradas, e um diretório guarda onde está cada bloco.
+ * Nada é sobrescrito no lugar: o checkpoint grava as páginas e os blocos alterados
+ * em setores livres, sincroniza, e só então grava o superbloco que aponta para o
+ * novo diretório. Os dois superblocos (setores 0 e 1) se alternam, e na abertura vale
+ * o de maior geração com checksum válido, então uma interrupção no meio do
+ * checkpoint deixa a versão anterior intacta e o WAL refaz o resto.
+ */
+uint32_t compressed_checksum(const uint32_t* superblock) {
+  return wal_checksum(COMPRESSED_MAGIC, superblock, COMPRESSED_SUPERBLOCK_FIELDS * sizeof(uint32_t));
 }
 
-void* leaf_node_cell(void* node, uint32_t cell_num) {
-  return node + LEAF_NODE_HEADER_SIZE + cell_num * LEAF_NODE_CELL_SIZE;
+void compressed_pread(int file_descriptor, void* buffer, size_t length, off_t offset) {
+  if (pread(file_descriptor, buffer, length, offset) != (ssize_t)length) {
+    printf("Erro ao ler o arquivo: %d\n", errno);
+    exit(EXIT_FAILURE);
+  }
 }
 
-uint32_t* leaf_node_key(void* node, uint32_t cell_num) {
-  return leaf_node_cell(node, cell_num);
+uint32_t compressed_sectors_for(uint32_t length) {
+  return (length + COMPRESSED_SECTOR_SIZE - 1) / COMPRESSED_SECTOR_SIZE;
 }
 
-void* leaf_node_value(void* node, uint32_t cell_num) {
-  return leaf_node_cell(node, cell_num) + LEAF_NODE_KEY_SIZE;
+bool compressed_sector_used(CompressedFile* file, uint32_t sector) {
+  return sector < file->num_sectors && (file->sector_bitmap[sector / 8] & (1 << (sector % 8)));
 }
 
-void initialize_leaf_node(void* node) {
-  set_node_type(node, NODE_LEAF);
-  set_node_root(node, false);
-  *leaf_node_num_cells(node) = 0;
-  *leaf_node_next_leaf(node) = 0;
+void compressed_mark_sectors(CompressedFile* file, uint32_t sector, uint32_t count, bool used) {
+  if (sector + count > file->num_sectors) {
+    file->num_sectors = sector + count;
+  }
+  uint32_t needed = file->num_sectors / 8 + 1;
+  if (needed > file->bitmap_capacity) {
+    uint32_t new_capacity = file->bitmap_capacity ? file->bitmap_capacity : 1024;
+    while (new_capacity < needed) {
+      new_capacity *= 2;
+    }
+    file->sector_bitmap = realloc(file->sector_bitmap, new_capacity);
+    memset(file->sector_bitmap + file->bitmap_capacity, 0, new_capacity - file->bitmap_capacity);
+    file->bitmap_capacity = new_capacity;
+  }
+  for (uint32_t i = sector; i < sector + count; i++) {
+    if (used) {
+      file->sector_bitmap[i / 8] |= 1 << (i % 8);
+    } else {
+      file->sector_bitmap[i / 8] &= ~(1 << (i % 8));
+    }
+  }
 }
 
-uint32_t* internal_node_num_keys(void* node) {
-  return node + INTERNAL_NODE_NUM_KEYS_OFFSET;
+// Procura count setores livres seguidos a partir da última alocação; sem espaço, o arquivo cresce
+uint32_t compressed_allocate(CompressedFile* file, uint32_t count) {
+  uint32_t start = file->allocation_hint;
+  for (int pass = 0; pass < 2; pass++) {
+    uint32_t run = 0;
+    for (uint32_t sector = start; sector < file->num_sectors; sector++) {
+      run = compressed_sector_used(file, sector) ? 0 : run + 1;
+      if (run == count) {
+        uint32_t first = sector + 1 - count;
+        compressed_mark_sectors(file, first, count, true);
+        file->allocation_hint = sector + 1;
+        return first;
+      }
+    }
+    start = COMPRESSED_SUPERBLOCKS;
+  }
+
+  uint32_t first = file->num_sectors;
+  compressed_mark_sectors(file, first, count, true);
+  file->allocation_hint = file->num_sectors;
+  return first;
 }
 
-void initialize_internal_node(void* node) {
-  set_node_type(node, NODE_INTERNAL);
-  set_node_root(node, false);
-  *internal_node_num_keys(node) = 0;
+// Setores que a versão confirmada ainda usa: só ficam livres depois do próximo superbloco
+void compressed_release_later(CompressedFile* file, uint32_t sector, uint32_t count) {
+  if (count == 0) {
+    return;
+  }
+  if (file->num_pending_free + 2 > file->pending_free_capacity) {
+    file->pending_free_capacity = file->pending_free_capacity ? file->pending_free_capacity * 2 : 64;
+    file->pending_free = realloc(file->pending_free, file->pending_free_capacity * sizeof(uint32_t));
+  }
+  file->pending_free[file->num_pending_free++] = sector;
+  file->pending_free[file->num_pending_free++] = count;
 }
 
-uint32_t* internal_node_right_child(void* node) {
-  return node + INTERNAL_NODE_RIGHT_CHILD_OFFSET;
+PageExtent* compressed_map_entry(CompressedFile* file, uint32_t page_num) {
+  if (page_num >= file->map_capacity) {
+    uint32_t new_capacity = file->map_capacity ? file->map_capacity : COMPRESSED_CHUNK_PAGES;
+    while (new_capacity <= page_num) {
+      new_capacity *= 2;
+    }
+    file->map = realloc(file->map, new_capacity * sizeof(PageExtent));
+    memset(file->map + file->map_capacity, 0, (new_capacity - file->map_capacity) * sizeof(PageExtent));
+    file->map_capacity = new_capacity;
+
+    uint32_t chunk_capacity = new_capacity / COMPRESSED_CHUNK_PAGES;
+    file->chunk_sectors = realloc(file->chunk_sectors, chunk_capacity * sizeof(uint32_t));
+    file->dirty_chunks = realloc(file->dirty_chunks, chunk_capacity * sizeof(bool));
+    for (uint32_t i = file->chunk_capacity; i < chunk_capacity; i++) {
+      file->chunk_sectors[i] = 0;
+      file->dirty_chunks[i] = false;
+    }
+    file->chunk_capacity = chunk_capacity;
+  }
+  if (page_num >= file->num_pages) {
+    file->num_pages = page_num + 1;
+  }
+  return &file->map[page_num];
 }
 
-uint32_t* internal_node_cell(void* node, uint32_t cell_num) {
-  return node + INTERNAL_NODE_HEADER_SIZE + cell_num * INTERNAL_NODE_CELL_SIZE;
+void compressed_write_superblock(CompressedFile* file) {
+  file->generation++;
+  uint32_t superblock[COMPRESSED_SECTOR_SIZE / sizeof(uint32_t)] = {
+    COMPRESSED_MAGIC, PAGE_SIZE, file->generation, file->num_pages,
+    file->directory_sector, file->directory_sectors, file->num_sectors, 0
+  };
+  superblock[COMPRESSED_SUPERBLOCK_FIELDS] = compressed_checksum(superblock);
+  wal_pwrite(file->file_descriptor, superblock, COMPRESSED_SECTOR_SIZE,
+             (off_t)(file->generation % COMPRESSED_SUPERBLOCKS) * COMPRESSED_SECTOR_SIZE);
 }
 
-uint32_t* internal_node_child(void* node, uint32_t child_num) {
-  uint32_t num_keys = *internal_node_num_keys(node);
-  if (child_num > num_keys) {
-    printf("Tentativa de acesso child_num %d > num_keys %d\n", child_num, num_keys);
-    exit(EXIT_FAILURE);
-  } else if (child_num == num_keys) {
-    return internal_node_right_child(node);
-  } else {
-    return internal_node_cell(node, child_num);
+// Um arquivo vazio criado com DB_OPEN_COMPRESS, ou um que começa com um superbloco
+bool compressed_file_detect(int file_descriptor) {
+  for (uint32_t slot = 0; slot < COMPRESSED_SUPERBLOCKS; slot++) {
+    uint32_t magic = 0;
+    if (pread(file_descriptor, &magic, sizeof(magic), (off_t)slot * COMPRESSED_SECTOR_SIZE) == sizeof(magic) &&
+        magic == COMPRESSED_MAGIC) {
+      return true;
+    }
   }
+  return false;
 }
 
-uint32_t* internal_node_key(void* node, uint32_t key_num) {
-  return (void*)internal_node_cell(node, key_num) + INTERNAL_NODE_CHILD_SIZE;
+CompressedFile* compressed_file_open(int file_descriptor) {
+  CompressedFile* file = calloc(1, sizeof(CompressedFile));
+  file->file_descriptor = file_descriptor;
+  pthread_mutex_init(&file->lock, NULL);
+  compressed_mark_sectors(file, 0, COMPRESSED_SUPERBLOCKS, true);
+  file->allocation_hint = COMPRESSED_SUPERBLOCKS;
+
+  // o superbloco válido de maior geração
+  uint32_t best[COMPRESSED_SECTOR_SIZE / sizeof(uint32_t)] = {0};
+  bool found = false;
+  for (uint32_t slot = 0; slot < COMPRESSED_SUPERBLOCKS; slot++) {
+    uint32_t superblock[COMPRESSED_SECTOR_SIZE / sizeof(uint32_t)] = {0};
+    if (pread(file_descriptor, superblock, COMPRESSED_SECTOR_SIZE,
+              (off_t)slot * COMPRESSED_SECTOR_SIZE) != COMPRESSED_SECTOR_SIZE) {
+      continue;
+    }
+    if (superblock[0] != COMPRESSED_MAGIC || superblock[1] != PAGE_SIZE ||
+        superblock[COMPRESSED_SUPERBLOCK_FIELDS] != compressed_checksum(superblock)) {
+      continue;
+    }
+    if (!found || superblock[2] > best[2]) {
+      memcpy(best, superblock, sizeof(best));
+      found = true;
+    }
+  }
+
+  if (!found) {
+    // arquivo novo: grava o primeiro superbloco para que o formato seja reconhecido
+    compressed_write_superblock(file);
+    wal_fsync(file_descriptor);
+    return file;
+  }
+
+  file->generation = best[2];
+  file->directory_sector = best[4];
+  file->directory_sectors = best[5];
+  // o commit trunca o arquivo depois de gravar o superbloco, então o arquivo pode ser menor
+  off_t file_length = lseek(file_descriptor, 0, SEEK_END);
+  uint32_t num_sectors = (file_length + COMPRESSED_SECTOR_SIZE - 1) / COMPRESSED_SECTOR_SIZE;
+  if (num_sectors > best[6]) {
+    num_sectors = best[6];
+  }
+  compressed_mark_sectors(file, COMPRESSED_SUPERBLOCKS, num_sectors - COMPRESSED_SUPERBLOCKS, false);
+  compressed_mark_sectors(file, file->directory_sector, file->directory_sectors, true);
+
+  uint32_t num_pages = best[3];
+  uint32_t num_chunks = (num_pages + COMPRESSED_CHUNK_PAGES - 1) / COMPRESSED_CHUNK_PAGES;
+  uint32_t* directory = malloc(num_chunks * sizeof(uint32_t) + 1);
+  compressed_pread(file_descriptor, directory, num_chunks * sizeof(uint32_t),
+                   (off_t)file->directory_sector * COMPRESSED_SECTOR_SIZE);
+  if (num_pages > 0) {
+    compressed_map_entry(file, num_pages - 1);
+  }
+  for (uint32_t chunk = 0; chunk < num_chunks; chunk++) {
+    file->chunk_sectors[chunk] = directory[chunk];
+    if (directory[chunk] == 0) {
+      continue;
+    }
+    compressed_pread(file_descriptor, file->map + chunk * COMPRESSED_CHUNK_PAGES, COMPRESSED_CHUNK_SIZE,
+                     (off_t)directory[chunk] * COMPRESSED_SECTOR_SIZE);
+    compressed_mark_sectors(file, directory[chunk], compressed_sectors_for(COMPRESSED_CHUNK_SIZE), true);
+  }
+  free(directory);
+
+  for (uint32_t page_num = 0; page_num < num_pages; page_num++) {
+    PageExtent* extent = &file->map[page_num];
+    if (extent->length > 0) {
+      compressed_mark_sectors(file, extent->sector, compressed_sectors_for(extent->length), true);
+      file->bytes_uncompressed += PAGE_SIZE;
+      file->bytes_compressed += extent->length;
+    }
+  }
+  return file;
 }
 
-NodeType get_node_type(void* node) {
-  uint8_t value = *((uint8_t*)(node + NODE_TYPE_OFFSET));
-  return (NodeType)value;
+// Lê uma página do arquivo comprimido; páginas que nunca foram gravadas voltam zeradas
+void compressed_file_read_page(CompressedFile* file, uint32_t page_num, void* destination) {
+  pthread_mutex_lock(&file->lock);
+  PageExtent extent = {0, 0};
+  if (page_num < file->num_pages) {
+    extent = file->map[page_num];
+  }
+  pthread_mutex_unlock(&file->lock);
+
+  if (extent.length == 0) {
+    memset(destination, 0, PAGE_SIZE);
+    return;
+  }
+  if (extent.length == PAGE_SIZE) {
+    compressed_pread(file->file_descriptor, destination, PAGE_SIZE,
+                     (off_t)extent.sector * COMPRESSED_SECTOR_SIZE);
+    return;
+  }
+  uint8_t compressed[PAGE_SIZE];
+  compressed_pread(file->file_descriptor, compressed, extent.length,
+                   (off_t)extent.sector * COMPRESSED_SECTOR_SIZE);
+  if (!lz_decompress(compressed, extent.length, destination, PAGE_SIZE)) {
+    printf("Página %d comprimida está corrompida.\n", page_num);
+    exit(EXIT_FAILURE);
+  }
 }
 
-uint32_t* node_parent(void* node) {
-  return node + PARENT_POINTER_OFFSET;
+// Grava a página em uma extensão nova; a antiga só é liberada no próximo commit
+void compressed_file_write_page(CompressedFile* file, uint32_t page_num, const void* page) {
+  uint8_t compressed[PAGE_SIZE];
+  uint32_t length = lz_compress(page, PAGE_SIZE, compressed, PAGE_SIZE - COMPRESSED_SECTOR_SIZE);
+  const void* data = compressed;
+  if (length == 0) {
+    // não economiza nem um setor: guarda a página como está
+    length = PAGE_SIZE;
+    data = page;
+  }
+
+  pthread_mutex_lock(&file->lock);
+  PageExtent* extent = compressed_map_entry(file, page_num);
+  if (extent->length > 0) {
+    compressed_release_later(file, extent->sector, compressed_sectors_for(extent->length));
+    file->bytes_uncompressed -= PAGE_SIZE;
+    file->bytes_compressed -= extent->length;
+  }
+  extent->sector = compressed_allocate(file, compressed_sectors_for(length));
+  extent->length = length;
+  file->dirty_chunks[page_num / COMPRESSED_CHUNK_PAGES] = true;
+  file->bytes_uncompressed += PAGE_SIZE;
+  file->bytes_compressed += length;
+  uint32_t sector = extent->sector;
+  pthread_mutex_unlock(&file->lock);
+
+  wal_pwrite(file->file_descriptor, data, length, (off_t)sector * COMPRESSED_SECTOR_SIZE);
 }
+
 /**
- * Para um nó interno, o maior numero de chave é sempre a chave à direita
- * Para um nó folha, é o maior indice do nó.
+ * Confirma as páginas gravadas desde o último commit: grava os blocos do mapa
+ * alterados e um diretório novo, sincroniza, e troca o superbloco.
  */
-uint32_t get_node_max_key(void* node) {
-  switch (get_node_type(node)) {
-    case NODE_INTERNAL:
-      return *internal_node_key(node, *internal_node_num_keys(node) - 1);
-    case NODE_LEAF:
-      return *leaf_node_key(node, *leaf_node_num_cells(node) - 1);
+void compressed_file_commit(CompressedFile* file) {
+  pthread_mutex_lock(&file->lock);
+  uint32_t num_chunks = (file->num_pages + COMPRESSED_CHUNK_PAGES - 1) / COMPRESSED_CHUNK_PAGES;
+  uint32_t chunk_sectors = compressed_sectors_for(COMPRESSED_CHUNK_SIZE);
+  for (uint32_t chunk = 0; chunk < num_chunks; chunk++) {
+    if (!file->dirty_chunks[chunk]) {
+      continue;
+    }
+    if (file->chunk_sectors[chunk] != 0) {
+      compressed_release_later(file, file->chunk_sectors[chunk], chunk_sectors);
+    }
+    file->chunk_sectors[chunk] = compressed_allocate(file, chunk_sectors);
+    file->dirty_chunks[chunk] = false;
+    wal_pwrite(file->file_descriptor, file->map + chunk * COMPRESSED_CHUNK_PAGES, COMPRESSED_CHUNK_SIZE,
+               (off_t)file->chunk_sectors[chunk] * COMPRESSED_SECTOR_SIZE);
   }
-}
 
-bool is_node_root(void* node) {
-  uint8_t value = *((uint8_t*)(node + IS_ROOT_OFFSET));
-  return (bool)value;
-}
+  compressed_release_later(file, file->directory_sector, file->directory_sectors);
+  file->directory_sectors = compressed_sectors_for(num_chunks * sizeof(uint32_t));
+  file->directory_sector = file->directory_sectors ? compressed_allocate(file, file->directory_sectors) : 0;
+  wal_pwrite(file->file_descriptor, file->chunk_sectors, num_chunks * sizeof(uint32_t),
+             (off_t)file->directory_sector * COMPRESSED_SECTOR_SIZE);
+  pthread_mutex_unlock(&file->lock);
+
+  // o superbloco só aponta para a versão nova depois que ela está no disco
+  wal_fsync(file->file_descriptor);
+  pthread_mutex_lock(&file->lock);
+  compressed_write_superblock(file);
+  pthread_mutex_unlock(&file->lock);
+  wal_fsync(file->file_descriptor);
+
+  pthread_mutex_lock(&file->lock);
+  for (uint32_t i = 0; i < file->num_pending_free; i += 2) {
+    compressed_mark_sectors(file, file->pending_free[i], file->pending_free[i + 1], false);
+  }
+  file->num_pending_free = 0;
+  file->allocation_hint = COMPRESSED_SUPERBLOCKS;
 
-void set_node_root(void* node, bool is_root) {
-  uint8_t value = is_root;
-  *((uint8_t*)(node + IS_ROOT_OFFSET)) = value;
+  // devolve ao sistema os setores livres no fim do arquivo
+  uint32_t num_sectors = file->num_sectors;
+  while (num_sectors > COMPRESSED_SUPERBLOCKS && !compressed_sector_used(file, num_sectors - 1)) {
+    num_sectors--;
+  }
+  if (num_sectors < file->num_sectors) {
+    file->num_sectors = num_sectors;
+    if (ftruncate(file->file_descriptor, (off_t)num_sectors * COMPRESSED_SECTOR_SIZE) == -1) {
+      printf("Erro ao truncar o arquivo: %d\n", errno);
+      exit(EXIT_FAILURE);
+    }
+  }
+  pthread_mutex_unlock(&file->lock);
 }
 
-// serialização dos dados
-void serialize_row(Row* source, void* destination) {
-  memcpy(destination + ID_OFFSET, &(source->id), ID_SIZE);
-  strncpy(destination + USERNAME_OFFSET, source->username, USERNAME_SIZE);  // usando strncpy para inicializar todas as posicoes da string em memoria
-  strncpy(destination + EMAIL_OFFSET, source->email, EMAIL_SIZE);
-}
+typedef struct {
+  uint32_t sector;
+  uint32_t page_num;
+} CompressedExtentRef;
 
-void deserialize_row(void *source, Row* destination) {
-  memcpy(&(destination->id), source + ID_OFFSET, ID_SIZE);
-  memcpy(&(destination->username), source + USERNAME_OFFSET, USERNAME_SIZE);
-  memcpy(&(destination->email), source + EMAIL_OFFSET, EMAIL_SIZE);
+int compressed_extent_compare(const void* a, const void* b) {
+  uint32_t sector_a = ((const CompressedExtentRef*)a)->sector;
+  uint32_t sector_b = ((const CompressedExtentRef*)b)->sector;
+  return sector_a < sector_b ? 1 : sector_a > sector_b ? -1 : 0; // do fim para o começo
 }
 
-void leaf_node_insert(Cursor* cursor, uint32_t key, Row* value) {
-  void* node = get_page(cursor->table->pager, cursor->page_num);
+/**
+ * Cada checkpoint grava as páginas em setores novos antes de liberar os antigos,
+ * então depois de uma sequência de checkpoints o arquivo tem buracos no começo e as
+ * versões mais novas no fim. No fechamento, as extensões do fim descem para os
+ * buracos (do mesmo jeito, cópia antes da liberação) e o commit trunca o que sobrou.
+ */
+void compressed_file_compact(CompressedFile* file) {
+  pthread_mutex_lock(&file->lock);
+  CompressedExtentRef* extents = malloc((file->num_pages + 1) * sizeof(CompressedExtentRef));
+  uint32_t num_extents = 0;
+  for (uint32_t page_num = 0; page_num < file->num_pages; page_num++) {
+    if (file->map[page_num].length > 0) {
+      extents[num_extents].sector = file->map[page_num].sector;
+      extents[num_extents].page_num = page_num;
+      num_extents++;
+    }
+  }
+  qsort(extents, num_extents, sizeof(CompressedExtentRef), compressed_extent_compare);
+
+  // buracos do arquivo, em ordem; consumidos pelo começo à medida que recebem extensões
+  uint32_t* hole_starts = malloc((file->num_sectors / 2 + 1) * sizeof(uint32_t));
+  uint32_t* hole_lengths = malloc((file->num_sectors / 2 + 1) * sizeof(uint32_t));
+  uint32_t num_holes = 0;
+  for (uint32_t sector = COMPRESSED_SUPERBLOCKS; sector < file->num_sectors; sector++) {
+    if (compressed_sector_used(file, sector)) {
+      continue;
+    }
+    if (num_holes > 0 && hole_starts[num_holes - 1] + hole_lengths[num_holes - 1] == sector) {
+      hole_lengths[num_holes - 1]++;
+    } else {
+      hole_starts[num_holes] = sector;
+      hole_lengths[num_holes] = 1;
+      num_holes++;
+    }
+  }
 
-  uint32_t num_cells = *leaf_node_num_cells(node);
+  // uma extensão ocupa até PAGE_SIZE / COMPRESSED_SECTOR_SIZE setores; para cada tamanho,
+  // o primeiro buraco que ainda pode caber só anda para a frente
+  uint32_t first_hole[PAGE_SIZE / COMPRESSED_SECTOR_SIZE + 1];
+  memset(first_hole, 0, sizeof(first_hole));
+  uint8_t data[PAGE_SIZE];
+  uint32_t moved = 0;
+  for (uint32_t i = 0; i < num_extents; i++) {
+    PageExtent* extent = &file->map[extents[i].page_num];
+    uint32_t count = compressed_sectors_for(extent->length);
+    uint32_t* hole = &first_hole[count];
+    while (*hole < num_holes && hole_lengths[*hole] < count) {
+      (*hole)++;
+    }
+    if (*hole == num_holes || hole_starts[*hole] >= extent->sector) {
+      continue; // nenhum buraco antes da posição atual da extensão
+    }
+    uint32_t destination = hole_starts[*hole];
+    hole_starts[*hole] += count;
+    hole_lengths[*hole] -= count;
+
+    compressed_pread(file->file_descriptor, data, extent->length,
+                     (off_t)extent->sector * COMPRESSED_SECTOR_SIZE);
+    wal_pwrite(file->file_descriptor, data, extent->length, (off_t)destination * COMPRESSED_SECTOR_SIZE);
+    compressed_mark_sectors(file, destination, count, true);
+    compressed_release_later(file, extent->sector, count);
+    extent->sector = destination;
+    file->dirty_chunks[extents[i].page_num / COMPRESSED_CHUNK_PAGES] = true;
+    moved++;
+  }
+  free(hole_starts);
+  free(hole_lengths);
+  free(extents);
+  pthread_mutex_unlock(&file->lock);
 
-  if (num_cells >= LEAF_NODE_MAX_CELLS) {
-    // nó está cheio
-    leaf_node_split_and_insert(cursor, key, value);
+  if (moved == 0) {
     return;
   }
+  compressed_file_commit(file);
 
-  if (cursor->cell_num < num_cells) {
-    // abrir espaço para uma nova célula
-    for (uint32_t i = num_cells; i > cursor->cell_num; i--) {
-      memcpy(leaf_node_cell(node, i), leaf_node_cell(node, i - 1), LEAF_NODE_CELL_SIZE);
+  // se as extensões ocuparam os buracos, o mapa e o diretório foram para o fim do
+  // arquivo; regravados agora, vão para o espaço que as extensões deixaram
+  pthread_mutex_lock(&file->lock);
+  for (uint32_t chunk = 0; chunk < file->chunk_capacity; chunk++) {
+    file->dirty_chunks[chunk] = file->chunk_sectors[chunk] != 0;
+  }
+  pthread_mutex_unlock(&file->lock);
+  compressed_file_commit(file);
+}
+
+
+/**
+ * Write-ahead log
+ * Ao fim de cada comando as páginas alteradas são anexadas ao arquivo <banco>-wal
+ * como imagens completas, seguidas de um marcador de commit. Um thread em segundo
+ * plano grava o buffer do log e faz o fsync de todos os commits pendentes de uma vez
+ * (group commit) e, quando o log cresce, copia as páginas para o arquivo do banco
+ * (checkpoint). Enquanto uma página estiver no log, a leitura é feita a partir dele.
+ */
+uint32_t wal_checksum(uint32_t seed, const void* data, size_t length) {
+  const uint8_t* bytes = data;
+  uint32_t hash = seed;
+  for (size_t i = 0; i < length; i++) {
+    hash ^= bytes[i];
+    hash *= 16777619; // FNV-1a
+  }
+  return hash;
+}
+
+off_t* wal_index_entry(Wal* wal, uint32_t page_num) {
+  if (page_num >= wal->index_capacity) {
+    uint32_t new_capacity = wal->index_capacity ? wal->index_capacity : 64;
+    while (new_capacity <= page_num) {
+      new_capacity *= 2;
     }
+    wal->index = realloc(wal->index, new_capacity * sizeof(off_t));
+    memset(wal->index + wal->index_capacity, 0, (new_capacity - wal->index_capacity) * sizeof(off_t));
+    wal->index_capacity = new_capacity;
   }
+  return &wal->index[page_num];
+}
 
-  *(leaf_node_num_cells(node)) += 1;
-  *(leaf_node_key(node, cursor->cell_num)) = key;
-  serialize_row(value, leaf_node_value(node, cursor->cell_num));
+void wal_pread(int file_descriptor, void* buffer, size_t length, off_t offset) {
+  if (pread(file_descriptor, buffer, length, offset) != (ssize_t)length) {
+    printf("Erro ao ler o WAL: %d\n", errno);
+    exit(EXIT_FAILURE);
+  }
 }
 
-void set_node_type(void* node, NodeType type) {
-  uint8_t value = type;
-  *((uint8_t*)(node + NODE_TYPE_OFFSET)) = value;
+void wal_pwrite(int file_descriptor, const void* buffer, size_t length, off_t offset) {
+  if (pwrite(file_descriptor, buffer, length, offset) != (ssize_t)length) {
+    printf("Erro ao escrever: %d\n", errno);
+    exit(EXIT_FAILURE);
+  }
 }
 
-// void indent(uint32_t level) {
-//   for (uint32_t i = 0; i < level; i++) {
-//     printf("  ");
-//   }
-// }
+void wal_fsync(int file_descriptor) {
+  if (fsync(file_descriptor) == -1) {
+    printf("Erro ao sincronizar o arquivo: %d\n", errno);
+    exit(EXIT_FAILURE);
+  }
+}
 
-// void print_tree(Pager* pager, uint32_t page_num, uint32_t indentation_level) {
-//   void* node = get_page(pager, page_num);
-//   uint32_t num_keys, child;
+// Recomeça o log do início com um novo salt, invalidando os quadros antigos
+void wal_reset(Wal* wal) {
+  wal->salt++;
+  wal->checksum = wal->salt;
+  uint32_t header[WAL_HEADER_SIZE / sizeof(uint32_t)] = {WAL_MAGIC, PAGE_SIZE, wal->salt, 0};
+  if (ftruncate(wal->file_descriptor, 0) == -1) {
+    printf("Erro ao truncar o WAL: %d\n", errno);
+    exit(EXIT_FAILURE);
+  }
+  wal_pwrite(wal->file_descriptor, header, WAL_HEADER_SIZE, 0);
+  wal->end = wal->written = wal->synced = wal->backfilled = WAL_HEADER_SIZE;
+  wal->buffer_length = 0;
+  if (wal->index != NULL) {
+    memset(wal->index, 0, wal->index_capacity * sizeof(off_t));
+  }
+}
 
-//   switch (get_node_type(node)) {
-//     case (NODE_LEAF):
-//       num_keys = *leaf_node_num_cells(node);
-//       indent(indentation_level);
-//       printf("- leaf (size %d)\n", num_keys);
-//       for (uint32_t i = 0; i < num_keys; i++) {
-//         indent(indentation_level + 1);
-//         printf("- %d\n", *leaf_node_key(node, i));
-//       }
-//       break;
-//     case (NODE_INTERNAL):
-//       num_keys = *internal_node_num_keys(node);
-//       indent(indentation_level);
-//       printf("- internal (size %d)\n", num_keys);
-//       for (uint32_t i = 0; i < num_keys; i++) {
-//         child = *internal_node_child(node, i);
-//         print_tree(pager, child, indentation_level + 1);
-
-//         indent(indentation_level + 1);
-//         printf("- key %d\n", *internal_node_key(node, i));
-//       }
-//       child = *internal_node_right_child(node);
-//       print_tree(pager, child, indentation_level + 1);
-//       break;
-//   }
-// }
-
-void indent(uint32_t level) {
-  for (uint32_t i = 0; i < level; i++) {
-    printf("  ");
+// Espera o fim do fsync ou checkpoint em andamento. Deve ser chamada com o lock
+void wal_wait_idle(Wal* wal) {
+  while (wal->busy) {
+    pthread_cond_wait(&wal->done, &wal->lock);
   }
 }
 
-void print_leaf_node(void* node, uint32_t indentation_level) {
-  uint32_t num_keys = *leaf_node_num_cells(node);
-  indent(indentation_level);
-  printf("- leaf (size %d)\n", num_keys);
-  for (uint32_t i = 0; i < num_keys; i++) {
-    if (i < 3 || i >= num_keys - 3) {
-      indent(indentation_level + 1);
-      printf("- %d\n", *leaf_node_key(node, i));
-    } else if (i == 3) {
-      indent(indentation_level + 1);
-      printf("- ...\n");
+/**
+ * Percorre os quadros válidos do log até `end`, guardando em offsets o quadro
+ * mais recente de cada página que pertence a um commit completo.
+ * Devolve o fim do último commit encontrado.
+ */
+off_t wal_scan(Wal* wal, off_t end, off_t** offsets, uint32_t* capacity) {
+  char* frame = malloc(WAL_FRAME_SIZE);
+  uint32_t checksum = wal->salt;
+  off_t last_commit = WAL_HEADER_SIZE;
+
+  for (int pass = 0; pass < 2; pass++) {
+    checksum = wal->salt;
+    for (off_t offset = WAL_HEADER_SIZE; offset + WAL_FRAME_SIZE <= end; offset += WAL_FRAME_SIZE) {
+      if (pass == 1 && offset >= last_commit) {
+        break;
+      }
+      uint32_t* header = (uint32_t*)frame;
+      if (pass == 0) {
+        wal_pread(wal->file_descriptor, frame, WAL_FRAME_SIZE, offset);
+        checksum = wal_checksum(checksum, frame, 3 * sizeof(uint32_t));
+        checksum = wal_checksum(checksum, frame + WAL_FRAME_HEADER_SIZE, PAGE_SIZE);
+        if (header[2] != wal->salt || header[3] != checksum) {
+          break; // quadro de uma geração anterior ou gravado pela metade
+        }
+        if (header[1] != 0) {
+          last_commit = offset + WAL_FRAME_SIZE;
+        }
+        continue;
+      }
+      // a segunda passada só visita quadros já conferidos na primeira: basta o cabeçalho
+      wal_pread(wal->file_descriptor, frame, WAL_FRAME_HEADER_SIZE, offset);
+      uint32_t page_num = header[0];
+      if (page_num >= *capacity) {
+        uint32_t new_capacity = *capacity ? *capacity : 64;
+        while (new_capacity <= page_num) {
+          new_capacity *= 2;
+        }
+        *offsets = realloc(*offsets, new_capacity * sizeof(off_t));
+        memset(*offsets + *capacity, 0, (new_capacity - *capacity) * sizeof(off_t));
+        *capacity = new_capacity;
+      }
+      (*offsets)[page_num] = offset;
     }
   }
+
+  free(frame);
+  return last_commit;
 }
-void print_internal_node(Pager* pager, void* node, uint32_t indentation_level, uint32_t depth_limit) {
-  uint32_t num_keys = *internal_node_num_keys(node);
-  indent(indentation_level);
-  printf("- internal (size %d)\n", num_keys);
-  for (uint32_t i = 0; i < num_keys; i++) {
-    uint32_t child = *internal_node_child(node, i);
-    if (depth_limit > 0) {
-      print_tree(pager, child, indentation_level + 1, depth_limit - 1);
+
+/**
+ * Copia para o banco a última imagem de cada página gravada no log até `end`
+ * e sincroniza o arquivo do banco. Não segura o lock: só lê a parte já sincronizada do log.
+ */
+void wal_backfill(Wal* wal, off_t end) {
+  off_t* offsets = NULL;
+  uint32_t capacity = 0;
+  wal_scan(wal, end, &offsets, &capacity);
+
+  char* page = malloc(PAGE_SIZE);
+  for (uint32_t page_num = 0; page_num < capacity; page_num++) {
+    if (offsets[page_num] == 0) {
+      continue;
+    }
+    wal_pread(wal->file_descriptor, page, PAGE_SIZE, offsets[page_num] + WAL_FRAME_HEADER_SIZE);
+    if (wal->compressed) {
+      compressed_file_write_page(wal->compressed, page_num, page);
     } else {
-      indent(indentation_level + 1);
-      printf("- ...\n");
+      wal_pwrite(wal->db_file_descriptor, page, PAGE_SIZE, (off_t)page_num * PAGE_SIZE);
     }
-
-    indent(indentation_level + 1);
-    printf("- key %d\n", *internal_node_key(node, i));
+    wal->pages_checkpointed++;
   }
-  uint32_t right_child = *internal_node_right_child(node);
-  if (depth_limit > 0) {
-    print_tree(pager, right_child, indentation_level + 1, depth_limit - 1);
+  if (wal->compressed) {
+    compressed_file_commit(wal->compressed);
   } else {
-    indent(indentation_level + 1);
-    printf("- ...\n");
+    wal_fsync(wal->db_file_descriptor);
   }
+
+  free(page);
+  free(offsets);
 }
 
-void print_tree(Pager* pager, uint32_t page_num, uint32_t indentation_level, uint32_t depth_limit) {
-  void* node = get_page(pager, page_num);
+// Grava o buffer e sincroniza o log. Deve ser chamada com o lock
+void wal_sync_locked(Wal* wal) {
+  wal_wait_idle(wal);
+  if (wal->buffer_length > 0) {
+    wal_pwrite(wal->file_descriptor, wal->buffer, wal->buffer_length, wal->written);
+    wal->written += wal->buffer_length;
+    wal->buffer_length = 0;
+  }
+  if (wal->synced == wal->written) {
+    return;
+  }
 
-  switch (get_node_type(node)) {
-    case (NODE_LEAF):
-      print_leaf_node(node, indentation_level);
-      break;
-    case (NODE_INTERNAL):
-      print_internal_node(pager, node, indentation_level, depth_limit);
-      break;
+  // o fsync roda sem o lock: commits que chegarem enquanto isso entram no próximo grupo
+  off_t target = wal->written;
+  uint64_t target_commits = wal->commits;
+  wal->busy = true;
+  pthread_mutex_unlock(&wal->lock);
+  if (fdatasync(wal->file_descriptor) == -1) {
+    printf("Erro ao sincronizar o WAL: %d\n", errno);
+    exit(EXIT_FAILURE);
   }
+  pthread_mutex_lock(&wal->lock);
+  wal->busy = false;
+  wal->synced = target;
+  wal->synced_commits = target_commits;
+  wal->syncs++;
+  pthread_cond_broadcast(&wal->done);
 }
 
-void print_constants() {
-  printf("ROW_SIZE: %d\n", ROW_SIZE);
-  printf("COMMON_NODE_HEADER_SIZE: %d\n", COMMON_NODE_HEADER_SIZE);
-  printf("LEAF_NODE_HEADER_SIZE: %d\n", LEAF_NODE_HEADER_SIZE);
-  printf("LEAF_NODE_CELL_SIZE: %d\n", LEAF_NODE_CELL_SIZE);
-  printf("LEAF_NODE_SPACE_FOR_CELLS: %d\n", LEAF_NODE_SPACE_FOR_CELLS);
-  printf("LEAF_NODE_MAX_CELLS: %d\n", LEAF_NODE_MAX_CELLS);
+// Copia para o banco tudo o que já foi sincronizado. Deve ser chamada com o lock
+void wal_checkpoint_locked(Wal* wal) {
+  wal_wait_idle(wal);
+  if (wal->backfilled == wal->synced) {
+    return;
+  }
+
+  off_t target = wal->synced;
+  wal->busy = true;
+  pthread_mutex_unlock(&wal->lock);
+  wal_backfill(wal, target);
+  pthread_mutex_lock(&wal->lock);
+  wal->busy = false;
+  wal->backfilled = target;
+  wal->checkpoints++;
+  if (wal->end == wal->backfilled) {
+    wal_reset(wal);
+  }
+  pthread_cond_broadcast(&wal->done);
 }
 
-// Dados do input
-InputBuffer* new_input_buffer() {
-  InputBuffer* input_buffer = malloc(sizeof(InputBuffer));
-  input_buffer->buffer = NULL;
-  input_buffer->buffer_length = 0;
-  input_buffer->input_length = 0;
+void* wal_thread_main(void* argument) {
+  Wal* wal = argument;
+
+  pthread_mutex_lock(&wal->lock);
+  while (!wal->shutdown) {
+    if (wal->buffer_length == 0 && !wal->checkpoint_requested) {
+      if (wal->sync_mode == SYNC_NORMAL) {
+        // modo normal: os commits não esperam, o thread sincroniza a cada janela
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += WAL_GROUP_COMMIT_MS * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+          deadline.tv_sec++;
+          deadline.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&wal->work, &wal->lock, &deadline);
+      } else {
+        pthread_cond_wait(&wal->work, &wal->lock);
+      }
+      continue;
+    }
 
-  return input_buffer;
-}
+    wal_sync_locked(wal);
+    if (wal->checkpoint_requested || wal->synced - wal->backfilled >= WAL_CHECKPOINT_BYTES) {
+      wal->checkpoint_requested = false;
+      wal_checkpoint_locked(wal);
+    }
+  }
+  pthread_mutex_unlock(&wal->lock);
 
-Cursor* leaf_node_find(Table* table, uint32_t page_num, uint32_t key) {
-  void* node = get_page(table->pager, page_num);
-  uint32_t num_cells = *leaf_node_num_cells(node);
+  return NULL;
+}
 
-  Cursor* cursor = malloc(sizeof(Cursor));
-  cursor->table = table;
-  cursor->page_num = page_num;
-  cursor->end_of_table = false;
+/**
+ * Abre o log ao lado do banco. Se sobrou um log de uma execução interrompida,
+ * os commits completos são aplicados ao banco antes de qualquer leitura.
+ * compressed é o arquivo comprimido do banco, ou NULL.
+ */
+Wal* wal_open(const char* db_filename, int db_file_descriptor, CompressedFile* compressed) {
+  Wal* wal = calloc(1, sizeof(Wal));
+  size_t path_length = strlen(db_filename) + sizeof(WAL_SUFFIX);
+  wal->path = malloc(path_length);
+  snprintf(wal->path, path_length, "%s%s", db_filename, WAL_SUFFIX);
+
+  wal->file_descriptor = open(wal->path, O_RDWR | O_CREAT, S_IWUSR | S_IRUSR);
+  if (wal->file_descriptor == -1) {
+    printf("Não foi possível abrir o WAL\n");
+    exit(EXIT_FAILURE);
+  }
+  wal->db_file_descriptor = db_file_descriptor;
+  wal->compressed = compressed;
+  wal->sync_mode = SYNC_FULL;
+
+  off_t length = lseek(wal->file_descriptor, 0, SEEK_END);
+  uint32_t header[WAL_HEADER_SIZE / sizeof(uint32_t)] = {0};
+  if (length >= WAL_HEADER_SIZE) {
+    wal_pread(wal->file_descriptor, header, WAL_HEADER_SIZE, 0);
+  }
 
-  // binary search
-  uint32_t min_index = 0;
-  uint32_t one_past_index = num_cells;
-  while (one_past_index != min_index) {
-    uint32_t index = (min_index + one_past_index) / 2;
-    uint32_t key_at_index = *leaf_node_key(node, index);
-    if (key == key_at_index) {
-      cursor->cell_num = index;
-      return cursor;
+  if (header[0] == WAL_MAGIC && header[1] == PAGE_SIZE) {
+    // recuperação: reaplica os commits completos que não chegaram ao banco
+    wal->salt = header[2];
+    off_t* offsets = NULL;
+    uint32_t capacity = 0;
+    off_t last_commit = wal_scan(wal, length, &offsets, &capacity);
+    for (uint32_t page_num = 0; page_num < capacity; page_num++) {
+      if (offsets[page_num] != 0) {
+        wal->pages_recovered++;
+      }
     }
-    if (key < key_at_index) {
-      one_past_index = index;
-    } else {
-      min_index = index + 1;
+    free(offsets);
+    wal_backfill(wal, last_commit);
+  }
+
+  wal_reset(wal);
+  wal_fsync(wal->file_descriptor);
+
+  pthread_mutex_init(&wal->lock, NULL);
+  pthread_cond_init(&wal->work, NULL);
+  pthread_cond_init(&wal->done, NULL);
+  pthread_create(&wal->thread, NULL, wal_thread_main, wal);
+
+  return wal;
+}
+
+/**
+ * Anexa as páginas alteradas por um comando como uma única transação.
+ * No modo SYNC_FULL espera o fsync do grupo em que o commit entrou.
+ */
+void wal_commit(Wal* wal, uint32_t* page_nums, void** pages, uint32_t num_pages, uint32_t db_pages) {
+  pthread_mutex_lock(&wal->lock);
+
+  // todo o log já está no banco: recomeça do início em vez de crescer
+  if (wal->end == wal->backfilled && wal->end > WAL_HEADER_SIZE && !wal->busy) {
+    wal_reset(wal);
+  }
+  // o log passou do limite: espera o checkpoint alcançar o fim antes de continuar
+  while (wal->end - WAL_HEADER_SIZE >= WAL_MAX_BYTES) {
+    wal->checkpoint_requested = true;
+    pthread_cond_signal(&wal->work);
+    pthread_cond_wait(&wal->done, &wal->lock);
+  }
+
+  size_t needed = wal->buffer_length + (size_t)num_pages * WAL_FRAME_SIZE;
+  if (needed > wal->buffer_capacity) {
+    wal->buffer_capacity = needed * 2;
+    wal->buffer = realloc(wal->buffer, wal->buffer_capacity);
+  }
+
+  for (uint32_t i = 0; i < num_pages; i++) {
+    char* frame = wal->buffer + wal->buffer_length;
+    uint32_t* header = (uint32_t*)frame;
+    header[0] = page_nums[i];
+    header[1] = (i == num_pages - 1) ? db_pages : 0; // marcador de commit
+    header[2] = wal->salt;
+    memcpy(frame + WAL_FRAME_HEADER_SIZE, pages[i], PAGE_SIZE);
+    wal->checksum = wal_checksum(wal->checksum, frame, 3 * sizeof(uint32_t));
+    wal->checksum = wal_checksum(wal->checksum, frame + WAL_FRAME_HEADER_SIZE, PAGE_SIZE);
+    header[3] = wal->checksum;
+
+    *wal_index_entry(wal, page_nums[i]) = wal->end;
+    wal->buffer_length += WAL_FRAME_SIZE;
+    wal->end += WAL_FRAME_SIZE;
+  }
+  uint64_t commit_seq = ++wal->commits;
+
+  if (wal->sync_mode == SYNC_FULL) {
+    pthread_cond_signal(&wal->work);
+    while (wal->synced_commits < commit_seq) {
+      pthread_cond_wait(&wal->done, &wal->lock);
     }
+  } else if (wal->buffer_length >= WAL_CHECKPOINT_BYTES) {
+    pthread_cond_signal(&wal->work);
   }
 
-  cursor->cell_num = min_index;
+  pthread_mutex_unlock(&wal->lock);
+}
+
+// Lê a versão mais recente de uma página, se ela estiver no log
+bool wal_read_page(Wal* wal, uint32_t page_num, void* destination) {
+  pthread_mutex_lock(&wal->lock);
+  off_t offset = page_num < wal->index_capacity ? wal->index[page_num] : 0;
+  if (offset == 0) {
+    pthread_mutex_unlock(&wal->lock);
+    return false;
+  }
 
-  return cursor;
+  if (offset >= wal->written) {
+    memcpy(destination, wal->buffer + (offset - wal->written) + WAL_FRAME_HEADER_SIZE, PAGE_SIZE);
+  } else {
+    wal_pread(wal->file_descriptor, destination, PAGE_SIZE, offset + WAL_FRAME_HEADER_SIZE);
+  }
+  pthread_mutex_unlock(&wal->lock);
+  return true;
 }
 
-uint32_t internal_node_find_child(void* node, uint32_t key) {
-  /**
-   * Retorna o indice do filho que deverá conter uma chave
-  */
-  uint32_t num_keys = *internal_node_num_keys(node);
+void wal_set_sync_mode(Wal* wal, SyncMode sync_mode) {
+  pthread_mutex_lock(&wal->lock);
+  wal->sync_mode = sync_mode;
+  pthread_cond_signal(&wal->work); // o thread pode estar numa espera sem prazo
+  pthread_mutex_unlock(&wal->lock);
+}
 
-/* Busca Binária */
-  uint32_t min_index = 0;
-  uint32_t max_index = num_keys; /* tem um filho a mais que chave */
+// Sincroniza o log e copia tudo para o banco, deixando o log vazio
+void wal_checkpoint(Wal* wal) {
+  pthread_mutex_lock(&wal->lock);
+  wal_sync_locked(wal);
+  wal_checkpoint_locked(wal);
+  pthread_mutex_unlock(&wal->lock);
+}
 
-  while (min_index != max_index) {
-    uint32_t index = (min_index + max_index) / 2;
-    uint32_t key_to_right = *internal_node_key(node, index);
-    if (key_to_right >= key) {
-      max_index = index;
-    } else {
-      min_index = index + 1;
+void wal_close(Wal* wal) {
+  wal_checkpoint(wal);
+
+  pthread_mutex_lock(&wal->lock);
+  wal->shutdown = true;
+  pthread_cond_signal(&wal->work);
+  pthread_mutex_unlock(&wal->lock);
+  pthread_join(wal->thread, NULL);
+
+  close(wal->file_descriptor);
+  unlink(wal->path);
+  pthread_mutex_destroy(&wal->lock);
+  pthread_cond_destroy(&wal->work);
+  pthread_cond_destroy(&wal->done);
+  free(wal->buffer);
+  free(wal->index);
+  free(wal->path);
+  free(wal);
+}
+
+// quadro fixado por um thread, com o pager dele
+typedef struct {
+  Pager* pager;
+  Frame* frame;
+} Pin;
+
+/**
+ * Latch de uma tabela do ponto de vista de um thread: quantos passos de leitura o
+ * seguram e se ele está com o latch exclusivo de uma transação. O epoch muda quando
+ * o thread solta o latch compartilhado para escrever, o que invalida os selects dele
+ * que estavam no meio.
+ */
+typedef struct {
+  Table* table;
+  uint32_t readers;
+  uint64_t epoch;
+  bool exclusive;
+  bool leaf_latched; // o thread segura em modo compartilhado a faixa leaf_stripe
+  uint32_t leaf_stripe;
+  PreparedStatement* leaf_owner; // select cuja linha corrente está nessa folha
+} TableLatch;
+
+typedef struct {
+  Pin* pins;
+  uint32_t num_pins;
+  uint32_t pins_capacity;
+  Pager* hits_pager; // acertos ainda não somados no pager
+  uint64_t hits;
+  TableLatch* latches;
+  uint32_t num_latches;
+  TableLatch* reading; // tabela do select em andamento, cujas folhas lidas são travadas
+} ThreadState;
+
+__thread ThreadState* current_thread_state = NULL;
+pthread_key_t thread_state_key;
+pthread_once_t thread_state_once = PTHREAD_ONCE_INIT;
+
+void thread_state_free(void* state) {
+  ThreadState* thread_state = state;
+  free(thread_state->pins);
+  free(thread_state->latches);
+  free(thread_state);
+}
+
+void thread_state_key_create() {
+  pthread_key_create(&thread_state_key, thread_state_free);
+}
+
+// estado do thread corrente, criado no primeiro uso e liberado quando o thread termina
+ThreadState* thread_state() {
+  if (current_thread_state == NULL) {
+    pthread_once(&thread_state_once, thread_state_key_create);
+    current_thread_state = calloc(1, sizeof(ThreadState));
+    pthread_setspecific(thread_state_key, current_thread_state);
+  }
+  return current_thread_state;
+}
+
+TableLatch* table_latch(Table* table) {
+  ThreadState* state = thread_state();
+  for (uint32_t i = 0; i < state->num_latches; i++) {
+    if (state->latches[i].table == table) {
+      return &state->latches[i];
     }
   }
+  state->latches = realloc(state->latches, (state->num_latches + 1) * sizeof(TableLatch));
+  TableLatch* latch = &state->latches[state->num_latches++];
+  memset(latch, 0, sizeof(TableLatch));
+  latch->table = table;
+  return latch;
+}
 
-  return min_index;
+// solta a folha que o thread segura para a linha corrente de um select
+void leaf_unlatch(Table* table, TableLatch* latch) {
+  if (!latch->leaf_latched) {
+    return;
+  }
+  latch->leaf_latched = false;
+  latch->leaf_owner = NULL;
+  pthread_rwlock_unlock(&table->page_latches[latch->leaf_stripe].lock);
 }
 
-Cursor* internal_node_find(Table* table, uint32_t page_num, uint32_t key) {
-  void* node = get_page(table->pager, page_num);
+/**
+ * Trava em modo compartilhado a folha que o select em andamento vai ler; fora de um
+ * select não faz nada. O thread segura uma folha de cada vez e solta a anterior antes
+ * de esperar pela próxima, então um leitor nunca espera segurando uma folha que um
+ * escritor queira.
+ */
+void leaf_latch_shared(Table* table, uint32_t page_num) {
+  TableLatch* latch = thread_state()->reading;
+  if (latch == NULL || latch->table != table) {
+    return;
+  }
+  uint32_t stripe = page_num % PAGE_LATCH_STRIPES;
+  if (latch->leaf_latched && latch->leaf_stripe == stripe) {
+    return;
+  }
+  leaf_unlatch(table, latch);
+  pthread_rwlock_rdlock(&table->page_latches[stripe].lock);
+  latch->leaf_latched = true;
+  latch->leaf_stripe = stripe;
+}
 
-  uint32_t child_index = internal_node_find_child(node, key);
-  uint32_t child_num = *internal_node_child(node, child_index);
-  void* child = get_page(table->pager, child_num);
-  switch (get_node_type(child)) {
-    case NODE_LEAF:
-      return leaf_node_find(table, child_num, key);
-    case NODE_INTERNAL:
-      return internal_node_find(table, child_num, key);
+// faixas travadas em modo exclusivo por um insert ou delete, em ordem crescente
+typedef struct {
+  uint32_t stripes[2];
+  uint32_t num_stripes;
+} LeafWriteLatch;
+
+void leaf_write_lock(Table* table, uint32_t stripe) {
+  PageLatch* page_latch = &table->page_latches[stripe];
+  __atomic_fetch_add(&page_latch->writers_waiting, 1, __ATOMIC_RELAXED);
+  pthread_rwlock_wrlock(&page_latch->lock);
+  __atomic_fetch_sub(&page_latch->writers_waiting, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * Trava as folhas page_num e other_page_num (0 se não houver outra) em ordem de faixa:
+ * dois escritores nunca esperam um pelo outro em sentidos opostos.
+ */
+void leaf_write_latch(Table* table, LeafWriteLatch* latch, uint32_t page_num, uint32_t other_page_num) {
+  uint32_t first = page_num % PAGE_LATCH_STRIPES;
+  uint32_t second = other_page_num == 0 ? first : other_page_num % PAGE_LATCH_STRIPES;
+  if (second < first) {
+    uint32_t swap = first;
+    first = second;
+    second = swap;
+  }
+  latch->num_stripes = 0;
+  latch->stripes[latch->num_stripes++] = first;
+  if (second != first) {
+    latch->stripes[latch->num_stripes++] = second;
+  }
+  for (uint32_t i = 0; i < latch->num_stripes; i++) {
+    leaf_write_lock(table, latch->stripes[i]);
   }
 }
 
+// acrescenta mais uma folha; false se a ordem não permitir esperar por ela agora
+bool leaf_write_latch_add(Table* table, LeafWriteLatch* latch, uint32_t page_num) {
+  uint32_t stripe = page_num % PAGE_LATCH_STRIPES;
+  for (uint32_t i = 0; i < latch->num_stripes; i++) {
+    if (latch->stripes[i] == stripe) {
+      return true;
+    }
+  }
+  if (latch->num_stripes == 2 || stripe < latch->stripes[latch->num_stripes - 1]) {
+    return false;
+  }
+  leaf_write_lock(table, stripe);
+  latch->stripes[latch->num_stripes++] = stripe;
+  return true;
+}
 
+void leaf_write_unlatch(Table* table, LeafWriteLatch* latch) {
+  for (uint32_t i = 0; i < latch->num_stripes; i++) {
+    pthread_rwlock_unlock(&table->page_latches[latch->stripes[i]].lock);
+  }
+  latch->num_stripes = 0;
+}
 
-Cursor* table_find(Table* table, uint32_t key) {
-  uint32_t root_page_num = table->root_page_num;
-  void* root_node = get_page(table->pager, root_page_num);
+/**
+ * Latch compartilhado de um passo de leitura. Um thread trava o rwlock uma vez só,
+ * por mais selects que tenha no meio; com a transação aberta ele já tem o exclusivo
+ * e devolve false.
+ */
+bool table_latch_shared(Table* table, TableLatch* latch) {
+  if (latch->exclusive) {
+    return false;
+  }
+  if (latch->readers++ == 0) {
+    pthread_rwlock_rdlock(&table->latch);
+  }
+  return true;
+}
 
-  if (get_node_type(root_node) == NODE_LEAF) {
-    return leaf_node_find(table, root_page_num, key);
-  } else {
-    return internal_node_find(table, root_page_num, key);
+/**
+ * Latch exclusivo de um comando que altera a tabela. Se o próprio thread tem selects
+ * com linha corrente, o compartilhado é solto antes, senão esperaria por si mesmo.
+ * Os totais mudados pelas folhas até aqui vão para o WAL antes do comando.
+ */
+void table_latch_exclusive(Table* table, TableLatch* latch) {
+  if (latch->exclusive) {
+    return;
   }
+  if (latch->readers > 0) {
+    leaf_unlatch(table, latch);
+    latch->readers = 0;
+    latch->epoch++;
+    pthread_rwlock_unlock(&table->latch);
+  }
+  __atomic_fetch_add(&table->writers_waiting, 1, __ATOMIC_RELAXED);
+  pthread_rwlock_wrlock(&table->latch);
+  __atomic_fetch_sub(&table->writers_waiting, 1, __ATOMIC_RELAXED);
+  table_counts_flush(table);
 }
 
-Cursor* table_start(Table* table) {
-  Cursor* cursor = table_find(table, 0);
+/**
+ * Um thread só espera por um latch segurando os da tabela do comando corrente: o
+ * latch compartilhado de outra tabela é solto, e os selects dele nela se reposicionam
+ * no próximo passo. Sem isso dois threads lendo duas tabelas em ordens diferentes
+ * poderiam esperar um pelo outro através dos escritores das duas.
+ */
+void table_unlatch_others(Table* table) {
+  ThreadState* state = thread_state();
+  for (uint32_t i = 0; i < state->num_latches; i++) {
+    TableLatch* latch = &state->latches[i];
+    if (latch->table != table && latch->readers > 0) {
+      leaf_unlatch(latch->table, latch);
+      latch->readers = 0;
+      latch->epoch++;
+      pthread_rwlock_unlock(&latch->table->latch);
+    }
+  }
+}
 
-  void* node = get_page(table->pager, cursor->page_num);
-  uint32_t num_cells = *leaf_node_num_cells(node);
-  cursor->end_of_table = (num_cells == 0);
+// fim do comando: o exclusivo fica com o thread até o commit ou rollback de uma transação
+void table_unlatch_exclusive(Table* table, TableLatch* latch) {
+  table->version++;
+  latch->exclusive = table->in_transaction;
+  if (!latch->exclusive) {
+    pthread_rwlock_unlock(&table->latch);
+  }
+}
 
-  return cursor;
+Frame* pager_frame(Pager* pager, uint32_t frame_index) {
+  return &pager->frame_chunks[frame_index / PAGER_FRAME_CHUNK_SIZE][frame_index % PAGER_FRAME_CHUNK_SIZE];
 }
 
-void* cursor_value(Cursor* cursor) {
-  uint32_t page_num = cursor->page_num;
-  void* page = get_page(cursor->table->pager, page_num);
+uint32_t page_table_lookup(Pager* pager, uint32_t page_num) {
+  uint32_t* chunk = __atomic_load_n(&pager->page_table[page_num >> PAGE_TABLE_CHUNK_BITS], __ATOMIC_ACQUIRE);
+  if (chunk == NULL) {
+    return PAGER_NO_FRAME;
+  }
+  return __atomic_load_n(&chunk[page_num & (PAGE_TABLE_CHUNK_SIZE - 1)], __ATOMIC_ACQUIRE);
+}
 
-  return leaf_node_value(page, cursor->cell_num);
+// com o lock do pool: os blocos da tabela de páginas são criados aqui e nunca liberados antes do fim
+void page_table_set(Pager* pager, uint32_t page_num, uint32_t frame_index) {
+  uint32_t** slot = &pager->page_table[page_num >> PAGE_TABLE_CHUNK_BITS];
+  if (*slot == NULL) {
+    uint32_t* chunk = malloc(PAGE_TABLE_CHUNK_SIZE * sizeof(uint32_t));
+    for (uint32_t i = 0; i < PAGE_TABLE_CHUNK_SIZE; i++) {
+      chunk[i] = PAGER_NO_FRAME;
+    }
+    __atomic_store_n(slot, chunk, __ATOMIC_RELEASE);
+  }
+  __atomic_store_n(&(*slot)[page_num & (PAGE_TABLE_CHUNK_SIZE - 1)], frame_index, __ATOMIC_RELEASE);
 }
 
-void cursor_advance(Cursor* cursor) {
-  uint32_t page_num = cursor->page_num;
-  void* node = get_page(cursor->table->pager, page_num);
+// com o lock do pool: um quadro novo no fim, que ainda não está na tabela de páginas
+uint32_t pager_add_frame(Pager* pager) {
+  uint32_t frame_index = pager->num_frames;
+  uint32_t chunk = frame_index / PAGER_FRAME_CHUNK_SIZE;
+  if (chunk == PAGER_MAX_FRAME_CHUNKS) {
+    printf("Erro: O buffer pool passou do limite de quadros.\n");
+    exit(EXIT_FAILURE);
+  }
+  if (pager->frame_chunks[chunk] == NULL) {
+    pager->frame_chunks[chunk] = calloc(PAGER_FRAME_CHUNK_SIZE, sizeof(Frame));
+  }
+  Frame* frame = pager_frame(pager, frame_index);
+  frame->pin_count = FRAME_EVICTING;
+  pager->num_frames++;
+  return frame_index;
+}
 
-  cursor->cell_num += 1;
-  
-  // if (cursor->cell_num >= (*leaf_node_num_cells(node))) {
-  //   cursor->end_of_table = true;
-  //   /* Advance to next leaf node */
+/**
+ * Escolhe um quadro para receber uma nova página, com o lock do pool.
+ * Enquanto o orçamento permitir, aloca um quadro novo. Depois disso usa o
+ * algoritmo CLOCK: o ponteiro percorre os quadros limpando o bit de referência
+ * e despeja o primeiro quadro não fixado que não foi usado desde a última volta.
+ * Páginas alteradas ainda não foram para o WAL e também não podem sair do pool.
+ * Se todos os quadros estiverem fixados, o pool cresce além do orçamento.
+ * O quadro devolvido fica com pin_count FRAME_EVICTING, fora do alcance dos acertos.
+ */
+uint32_t pager_find_victim(Pager* pager) {
+  if (pager->num_frames < pager->max_frames) {
+    return pager_add_frame(pager);
+  }
+
+  for (uint32_t steps = 0; steps < 2 * pager->num_frames; steps++) {
+    uint32_t frame_index = pager->clock_hand;
+    Frame* frame = pager_frame(pager, frame_index);
+    pager->clock_hand = (pager->clock_hand + 1) % pager->num_frames;
+
+    // as folhas marcam os nós dos totais com o latch compartilhado (pager_hold_page)
+    if (__atomic_load_n(&frame->pin_count, __ATOMIC_RELAXED) > 0 || __atomic_load_n(&frame->dirty, __ATOMIC_RELAXED)) {
+      continue;
+    }
+    if (__atomic_load_n(&frame->referenced, __ATOMIC_RELAXED)) {
+      __atomic_store_n(&frame->referenced, false, __ATOMIC_RELAXED);
+      continue;
+    }
+    // um acerto pode fixar o quadro entre a leitura e a troca
+    uint32_t unpinned = 0;
+    if (!__atomic_compare_exchange_n(&frame->pin_count, &unpinned, FRAME_EVICTING, false,
+                                     __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+      continue;
+    }
+
+    // a versão mais recente da página já está no WAL ou no banco
+    page_table_set(pager, frame->page_num, PAGER_NO_FRAME);
+    pager->cache_evictions++;
+    return frame_index;
+  }
+
+  return pager_add_frame(pager);
+}
+
+/**
+ * Devolve o pool ao orçamento depois de um commit ou rollback, com o lock do pool.
+ * As páginas de uma transação ficam sujas até o commit, então o pool cresce além do
+ * orçamento enquanto ela está aberta. Os quadros só saem pelo fim, porque o índice
+ * do quadro está na tabela de páginas: um quadro do fim limpo e não fixado é
+ * despejado, e um sujo (os totais de pager_hold_page) troca de lugar com um quadro
+ * limpo do começo. Quadros fixados ficam para o próximo commit.
+ */
+void pager_shrink(Pager* pager) {
+  pthread_mutex_lock(&pager->lock);
+  while (pager->num_frames > pager->max_frames) {
+    uint32_t last_index = pager->num_frames - 1;
+    Frame* last = pager_frame(pager, last_index);
+    uint32_t unpinned = 0;
+    if (!__atomic_compare_exchange_n(&last->pin_count, &unpinned, FRAME_EVICTING, false,
+                                     __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+      break;
+    }
+
+    if (!__atomic_load_n(&last->dirty, __ATOMIC_RELAXED)) {
+      page_table_set(pager, last->page_num, PAGER_NO_FRAME);
+      pager->cache_evictions++;
+    } else {
+      // o CLOCK não passa pelo quadro do fim enquanto procura onde pôr a página dele
+      pager->num_frames--;
+      pager->clock_hand %= pager->num_frames;
+      uint32_t frame_index = pager_find_victim(pager);
+      if (frame_index == last_index) {
+        // nenhum quadro limpo no começo: pager_add_frame devolveu o próprio quadro do fim
+        __atomic_store_n(&last->pin_count, 0, __ATOMIC_RELEASE);
+        break;
+      }
+      pager->num_frames++;
+      Frame* frame = pager_frame(pager, frame_index);
+      free(frame->data);
+      frame->page_num = last->page_num;
+      frame->dirty = true;
+      frame->referenced = last->referenced;
+      frame->data = last->data;
+      last->data = NULL;
+      page_table_set(pager, frame->page_num, frame_index);
+      __atomic_store_n(&frame->pin_count, 0, __ATOMIC_RELEASE);
+    }
+
+    // o quadro fica com FRAME_EVICTING até ser reaproveitado por pager_add_frame
+    free(last->data);
+    last->data = NULL;
+    pager->num_frames--;
+  }
+  if (pager->num_frames > 0) {
+    pager->clock_hand %= pager->num_frames;
+  }
+  pthread_mutex_unlock(&pager->lock);
+}
+
+// guarda o quadro na lista do thread, que o libera em pager_release
+void pager_pin(Pager* pager, Frame* frame) {
+  ThreadState* state = thread_state();
+  if (state->num_pins == state->pins_capacity) {
+    state->pins_capacity = state->pins_capacity ? state->pins_capacity * 2 : 32;
+    state->pins = realloc(state->pins, state->pins_capacity * sizeof(Pin));
+  }
+  state->pins[state->num_pins].pager = pager;
+  state->pins[state->num_pins].frame = frame;
+  state->num_pins++;
+}
+
+/**
+ * Fixa o quadro se ele ainda guardar a página: entre a consulta à tabela de páginas
+ * e o pin o quadro pode ter sido despejado e reaproveitado por outro thread.
+ */
+bool frame_try_pin(Frame* frame, uint32_t page_num) {
+  uint32_t pin_count = __atomic_load_n(&frame->pin_count, __ATOMIC_RELAXED);
+  do {
+    if (pin_count == FRAME_EVICTING) {
+      return false;
+    }
+  } while (!__atomic_compare_exchange_n(&frame->pin_count, &pin_count, pin_count + 1, true,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED));
+  if (frame->page_num != page_num) {
+    __atomic_fetch_sub(&frame->pin_count, 1, __ATOMIC_RELEASE);
+    return false;
+  }
+  return true;
+}
+
+/**
+ * Libera as páginas fixadas pelo thread corrente nesse pager.
+ * Os ponteiros devolvidos por get_page continuam válidos até esta chamada.
+ */
+void pager_release(Pager* pager) {
+  ThreadState* state = thread_state();
+  uint32_t kept = 0;
+  for (uint32_t i = 0; i < state->num_pins; i++) {
+    if (state->pins[i].pager == pager) {
+      __atomic_fetch_sub(&state->pins[i].frame->pin_count, 1, __ATOMIC_RELEASE);
+    } else {
+      state->pins[kept++] = state->pins[i];
+    }
+  }
+  state->num_pins = kept;
+
+  if (state->hits_pager == pager) {
+    __atomic_fetch_add(&pager->cache_hits, state->hits, __ATOMIC_RELAXED);
+    state->hits = 0;
+  }
+}
+
+/**
+ * Marca uma página em cache como alterada.
+ * Deve ser chamada pelos caminhos que modificam a página, que já a obtiveram com get_page.
+ */
+void pager_mark_dirty(Pager* pager, uint32_t page_num) {
+  bool* dirty;
+  if (!pager->use_mmap) {
+    dirty = &pager_frame(pager, page_table_lookup(pager, page_num))->dirty;
+  } else {
+    if (page_num >= pager->dirty_pages_capacity) {
+      uint32_t new_capacity = pager->dirty_pages_capacity ? pager->dirty_pages_capacity : 64;
+      while (new_capacity <= page_num) {
+        new_capacity *= 2;
+      }
+      pager->dirty_pages = realloc(pager->dirty_pages, new_capacity * sizeof(bool));
+      memset(pager->dirty_pages + pager->dirty_pages_capacity, 0,
+             (new_capacity - pager->dirty_pages_capacity) * sizeof(bool));
+      pager->dirty_pages_capacity = new_capacity;
+    }
+    dirty = &pager->dirty_pages[page_num];
+  }
+
+  if (*dirty) {
+    return;
+  }
+  *dirty = true;
+  if (pager->num_dirty == pager->dirty_capacity) {
+    pager->dirty_capacity = pager->dirty_capacity ? pager->dirty_capacity * 2 : 16;
+    pager->dirty_list = realloc(pager->dirty_list, pager->dirty_capacity * sizeof(uint32_t));
+  }
+  pager->dirty_list[pager->num_dirty++] = page_num;
+}
+
+/**
+ * Segura no pool uma página alterada fora da lista do comando corrente, que vai para o
+ * WAL depois, num commit próprio. No modo mmap as páginas não saem da memória.
+ */
+void pager_hold_page(Pager* pager, uint32_t page_num) {
+  if (!pager->use_mmap) {
+    __atomic_store_n(&pager_frame(pager, page_table_lookup(pager, page_num))->dirty, true, __ATOMIC_RELAXED);
+  }
+}
+
+/**
+ * Efetiva o comando corrente: as páginas alteradas vão para o WAL como uma
+ * transação e deixam de estar sujas. Nenhuma delas é gravada no banco aqui.
+ */
+void pager_commit(Pager* pager) {
+  if (pager->num_dirty == 0) {
+    return;
+  }
+
+  void** pages = malloc(pager->num_dirty * sizeof(void*));
+  for (uint32_t i = 0; i < pager->num_dirty; i++) {
+    uint32_t page_num = pager->dirty_list[i];
+    if (pager->use_mmap) {
+      pages[i] = pager->map + (size_t)page_num * PAGE_SIZE;
+      pager->dirty_pages[page_num] = false;
+    } else {
+      Frame* frame = pager_frame(pager, page_table_lookup(pager, page_num));
+      pages[i] = frame->data;
+      frame->dirty = false;
+    }
+  }
+
+  wal_commit(pager->wal, pager->dirty_list, pages, pager->num_dirty, pager->num_pages);
+  pager->pages_written += pager->num_dirty;
+  pager->num_dirty = 0;
+  free(pages);
+  if (!pager->use_mmap && pager->num_frames > pager->max_frames) {
+    pager_shrink(pager);
+  }
+}
+
+// Checkpoint completo: efetiva o comando corrente e copia todo o log para o banco
+void pager_checkpoint(Pager* pager) {
+  pager_commit(pager);
+  wal_checkpoint(pager->wal);
+}
+
+/**
+ * Garante que a página esteja dentro do arquivo e do mapeamento.
+ * O arquivo cresce página a página com ftruncate, enquanto o mapeamento cresce
+ * em blocos sobre a região reservada, então endereços já devolvidos não mudam.
+ */
+void* pager_mmap_page(Pager* pager, uint32_t page_num) {
+  // página que já está no arquivo e no mapeamento: só aritmética, sem lock
+  if (page_num < __atomic_load_n(&pager->num_pages, __ATOMIC_ACQUIRE) &&
+      page_num < __atomic_load_n(&pager->mapped_pages, __ATOMIC_ACQUIRE)) {
+    return pager->map + (size_t)page_num * PAGE_SIZE;
+  }
+
+  pthread_mutex_lock(&pager->lock);
+  if ((off_t)(page_num + 1) * PAGE_SIZE > pager->file_length) {
+    pager->file_length = (off_t)(page_num + 1) * PAGE_SIZE;
+    if (ftruncate(pager->file_descriptor, pager->file_length) == -1) {
+      printf("Erro ao aumentar o arquivo: %d\n", errno);
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  if (page_num >= pager->mapped_pages) {
+    uint32_t new_mapped_pages =
+        (page_num / PAGER_MMAP_CHUNK_PAGES + 1) * PAGER_MMAP_CHUNK_PAGES;
+    if ((uint64_t)new_mapped_pages * PAGE_SIZE > PAGER_MMAP_RESERVE) {
+      printf("Arquivo maior que a região reservada para o mmap.\n");
+      exit(EXIT_FAILURE);
+    }
+    void* address = mmap(pager->map + (size_t)pager->mapped_pages * PAGE_SIZE,
+                         (size_t)(new_mapped_pages - pager->mapped_pages) * PAGE_SIZE,
+                         PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED,
+                         pager->file_descriptor, (off_t)pager->mapped_pages * PAGE_SIZE);
+    if (address == MAP_FAILED) {
+      printf("Erro ao mapear o arquivo: %d\n", errno);
+      exit(EXIT_FAILURE);
+    }
+    __atomic_store_n(&pager->mapped_pages, new_mapped_pages, __ATOMIC_RELEASE);
+  }
+
+  if (page_num >= pager->num_pages) {
+    __atomic_store_n(&pager->num_pages, page_num + 1, __ATOMIC_RELEASE);
+  }
+  pthread_mutex_unlock(&pager->lock);
+
+  return pager->map + (size_t)page_num * PAGE_SIZE;
+}
+
+// lê a última versão efetivada da página: as que ainda estão no WAL vêm dele, o resto do banco
+void pager_read_page(Pager* pager, uint32_t page_num, void* page) {
+  if (wal_read_page(pager->wal, page_num, page)) {
+    return;
+  }
+  if (pager->compressed) {
+    compressed_file_read_page(pager->compressed, page_num, page);
+    return;
+  }
+  // pread não mexe na posição do arquivo, que é compartilhada pelos threads
+  ssize_t bytes_read = pread(pager->file_descriptor, page, PAGE_SIZE, (off_t)page_num * PAGE_SIZE);
+  if (bytes_read == -1) {
+    printf("Erro ao ler o arquivo: %d\n", errno);
+    exit(EXIT_FAILURE);
+  }
+  // páginas novas, depois do fim do arquivo, começam zeradas
+  memset(page + bytes_read, 0, PAGE_SIZE - bytes_read);
+}
+
+/**
+ * Descarta as alterações ainda não efetivadas. No buffer pool cada quadro alterado é
+ * relido no lugar; no modo mmap o madvise devolve a página do mapeamento privado à
+ * versão do arquivo, e as páginas que estão no WAL são copiadas de volta por cima.
+ */
+void pager_rollback(Pager* pager, uint32_t num_pages) {
+  pager_release(pager);
+  for (uint32_t i = 0; i < pager->num_dirty; i++) {
+    uint32_t page_num = pager->dirty_list[i];
+    if (pager->use_mmap) {
+      void* page = pager->map + (size_t)page_num * PAGE_SIZE;
+      madvise(page, PAGE_SIZE, MADV_DONTNEED);
+      wal_read_page(pager->wal, page_num, page);
+      pager->dirty_pages[page_num] = false;
+    } else {
+      Frame* frame = pager_frame(pager, page_table_lookup(pager, page_num));
+      pager_read_page(pager, page_num, frame->data);
+      frame->dirty = false;
+    }
+  }
+  pager->num_dirty = 0;
+  pager->num_pages = num_pages;
+  if (!pager->use_mmap && pager->num_frames > pager->max_frames) {
+    pager_shrink(pager);
+  }
+}
+
+/**
+ * Falta no cache, com o lock do pool: outro thread pode ter carregado a página
+ * enquanto este esperava. A leitura do disco acontece com o lock, antes de a página
+ * entrar na tabela de páginas.
+ */
+Frame* pager_load_page(Pager* pager, uint32_t page_num) {
+  pthread_mutex_lock(&pager->lock);
+  Frame* frame;
+  uint32_t frame_index = page_table_lookup(pager, page_num);
+  if (frame_index != PAGER_NO_FRAME) {
+    // os despejos só acontecem com o lock, então o quadro não pode sair daqui
+    frame = pager_frame(pager, frame_index);
+    __atomic_fetch_add(&frame->pin_count, 1, __ATOMIC_ACQUIRE);
+    __atomic_fetch_add(&pager->cache_hits, 1, __ATOMIC_RELAXED);
+  } else {
+    // não encontrou no cache. Escolhe um quadro e faz a leitura do arquivo
+    pager->cache_misses++;
+    frame_index = pager_find_victim(pager);
+    frame = pager_frame(pager, frame_index);
+    if (frame->data == NULL) {
+      frame->data = malloc(PAGE_SIZE);
+    }
+    frame->page_num = page_num;
+    frame->dirty = false;
+    frame->referenced = true;
+
+    pager_read_page(pager, page_num, frame->data);
+    __atomic_store_n(&frame->pin_count, 1, __ATOMIC_RELEASE);
+    page_table_set(pager, page_num, frame_index);
+  }
+
+  // depois de um rollback as páginas novas desfeitas continuam no cache
+  if (page_num >= pager->num_pages) {
+    pager->num_pages = page_num + 1;
+  }
+  pthread_mutex_unlock(&pager->lock);
+  return frame;
+}
+
+void* get_page(Pager* pager, uint32_t page_num) {
+  if (pager->use_mmap) {
+    return pager_mmap_page(pager, page_num);
+  }
+
+  // acerto: nenhum lock, só o compare-and-swap do pin_count
+  uint32_t frame_index = page_table_lookup(pager, page_num);
+  if (frame_index != PAGER_NO_FRAME && page_num < pager->num_pages) {
+    Frame* frame = pager_frame(pager, frame_index);
+    if (frame_try_pin(frame, page_num)) {
+      if (!__atomic_load_n(&frame->referenced, __ATOMIC_RELAXED)) {
+        __atomic_store_n(&frame->referenced, true, __ATOMIC_RELAXED);
+      }
+      ThreadState* state = thread_state();
+      if (state->hits_pager != pager) {
+        // o rql_step libera o pager antes de trocar de tabela, então não há acertos perdidos aqui
+        state->hits_pager = pager;
+        state->hits = 0;
+      }
+      state->hits++;
+      pager_pin(pager, frame);
+      return frame->data;
+    }
+  }
+
+  Frame* frame = pager_load_page(pager, page_num);
+  pager_pin(pager, frame);
+  return frame->data;
+}
+
+// Funções de acesso aos campos dos nós
+uint32_t* leaf_node_num_cells(void* node) {
+  return node + LEAF_NODE_NUM_CELLS_OFFSET;
+}
+
+uint32_t* leaf_node_content_start(void* node) {
+  return node + LEAF_NODE_CONTENT_START_OFFSET;
+}
+
+uint32_t* leaf_node_fragmented(void* node) {
+  return node + LEAF_NODE_FRAGMENTED_OFFSET;
+}
+
+uint32_t* leaf_node_keys(void* node) {
+  return node + LEAF_NODE_HEADER_SIZE;
+}
+
+uint32_t* leaf_node_key(void* node, uint32_t cell_num) {
+  return leaf_node_keys(node) + cell_num;
+}
+
+// as posições começam onde as chaves terminam, então mudam de lugar com num_cells
+uint16_t* leaf_node_value_positions(void* node) {
+  return (void*)leaf_node_keys(node) + *leaf_node_num_cells(node) * LEAF_NODE_KEY_SIZE;
+}
+
+uint16_t* leaf_node_value_position(void* node, uint32_t cell_num) {
+  return leaf_node_value_positions(node) + cell_num;
+}
+
+void* leaf_node_value(void* node, uint32_t cell_num) {
+  return node + *leaf_node_value_position(node, cell_num);
+}
+
+// tamanho da linha serializada, lido dos tamanhos gravados antes de cada texto
+uint32_t row_serialized_size(void* source) {
+  uint8_t* username_length = source + USERNAME_OFFSET;
+  uint8_t* email_length = (void*)username_length + COLUMN_LENGTH_SIZE + *username_length;
+  return ID_SIZE + COLUMN_LENGTH_SIZE + *username_length + COLUMN_LENGTH_SIZE + *email_length;
+}
+
+uint32_t leaf_node_value_size(void* node, uint32_t cell_num) {
+  return row_serialized_size(leaf_node_value(node, cell_num));
+}
+
+// espaço livre entre o diretório de slots e as linhas, mais os buracos
+uint32_t leaf_node_free_space(void* node) {
+  uint32_t slots_end = LEAF_NODE_HEADER_SIZE + *leaf_node_num_cells(node) * LEAF_NODE_SLOT_SIZE;
+  return *leaf_node_content_start(node) - slots_end + *leaf_node_fragmented(node);
+}
+
+uint32_t leaf_node_used_space(void* node) {
+  return LEAF_NODE_SPACE_FOR_CELLS - leaf_node_free_space(node);
+}
+
+void initialize_leaf_node(void* node) {
+  set_node_type(node, NODE_LEAF);
+  set_node_root(node, false);
+  *leaf_node_num_cells(node) = 0;
+  *leaf_node_next_leaf(node) = 0;
+  *leaf_node_content_start(node) = PAGE_SIZE;
+  *leaf_node_fragmented(node) = 0;
+}
+
+// regrava as linhas encostadas no fim da página, na ordem dos slots, eliminando os buracos
+void leaf_node_compact(void* node) {
+  uint8_t copy[PAGE_SIZE];
+  memcpy(copy, node, PAGE_SIZE);
+
+  uint32_t content_start = PAGE_SIZE;
+  for (uint32_t i = 0; i < *leaf_node_num_cells(node); i++) {
+    uint32_t size = leaf_node_value_size(copy, i);
+    content_start -= size;
+    memcpy(node + content_start, leaf_node_value(copy, i), size);
+    *leaf_node_value_position(node, i) = content_start;
+  }
+  // o espaço livre fica zerado, o que o deixa quase de graça nas páginas comprimidas
+  uint32_t slots_end = LEAF_NODE_HEADER_SIZE + *leaf_node_num_cells(node) * LEAF_NODE_SLOT_SIZE;
+  memset(node + slots_end, 0, content_start - slots_end);
+  *leaf_node_content_start(node) = content_start;
+  *leaf_node_fragmented(node) = 0;
+}
+
+// insere uma linha já serializada na posição cell_num; quem chama garante que ela cabe
+void leaf_node_insert_value(void* node, uint32_t cell_num, uint32_t key, void* value, uint32_t size) {
+  uint32_t num_cells = *leaf_node_num_cells(node);
+  uint32_t slots_end = LEAF_NODE_HEADER_SIZE + (num_cells + 1) * LEAF_NODE_SLOT_SIZE;
+  if (*leaf_node_content_start(node) < slots_end + size) {
+    leaf_node_compact(node);
+  }
+
+  *leaf_node_content_start(node) -= size;
+  memcpy(node + *leaf_node_content_start(node), value, size);
+
+  // as posições andam uma chave para a frente, as de depois de cell_num mais uma posição;
+  // começando pelo fim, nada é sobrescrito antes de ser copiado
+  uint32_t* keys = leaf_node_keys(node);
+  uint16_t* positions = leaf_node_value_positions(node);
+  uint16_t* new_positions = (void*)(keys + num_cells + 1);
+  memmove(new_positions + cell_num + 1, positions + cell_num, (num_cells - cell_num) * LEAF_NODE_VALUE_POSITION_SIZE);
+  memmove(new_positions, positions, cell_num * LEAF_NODE_VALUE_POSITION_SIZE);
+  memmove(keys + cell_num + 1, keys + cell_num, (num_cells - cell_num) * LEAF_NODE_KEY_SIZE);
+  keys[cell_num] = key;
+  new_positions[cell_num] = *leaf_node_content_start(node);
+  *leaf_node_num_cells(node) = num_cells + 1;
+}
+
+void leaf_node_remove_value(void* node, uint32_t cell_num) {
+  uint32_t num_cells = *leaf_node_num_cells(node);
+  uint32_t size = leaf_node_value_size(node, cell_num);
+  memset(leaf_node_value(node, cell_num), 0, size);
+  if (*leaf_node_value_position(node, cell_num) == *leaf_node_content_start(node)) {
+    *leaf_node_content_start(node) += size;
+  } else {
+    *leaf_node_fragmented(node) += size;
+  }
+
+  // o inverso do insert: as chaves primeiro, depois as posições, do começo para o fim
+  uint32_t* keys = leaf_node_keys(node);
+  uint16_t* positions = leaf_node_value_positions(node);
+  uint16_t* new_positions = (void*)(keys + num_cells - 1);
+  memmove(keys + cell_num, keys + cell_num + 1, (num_cells - cell_num - 1) * LEAF_NODE_KEY_SIZE);
+  memmove(new_positions, positions, cell_num * LEAF_NODE_VALUE_POSITION_SIZE);
+  memmove(new_positions + cell_num, positions + cell_num + 1, (num_cells - cell_num - 1) * LEAF_NODE_VALUE_POSITION_SIZE);
+  memset(new_positions + num_cells - 1, 0, LEAF_NODE_SLOT_SIZE);
+  *leaf_node_num_cells(node) = num_cells - 1;
+}
+
+/**
+ * Redistribui as linhas de uma sequência de células entre uma ou duas folhas.
+ * Usado na divisão e no rebalanceamento: as células apontam para cópias das
+ * páginas, então as folhas de destino podem ser reescritas do zero.
+ */
+typedef struct {
+  uint32_t key;
+  void* value;
+  uint32_t size;
+} LeafCell;
+
+uint32_t leaf_cells_collect(void* node, LeafCell* cells) {
+  uint32_t num_cells = *leaf_node_num_cells(node);
+  for (uint32_t i = 0; i < num_cells; i++) {
+    cells[i].key = *leaf_node_key(node, i);
+    cells[i].value = leaf_node_value(node, i);
+    cells[i].size = leaf_node_value_size(node, i);
+  }
+  return num_cells;
+}
+
+// primeira célula da metade da direita: divide pelo espaço ocupado, não pela contagem
+uint32_t leaf_cells_split_point(LeafCell* cells, uint32_t num_cells) {
+  uint32_t total = 0;
+  for (uint32_t i = 0; i < num_cells; i++) {
+    total += LEAF_NODE_SLOT_SIZE + cells[i].size;
+  }
+  uint32_t left = 0;
+  uint32_t split = 0;
+  while (split < num_cells - 1 && left + LEAF_NODE_SLOT_SIZE + cells[split].size <= total / 2) {
+    left += LEAF_NODE_SLOT_SIZE + cells[split].size;
+    split++;
+  }
+  return split == 0 ? 1 : split;
+}
+
+void leaf_node_fill(void* node, LeafCell* cells, uint32_t num_cells) {
+  memset(node + LEAF_NODE_HEADER_SIZE, 0, PAGE_SIZE - LEAF_NODE_HEADER_SIZE);
+  *leaf_node_num_cells(node) = 0;
+  *leaf_node_content_start(node) = PAGE_SIZE;
+  *leaf_node_fragmented(node) = 0;
+  for (uint32_t i = 0; i < num_cells; i++) {
+    leaf_node_insert_value(node, i, cells[i].key, cells[i].value, cells[i].size);
+  }
+}
+
+uint32_t* internal_node_num_keys(void* node) {
+  return node + INTERNAL_NODE_NUM_KEYS_OFFSET;
+}
+
+void initialize_internal_node(void* node) {
+  set_node_type(node, NODE_INTERNAL);
+  set_node_root(node, false);
+  *internal_node_num_keys(node) = 0;
+}
+
+uint32_t* internal_node_right_child(void* node) {
+  return node + INTERNAL_NODE_RIGHT_CHILD_OFFSET;
+}
+
+uint32_t* internal_node_keys(void* node) {
+  return node + INTERNAL_NODE_HEADER_SIZE;
+}
+
+uint32_t* internal_node_children(void* node) {
+  return internal_node_keys(node) + INTERNAL_NODE_MAX_CELLS;
+}
+
+uint32_t* internal_node_counts(void* node) {
+  return internal_node_children(node) + INTERNAL_NODE_MAX_CELLS;
+}
+
+// copia count células (chave, filho e total) de source para destination, que podem se sobrepor
+void internal_node_move_cells(void* destination, uint32_t to, void* source, uint32_t from, uint32_t count) {
+  memmove(internal_node_keys(destination) + to, internal_node_keys(source) + from, count * INTERNAL_NODE_KEY_SIZE);
+  memmove(internal_node_children(destination) + to, internal_node_children(source) + from,
+          count * INTERNAL_NODE_CHILD_SIZE);
+  memmove(internal_node_counts(destination) + to, internal_node_counts(source) + from,
+          count * INTERNAL_NODE_COUNT_SIZE);
+}
+
+uint32_t* internal_node_child(void* node, uint32_t child_num) {
+  uint32_t num_keys = *internal_node_num_keys(node);
+  if (child_num > num_keys) {
+    printf("Tentativa de acesso child_num %d > num_keys %d\n", child_num, num_keys);
+    exit(EXIT_FAILURE);
+  } else if (child_num == num_keys) {
+    return internal_node_right_child(node);
+  } else {
+    return internal_node_children(node) + child_num;
+  }
+}
+
+uint32_t* internal_node_key(void* node, uint32_t key_num) {
+  return internal_node_keys(node) + key_num;
+}
+
+uint32_t* internal_node_right_count(void* node) {
+  return node + INTERNAL_NODE_RIGHT_COUNT_OFFSET;
+}
+
+// linhas na subárvore do filho; o do filho da direita, na posição num_keys, fica no header
+uint32_t* internal_node_count(void* node, uint32_t child_num) {
+  if (child_num == *internal_node_num_keys(node)) {
+    return internal_node_right_count(node);
+  }
+  return internal_node_counts(node) + child_num;
+}
+
+NodeType get_node_type(void* node) {
+  uint8_t value = *((uint8_t*)(node + NODE_TYPE_OFFSET));
+  return (NodeType)value;
+}
+
+uint32_t* node_parent(void* node) {
+  return node + PARENT_POINTER_OFFSET;
+}
+
+uint32_t* db_header_magic(void* header) {
+  return header + DB_HEADER_MAGIC_OFFSET;
+}
+
+uint32_t* db_header_root_page(void* header) {
+  return header + DB_HEADER_ROOT_PAGE_OFFSET;
+}
+
+uint32_t* db_header_free_head(void* header) {
+  return header + DB_HEADER_FREE_HEAD_OFFSET;
+}
+
+uint32_t* db_header_free_count(void* header) {
+  return header + DB_HEADER_FREE_COUNT_OFFSET;
+}
+
+uint32_t* db_header_index_root(void* header) {
+  return header + DB_HEADER_INDEX_ROOT_OFFSET;
+}
+
+uint32_t* db_header_bloom_page(void* header) {
+  return header + DB_HEADER_BLOOM_PAGE_OFFSET;
+}
+
+// os filtros nas páginas estão em dia: só é verdade entre o fechamento e a próxima abertura
+uint32_t* db_header_bloom_clean(void* header) {
+  return header + DB_HEADER_BLOOM_CLEAN_OFFSET;
+}
+
+uint32_t* free_page_next(void* node) {
+  return node + FREE_PAGE_NEXT_OFFSET;
+}
+/**
+ * Para um nó interno, a maior chave está na subárvore do filho da direita,
+ * que não tem chave própria no nó: desce pelos filhos da direita até a folha.
+ * Para um nó folha, é o maior indice do nó.
+ */
+uint32_t get_node_max_key(Pager* pager, void* node) {
+  switch (get_node_type(node)) {
+    case NODE_INTERNAL:
+      return get_node_max_key(pager, get_page(pager, *internal_node_right_child(node)));
+    case NODE_LEAF:
+      return *leaf_node_key(node, *leaf_node_num_cells(node) - 1);
+    case NODE_FREE:
+      break;
+  }
+  return 0;
+}
+
+bool is_node_root(void* node) {
+  uint8_t value = *((uint8_t*)(node + IS_ROOT_OFFSET));
+  return (bool)value;
+}
+
+void set_node_root(void* node, bool is_root) {
+  uint8_t value = is_root;
+  *((uint8_t*)(node + IS_ROOT_OFFSET)) = value;
+}
+
+// serialização dos dados: id, e cada texto precedido do seu tamanho; devolve o tamanho gravado
+uint32_t serialize_row(Row* source, void* destination) {
+  uint8_t username_length = strlen(source->username);
+  uint8_t email_length = strlen(source->email);
+  void* username_start = destination + USERNAME_OFFSET;
+  void* email_start = username_start + COLUMN_LENGTH_SIZE + username_length;
+
+  memcpy(destination + ID_OFFSET, &(source->id), ID_SIZE);
+  memcpy(username_start, &username_length, COLUMN_LENGTH_SIZE);
+  memcpy(username_start + COLUMN_LENGTH_SIZE, source->username, username_length);
+  memcpy(email_start, &email_length, COLUMN_LENGTH_SIZE);
+  memcpy(email_start + COLUMN_LENGTH_SIZE, source->email, email_length);
+  return row_serialized_size(destination);
+}
+
+void deserialize_row(void *source, Row* destination) {
+  uint8_t* username_length = source + USERNAME_OFFSET;
+  uint8_t* email_length = (void*)username_length + COLUMN_LENGTH_SIZE + *username_length;
+
+  memcpy(&(destination->id), source + ID_OFFSET, ID_SIZE);
+  memcpy(destination->username, (void*)username_length + COLUMN_LENGTH_SIZE, *username_length);
+  destination->username[*username_length] = '\0';
+  memcpy(destination->email, (void*)email_length + COLUMN_LENGTH_SIZE, *email_length);
+  destination->email[*email_length] = '\0';
+}
+
+void leaf_node_insert(Cursor* cursor, uint32_t key, Row* value) {
+  void* node = get_page(cursor->table->pager, cursor->page_num);
+
+  uint8_t record[ROW_SIZE];
+  uint32_t size = serialize_row(value, record);
+
+  if (leaf_node_free_space(node) < LEAF_NODE_SLOT_SIZE + size) {
+    // nó está cheio
+    leaf_node_split_and_insert(cursor, key, value);
+    return;
+  }
+
+  leaf_node_insert_value(node, cursor->cell_num, key, record, size);
+  pager_mark_dirty(cursor->table->pager, cursor->page_num);
+  table_counts_add(cursor->table, cursor->page_num, key, 1);
+}
+
+void set_node_type(void* node, NodeType type) {
+  uint8_t value = type;
+  *((uint8_t*)(node + NODE_TYPE_OFFSET)) = value;
+}
+
+// void indent(uint32_t level) {
+//   for (uint32_t i = 0; i < level; i++) {
+//     printf("  ");
+//   }
+// }
+
+// void print_tree(Pager* pager, uint32_t page_num, uint32_t indentation_level) {
+//   void* node = get_page(pager, page_num);
+//   uint32_t num_keys, child;
+
+//   switch (get_node_type(node)) {
+//     case (NODE_LEAF):
+//       num_keys = *leaf_node_num_cells(node);
+//       indent(indentation_level);
+//       printf("- leaf (size %d)\n", num_keys);
+//       for (uint32_t i = 0; i < num_keys; i++) {
+//         indent(indentation_level + 1);
+//         printf("- %d\n", *leaf_node_key(node, i));
+//       }
+//       break;
+//     case (NODE_INTERNAL):
+//       num_keys = *internal_node_num_keys(node);
+//       indent(indentation_level);
+//       printf("- internal (size %d)\n", num_keys);
+//       for (uint32_t i = 0; i < num_keys; i++) {
+//         child = *internal_node_child(node, i);
+//         print_tree(pager, child, indentation_level + 1);
+
+//         indent(indentation_level + 1);
+//         printf("- key %d\n", *internal_node_key(node, i));
+//       }
+//       child = *internal_node_right_child(node);
+//       print_tree(pager, child, indentation_level + 1);
+//       break;
+//   }
+// }
+
+void indent(uint32_t level) {
+  for (uint32_t i = 0; i < level; i++) {
+    printf("  ");
+  }
+}
+
+void print_leaf_node(void* node, uint32_t indentation_level) {
+  uint32_t num_keys = *leaf_node_num_cells(node);
+  indent(indentation_level);
+  printf("- leaf (size %d)\n", num_keys);
+  for (uint32_t i = 0; i < num_keys; i++) {
+    if (i < 3 || i >= num_keys - 3) {
+      indent(indentation_level + 1);
+      printf("- %d\n", *leaf_node_key(node, i));
+    } else if (i == 3) {
+      indent(indentation_level + 1);
+      printf("- ...\n");
+    }
+  }
+}
+void print_internal_node(Pager* pager, void* node, uint32_t indentation_level, uint32_t depth_limit) {
+  uint32_t num_keys = *internal_node_num_keys(node);
+  indent(indentation_level);
+  printf("- internal (size %d)\n", num_keys);
+  for (uint32_t i = 0; i < num_keys; i++) {
+    uint32_t child = *internal_node_child(node, i);
+    if (depth_limit > 0) {
+      print_tree(pager, child, indentation_level + 1, depth_limit - 1);
+    } else {
+      indent(indentation_level + 1);
+      printf("- ...\n");
+    }
+
+    indent(indentation_level + 1);
+    printf("- key %d\n", *internal_node_key(node, i));
+  }
+  uint32_t right_child = *internal_node_right_child(node);
+  if (depth_limit > 0) {
+    print_tree(pager, right_child, indentation_level + 1, depth_limit - 1);
+  } else {
+    indent(indentation_level + 1);
+    printf("- ...\n");
+  }
+}
+
+void print_tree(Pager* pager, uint32_t page_num, uint32_t indentation_level, uint32_t depth_limit) {
+  void* node = get_page(pager, page_num);
+
+  switch (get_node_type(node)) {
+    case (NODE_LEAF):
+      print_leaf_node(node, indentation_level);
+      break;
+    case (NODE_INTERNAL):
+      print_internal_node(pager, node, indentation_level, depth_limit);
+      break;
+    case (NODE_FREE):
+      break;
+  }
+}
+
+void print_constants() {
+  printf("ROW_SIZE: %d\n", ROW_SIZE);
+  printf("COMMON_NODE_HEADER_SIZE: %d\n", COMMON_NODE_HEADER_SIZE);
+  printf("LEAF_NODE_HEADER_SIZE: %d\n", LEAF_NODE_HEADER_SIZE);
+  printf("LEAF_NODE_SLOT_SIZE: %d\n", LEAF_NODE_SLOT_SIZE);
+  printf("LEAF_NODE_SPACE_FOR_CELLS: %d\n", LEAF_NODE_SPACE_FOR_CELLS);
+  printf("INTERNAL_NODE_MAX_CELLS: %d\n", INTERNAL_NODE_MAX_CELLS);
+}
+
+/**
+ * Posição da primeira chave maior ou igual a key num array ordenado (num_keys se não
+ * houver). A busca binária não tem desvios: a metade escolhida vira um cmov, sem
+ * depender da previsão de um if que erra metade das vezes. Quando sobram até
+ * KEY_SEARCH_BLOCK chaves, o resto é contado de quatro em quatro com SSE2: a posição
+ * é o número de chaves menores que key.
+ */
+uint32_t key_lower_bound(const uint32_t* keys, uint32_t num_keys, uint32_t key) {
+  const uint32_t* base = keys;
+  uint32_t length = num_keys;
+  while (length > KEY_SEARCH_BLOCK) {
+    uint32_t half = length / 2;
+    base = base[half] < key ? base + half : base;
+    length -= half;
+  }
+
+  uint32_t less = 0;
+  uint32_t i = 0;
+#ifdef FILTER_X86_KERNELS
+  // o SSE2 só compara inteiros com sinal: inverter o bit mais alto mantém a ordem
+  __m128i bias = _mm_set1_epi32(INT32_MIN);
+  __m128i target = _mm_xor_si128(_mm_set1_epi32(key), bias);
+  for (; i + 4 <= length; i += 4) {
+    __m128i block = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(base + i)), bias);
+    less += __builtin_popcount(_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(target, block))));
+  }
+#endif
+  for (; i < length; i++) {
+    less += base[i] < key;
+  }
+  return (base - keys) + less;
+}
+
+// posição da chave na folha, ou de onde ela entraria
+uint32_t leaf_node_find_cell(void* node, uint32_t key) {
+  return key_lower_bound(leaf_node_keys(node), *leaf_node_num_cells(node), key);
+}
+
+Cursor* leaf_node_find(Table* table, uint32_t page_num, uint32_t key) {
+  leaf_latch_shared(table, page_num);
+  void* node = get_page(table->pager, page_num);
+
+  Cursor* cursor = malloc(sizeof(Cursor));
+  cursor->table = table;
+  cursor->page_num = page_num;
+  cursor->end_of_table = false;
+  cursor->cell_num = leaf_node_find_cell(node, key);
+
+  return cursor;
+}
+
+uint32_t internal_node_find_child(void* node, uint32_t key) {
+  /**
+   * Retorna o indice do filho que deverá conter uma chave
+  */
+  /* tem um filho a mais que chave: depois da última chave vem o filho da direita */
+  return key_lower_bound(internal_node_keys(node), *internal_node_num_keys(node), key);
+}
+
+Cursor* internal_node_find(Table* table, uint32_t page_num, uint32_t key) {
+  void* node = get_page(table->pager, page_num);
+
+  uint32_t child_index = internal_node_find_child(node, key);
+  uint32_t child_num = *internal_node_child(node, child_index);
+  void* child = get_page(table->pager, child_num);
+  if (get_node_type(child) == NODE_LEAF) {
+    return leaf_node_find(table, child_num, key);
+  } else {
+    return internal_node_find(table, child_num, key);
+  }
+}
+
+
+
+Cursor* table_find(Table* table, uint32_t key) {
+  uint32_t root_page_num = table->root_page_num;
+  void* root_node = get_page(table->pager, root_page_num);
+
+  if (get_node_type(root_node) == NODE_LEAF) {
+    return leaf_node_find(table, root_page_num, key);
+  } else {
+    return internal_node_find(table, root_page_num, key);
+  }
+}
+
+// folha em que a chave está ou entraria, lendo só os nós internos
+uint32_t table_find_leaf(Table* table, uint32_t key) {
+  uint32_t page_num = table->root_page_num;
+  void* node = get_page(table->pager, page_num);
+  while (get_node_type(node) != NODE_LEAF) {
+    page_num = *internal_node_child(node, internal_node_find_child(node, key));
+    node = get_page(table->pager, page_num);
+  }
+  return page_num;
+}
+
+Cursor* table_start(Table* table) {
+  Cursor* cursor = table_find(table, 0);
+
+  void* node = get_page(table->pager, cursor->page_num);
+  uint32_t num_cells = *leaf_node_num_cells(node);
+  cursor->end_of_table = (num_cells == 0);
+
+  return cursor;
+}
+
+/**
+ * Cursor na primeira linha com chave >= key, começando pela folha da dica. A busca
+ * para na posição em que a chave entraria, que pode ser o fim de uma folha; nesse
+ * caso a linha é a primeira da folha seguinte.
+ */
+Cursor* table_seek(Table* table, uint32_t hint_page_num, uint32_t key) {
+  Cursor* cursor = table_find_from_hint(table, hint_page_num, key);
+
+  void* node = get_page(table->pager, cursor->page_num);
+  if (cursor->cell_num >= *leaf_node_num_cells(node)) {
+    uint32_t next_page_num = *leaf_node_next_leaf(node);
+    if (next_page_num == 0) {
+      cursor->end_of_table = true;
+    } else {
+      cursor->page_num = next_page_num;
+      cursor->cell_num = 0;
+    }
+  }
+
+  return cursor;
+}
+
+// total de linhas da tabela: a soma dos totais da raíz, sem descer
+uint32_t table_row_count(Table* table) {
+  void* root = get_page(table->pager, table->root_page_num);
+  if (get_node_type(root) == NODE_LEAF) {
+    leaf_latch_shared(table, table->root_page_num);
+  }
+  return node_row_count(root);
+}
+
+// quantas linhas têm id menor que key: a soma dos totais à esquerda do caminho até a folha
+uint32_t table_rank(Table* table, uint32_t key) {
+  uint32_t rank = 0;
+  uint32_t page_num = table->root_page_num;
+  void* node = get_page(table->pager, page_num);
+  while (get_node_type(node) != NODE_LEAF) {
+    uint32_t child_index = internal_node_find_child(node, key);
+    for (uint32_t i = 0; i < child_index; i++) {
+      rank += __atomic_load_n(internal_node_count(node, i), __ATOMIC_RELAXED);
+    }
+    page_num = *internal_node_child(node, child_index);
+    node = get_page(table->pager, page_num);
+  }
+  leaf_latch_shared(table, page_num);
+  return rank + leaf_node_find_cell(node, key);
+}
+
+// linhas com id entre start e end, inclusive
+uint32_t table_count_range(Table* table, uint32_t start, uint32_t end) {
+  if (start > end) {
+    return 0;
+  }
+  uint32_t before = table_rank(table, start);
+  uint32_t through = end == UINT32_MAX ? table_row_count(table) : table_rank(table, end + 1);
+  // os inserts e deletes pelas folhas podem mudar a tabela entre as duas descidas
+  return through > before ? through - before : 0;
+}
+
+/**
+ * Cursor na linha de posição rank, contada a partir de 0 na ordem dos ids: em cada nó
+ * pula os filhos cujos totais cabem inteiros antes dela. Depois da última linha o
+ * cursor fica no fim da tabela.
+ */
+Cursor* table_seek_rank(Table* table, uint32_t rank) {
+  uint32_t page_num = table->root_page_num;
+  void* node = get_page(table->pager, page_num);
+  while (get_node_type(node) != NODE_LEAF) {
+    uint32_t num_keys = *internal_node_num_keys(node);
+    uint32_t child_index = 0;
+    while (child_index < num_keys) {
+      uint32_t count = __atomic_load_n(internal_node_count(node, child_index), __ATOMIC_RELAXED);
+      if (rank < count) {
+        break;
+      }
+      rank -= count;
+      child_index++;
+    }
+    page_num = *internal_node_child(node, child_index);
+    node = get_page(table->pager, page_num);
+  }
+
+  Cursor* cursor = malloc(sizeof(Cursor));
+  cursor->table = table;
+  cursor->end_of_table = false;
+  leaf_latch_shared(table, page_num);
+  // um total desatualizado por um escritor das folhas só desloca a posição para a folha seguinte
+  while (rank >= *leaf_node_num_cells(node)) {
+    uint32_t next_page_num = *leaf_node_next_leaf(node);
+    if (next_page_num == 0) {
+      rank = *leaf_node_num_cells(node);
+      cursor->end_of_table = true;
+      break;
+    }
+    rank -= *leaf_node_num_cells(node);
+    page_num = next_page_num;
+    leaf_latch_shared(table, page_num);
+    node = get_page(table->pager, page_num);
+  }
+  cursor->page_num = page_num;
+  cursor->cell_num = rank;
+  return cursor;
+}
+
+/**
+ * Procura a chave em uma folha já conhecida, sem descer pela árvore. A página é só
+ * uma dica (a última folha da tabela, a folha do insert anterior de um lote): ela
+ * serve se ainda for uma folha da tabela e a chave estiver entre a primeira e a
+ * última dela, ou depois da última se não houver próxima folha. Senão devolve NULL.
+ * Com ids crescentes os inserts sempre caem no fim da última folha.
+ */
+Cursor* table_find_in_leaf(Table* table, uint32_t page_num, uint32_t key) {
+  // depois de um rollback a dica pode apontar além do fim do arquivo
+  if (page_num == 0 || page_num >= table->pager->num_pages) {
+    return NULL;
+  }
+  leaf_latch_shared(table, page_num);
+  void* node = get_page(table->pager, page_num);
+  if (get_node_type(node) != NODE_LEAF) {
+    return NULL;
+  }
+  uint32_t num_cells = *leaf_node_num_cells(node);
+  if (num_cells == 0 || key < *leaf_node_key(node, 0)) {
+    return NULL;
+  }
+  if (key > *leaf_node_key(node, num_cells - 1) && *leaf_node_next_leaf(node) != 0) {
+    return NULL;
+  }
+  return leaf_node_find(table, page_num, key);
+}
+
+Cursor* table_find_from_hint(Table* table, uint32_t hint_page_num, uint32_t key) {
+  Cursor* cursor = table_find_in_leaf(table, hint_page_num, key);
+  if (cursor == NULL) {
+    cursor = table_find(table, key);
+  }
+  return cursor;
+}
+
+void* cursor_value(Cursor* cursor) {
+  uint32_t page_num = cursor->page_num;
+  void* page = get_page(cursor->table->pager, page_num);
+
+  return leaf_node_value(page, cursor->cell_num);
+}
+
+// avança o cursor dentro da folha já obtida com get_page, ou para a folha seguinte
+void cursor_advance_in_leaf(Cursor* cursor, void* node) {
+  cursor->cell_num += 1;
+  
+  // if (cursor->cell_num >= (*leaf_node_num_cells(node))) {
+  //   cursor->end_of_table = true;
+  //   /* Advance to next leaf node */
   //   uint32_t next_page_num = *leaf_node_next_leaf(node);
   //   if (next_page_num == 0) {
   //     /* This was rightmost leaf */
@@ -608,576 +2932,3555 @@ void cursor_advance(Cursor* cursor) {
         // This was the rightmost leaf
         cursor->end_of_table = true;
     } else {
-        cursor->page_num = next_page_num;
-        cursor->cell_num = 0;
+        cursor->page_num = next_page_num;
+        cursor->cell_num = 0;
+    }
+  }
+}
+
+void cursor_advance(Cursor* cursor) {
+  uint32_t page_num = cursor->page_num;
+  void* node = get_page(cursor->table->pager, page_num);
+  cursor_advance_in_leaf(cursor, node);
+}
+
+/**
+ * Varredura paralela da tabela inteira. As chaves separadoras dos nós internos, da raíz
+ * para baixo, dividem as chaves em faixas disjuntas com números parecidos de folhas, e
+ * cada faixa é percorrida por um thread pelas folhas encadeadas. Para cada folha a
+ * função recebe as células da faixa, [begin, end), com a folha travada em modo
+ * compartilhado; cada faixa tem o seu contexto, então a função não precisa de lock.
+ * As faixas estão em ordem de chave: juntar os contextos em ordem dá o resultado
+ * ordenado, e quem não precisa da ordem usa cada um assim que ele termina.
+ */
+typedef void (*ScanLeafFunction)(void* context, void* node, uint32_t begin, uint32_t end);
+typedef void (*ScanDoneFunction)(void* context);
+
+typedef struct {
+  Table* table;
+  uint64_t first_key; // os dois limites entram na faixa
+  uint64_t last_key;
+  ScanLeafFunction leaf;
+  ScanDoneFunction done; // chamada no thread da faixa depois da última folha, pode ser NULL
+  void* context;
+  pthread_t thread;
+} ScanPartition;
+
+int scan_key_compare(const void* a, const void* b) {
+  uint32_t key_a = *(const uint32_t*)a;
+  uint32_t key_b = *(const uint32_t*)b;
+  return key_a < key_b ? -1 : key_a > key_b;
+}
+
+/**
+ * Escolhe até max_partitions - 1 chaves separadoras. Desce um nível de cada vez até ter
+ * pelo menos 4 separadores por faixa ou chegar aos pais das folhas; nesse último caso
+ * cada separador é uma folha e as faixas ficam com pelo menos SCAN_MIN_LEAVES_PER_THREAD.
+ * Devolve o número de faixas.
+ */
+uint32_t table_scan_bounds(Table* table, uint32_t max_partitions, uint32_t* bounds) {
+  Pager* pager = table->pager;
+  void* root = get_page(pager, table->root_page_num);
+  if (max_partitions <= 1 || get_node_type(root) == NODE_LEAF) {
+    return 1;
+  }
+
+  uint32_t num_keys = 0;
+  uint32_t* keys = NULL;
+  uint32_t num_pages = 1;
+  uint32_t* pages = malloc(sizeof(uint32_t));
+  pages[0] = table->root_page_num;
+  bool leaves_below = false;
+  while (!leaves_below && num_keys < 4 * max_partitions) {
+    uint32_t num_children = 0;
+    uint32_t* children = NULL;
+    for (uint32_t i = 0; i < num_pages; i++) {
+      void* node = get_page(pager, pages[i]);
+      uint32_t node_keys = *internal_node_num_keys(node);
+      keys = realloc(keys, (num_keys + node_keys) * sizeof(uint32_t));
+      children = realloc(children, (num_children + node_keys + 1) * sizeof(uint32_t));
+      for (uint32_t j = 0; j < node_keys; j++) {
+        keys[num_keys++] = *internal_node_key(node, j);
+      }
+      for (uint32_t j = 0; j <= node_keys; j++) {
+        children[num_children++] = *internal_node_child(node, j);
+      }
+    }
+    free(pages);
+    pages = children;
+    num_pages = num_children;
+    leaves_below = get_node_type(get_page(pager, pages[0])) == NODE_LEAF;
+  }
+  free(pages);
+
+  uint32_t num_partitions = max_partitions;
+  if (leaves_below && (num_keys + 1) / SCAN_MIN_LEAVES_PER_THREAD < num_partitions) {
+    num_partitions = (num_keys + 1) / SCAN_MIN_LEAVES_PER_THREAD;
+  }
+  if (num_partitions > num_keys + 1) {
+    num_partitions = num_keys + 1;
+  }
+  if (num_partitions <= 1) {
+    free(keys);
+    return 1;
+  }
+  // os separadores de níveis diferentes se intercalam
+  qsort(keys, num_keys, sizeof(uint32_t), scan_key_compare);
+  for (uint32_t i = 1; i < num_partitions; i++) {
+    bounds[i - 1] = keys[(uint64_t)i * num_keys / num_partitions];
+  }
+  free(keys);
+  return num_partitions;
+}
+
+/**
+ * Percorre as folhas com chaves entre first_key e last_key. Com o latch da tabela
+ * seguro pelo thread que pediu a varredura os nós internos e o encadeamento das folhas
+ * não mudam; só o conteúdo de uma folha pode mudar, por um escritor com o latch dela.
+ * As páginas do thread corrente são liberadas a cada folha.
+ */
+void table_scan_range(ScanPartition* partition) {
+  Table* table = partition->table;
+  Pager* pager = table->pager;
+  uint32_t page_num = table_find_leaf(table, (uint32_t)partition->first_key);
+  bool first_leaf = true;
+  while (page_num != 0) {
+    pthread_rwlock_t* lock = &table->page_latches[page_num % PAGE_LATCH_STRIPES].lock;
+    pthread_rwlock_rdlock(lock);
+    void* node = get_page(pager, page_num);
+    uint32_t num_cells = *leaf_node_num_cells(node);
+    uint32_t begin = first_leaf ? leaf_node_find_cell(node, (uint32_t)partition->first_key) : 0;
+    uint32_t end = num_cells;
+    uint32_t next_page_num = *leaf_node_next_leaf(node);
+    if (num_cells > 0 && *leaf_node_key(node, num_cells - 1) > partition->last_key) {
+      end = leaf_node_find_cell(node, (uint32_t)partition->last_key + 1);
+      next_page_num = 0;
+    }
+    if (begin < end) {
+      partition->leaf(partition->context, node, begin, end);
+    }
+    pthread_rwlock_unlock(lock);
+    pager_release(pager);
+    page_num = next_page_num;
+    first_leaf = false;
+  }
+  if (partition->done != NULL) {
+    partition->done(partition->context);
+  }
+}
+
+void* table_scan_thread_main(void* argument) {
+  table_scan_range(argument);
+  return NULL;
+}
+
+/**
+ * Varre a tabela com até table->scan_threads threads; o thread corrente fica com a
+ * primeira faixa. contexts tem um contexto de context_size bytes por thread possível
+ * (SCAN_MAX_THREADS basta), e a faixa i usa o i-ésimo. Quem chama segura o latch da
+ * tabela e não pode estar no meio de um select, cuja folha travada poderia prender
+ * um escritor que os threads da varredura esperariam. Devolve o número de faixas.
+ */
+uint32_t table_scan_parallel(Table* table, ScanLeafFunction leaf, ScanDoneFunction done,
+                             void* contexts, size_t context_size) {
+  uint32_t bounds[SCAN_MAX_THREADS];
+  uint32_t num_partitions = table_scan_bounds(table, table->scan_threads, bounds);
+  pager_release(table->pager);
+
+  ScanPartition partitions[SCAN_MAX_THREADS];
+  for (uint32_t i = 0; i < num_partitions; i++) {
+    partitions[i].table = table;
+    partitions[i].first_key = i == 0 ? 0 : (uint64_t)bounds[i - 1] + 1;
+    partitions[i].last_key = i + 1 == num_partitions ? UINT32_MAX : bounds[i];
+    partitions[i].leaf = leaf;
+    partitions[i].done = done;
+    partitions[i].context = (char*)contexts + i * context_size;
+  }
+  for (uint32_t i = 1; i < num_partitions; i++) {
+    if (pthread_create(&partitions[i].thread, NULL, table_scan_thread_main, &partitions[i]) != 0) {
+      printf("Erro ao criar o thread da varredura: %d\n", errno);
+      exit(EXIT_FAILURE);
+    }
+  }
+  table_scan_range(&partitions[0]);
+  for (uint32_t i = 1; i < num_partitions; i++) {
+    pthread_join(partitions[i].thread, NULL);
+  }
+  return num_partitions;
+}
+
+void rql_close(Table* table) {
+  Pager* pager = table->pager;
+  pager_release(pager);
+
+  // uma transação sem commit é desfeita
+  if (table->in_transaction) {
+    table_rollback(table);
+  }
+  ThreadState* state = thread_state();
+  for (uint32_t i = 0; i < state->num_latches; i++) {
+    if (state->latches[i].table == table) {
+      leaf_unlatch(table, &state->latches[i]);
+      state->latches[i] = state->latches[--state->num_latches];
+      break;
+    }
+  }
+  pthread_rwlock_destroy(&table->latch);
+  pthread_mutex_destroy(&table->counts_lock);
+  for (uint32_t i = 0; i < PAGE_LATCH_STRIPES; i++) {
+    pthread_rwlock_destroy(&table->page_latches[i].lock);
+  }
+  free(table->page_latches);
+
+  // checkpoint final: o banco fica completo e o WAL é removido
+  table_counts_flush(table);
+  bloom_filters_save(table);
+  pager_commit(pager);
+  wal_close(pager->wal);
+  if (pager->compressed) {
+    compressed_file_compact(pager->compressed);
+  }
+  for (uint32_t i = 0; i < pager->num_frames; i++) {
+    free(pager_frame(pager, i)->data);
+  }
+  for (uint32_t i = 0; i < PAGER_MAX_FRAME_CHUNKS && pager->frame_chunks[i] != NULL; i++) {
+    free(pager->frame_chunks[i]);
+  }
+  for (uint32_t i = 0; i < PAGE_TABLE_CHUNK_SIZE; i++) {
+    free(pager->page_table[i]);
+  }
+  if (pager->use_mmap) {
+    munmap(pager->map, PAGER_MMAP_RESERVE);
+  }
+
+  int result = close(pager->file_descriptor);
+  if (result == -1) {
+    printf("Erro ao fechar o banco de dados.\n");
+    exit(EXIT_FAILURE);
+  }
+  free(pager->frame_chunks);
+  free(pager->page_table);
+  pthread_mutex_destroy(&pager->lock);
+  free(pager->dirty_pages);
+  free(pager->dirty_list);
+  free(pager);
+  free(table->id_filter.bits);
+  free(table->username_filter.bits);
+  free(table->counts_pending);
+  free(table->counts_pending_pages);
+  free(table);
+}
+
+
+
+void print_cache_stats(Pager* pager) {
+  uint64_t lookups = pager->cache_hits + pager->cache_misses;
+  printf("Cache:\n");
+  if (pager->use_mmap) {
+    printf("modo mmap: %d paginas mapeadas\n", pager->mapped_pages);
+    printf("paginas gravadas: %" PRIu64 "\n", pager->pages_written);
+    return;
+  }
+  printf("paginas em cache: %d/%d\n", pager->num_frames, pager->max_frames);
+  printf("acertos: %" PRIu64 "\n", pager->cache_hits);
+  printf("faltas: %" PRIu64 "\n", pager->cache_misses);
+  printf("despejos: %" PRIu64 "\n", pager->cache_evictions);
+  printf("paginas gravadas: %" PRIu64 "\n", pager->pages_written);
+  printf("taxa de acerto: %.1f%%\n", lookups ? 100.0 * pager->cache_hits / lookups : 0.0);
+}
+
+void print_page_stats(Pager* pager) {
+  uint32_t free_count = *db_header_free_count(get_page(pager, DB_HEADER_PAGE_NUM));
+  printf("Paginas:\n");
+  printf("total: %d\n", pager->num_pages);
+  printf("em uso: %d\n", pager->num_pages - free_count);
+  printf("livres: %d\n", free_count);
+}
+
+void print_wal_stats(Wal* wal) {
+  pthread_mutex_lock(&wal->lock);
+  printf("WAL:\n");
+  printf("modo: %s\n", wal->sync_mode == SYNC_FULL ? "full" : "normal");
+  printf("tamanho: %" PRIu64 " bytes\n", (uint64_t)wal->end);
+  printf("commits: %" PRIu64 "\n", wal->commits);
+  printf("sincronizacoes: %" PRIu64 "\n", wal->syncs);
+  printf("checkpoints: %" PRIu64 "\n", wal->checkpoints);
+  printf("paginas copiadas para o banco: %" PRIu64 "\n", wal->pages_checkpointed);
+  printf("paginas recuperadas: %" PRIu64 "\n", wal->pages_recovered);
+  pthread_mutex_unlock(&wal->lock);
+}
+
+// Conta só as páginas já copiadas para o banco; as que estão no WAL entram no próximo checkpoint
+void print_compression_stats(Pager* pager) {
+  CompressedFile* file = pager->compressed;
+  printf("Compressao:\n");
+  if (file == NULL) {
+    printf("desativada\n");
+    return;
+  }
+  pthread_mutex_lock(&file->lock);
+  printf("paginas no arquivo: %d\n", file->num_pages);
+  printf("bytes das paginas: %" PRIu64 "\n", file->bytes_uncompressed);
+  printf("bytes comprimidos: %" PRIu64 "\n", file->bytes_compressed);
+  printf("tamanho do arquivo: %" PRIu64 " bytes\n", (uint64_t)file->num_sectors * COMPRESSED_SECTOR_SIZE);
+  printf("taxa: %.1f%%\n", file->bytes_uncompressed ? 100.0 * file->bytes_compressed / file->bytes_uncompressed : 0.0);
+  pthread_mutex_unlock(&file->lock);
+}
+
+// comandos não sql do usuário, iniciados sempre com .
+MetaCommandResult table_meta_command(Table* table, const char* command) {
+  if (strcmp(command, ".btree") == 0) {
+    printf("Tree:\n");
+    print_tree(table->pager, table->root_page_num, 0, 3);
+    return META_COMMAND_SUCCESS;
+  } else if (strcmp(command, ".constants") == 0) {
+    printf("Constantes:\n");
+    print_constants();
+    return META_COMMAND_SUCCESS;
+  } else if (strcmp(command, ".flush") == 0) {
+    // dentro de uma transação só o que já foi efetivado vai para o banco
+    if (table->in_transaction) {
+      wal_checkpoint(table->pager->wal);
+    } else {
+      pager_checkpoint(table->pager);
+    }
+    printf("Executado.\n");
+    return META_COMMAND_SUCCESS;
+  } else if (strcmp(command, ".synchronous full") == 0) {
+    wal_set_sync_mode(table->pager->wal, SYNC_FULL);
+    return META_COMMAND_SUCCESS;
+  } else if (strcmp(command, ".synchronous normal") == 0) {
+    wal_set_sync_mode(table->pager->wal, SYNC_NORMAL);
+    return META_COMMAND_SUCCESS;
+  } else if (strcmp(command, ".wal") == 0) {
+    print_wal_stats(table->pager->wal);
+    return META_COMMAND_SUCCESS;
+  } else if (strcmp(command, ".pages") == 0) {
+    print_page_stats(table->pager);
+    return META_COMMAND_SUCCESS;
+  } else if (strcmp(command, ".cache") == 0) {
+    print_cache_stats(table->pager);
+    return META_COMMAND_SUCCESS;
+  } else if (strcmp(command, ".bloom") == 0) {
+    print_bloom_stats(table);
+    return META_COMMAND_SUCCESS;
+  } else if (strcmp(command, ".compression") == 0) {
+    print_compression_stats(table->pager);
+    return META_COMMAND_SUCCESS;
+  } else if (strncmp(command, ".import ", 8) == 0) {
+    char filename[256];
+    uint32_t fill_factor = BULK_LOAD_DEFAULT_FILL;
+    char extra;
+    int matched = sscanf(command, ".import %255s %u %c", filename, &fill_factor, &extra);
+    if (matched < 1 || matched > 2 || fill_factor < 50 || fill_factor > 100) {
+      printf("Uso: .import <arquivo.csv> [preenchimento entre 50 e 100]\n");
+      return META_COMMAND_SUCCESS;
+    }
+    if (table->in_transaction) {
+      printf("Erro: O .import não pode ser usado dentro de uma transação.\n");
+      return META_COMMAND_SUCCESS;
+    }
+    table_bulk_load(table, filename, fill_factor);
+    return META_COMMAND_SUCCESS;
+  } else if (strcmp(command, ".print_index") == 0) {
+    print_index(table);
+    return META_COMMAND_SUCCESS;
+  } else if (strcmp(command, ".threads") == 0) {
+    printf("threads de varredura: %u\n", table->scan_threads);
+    return META_COMMAND_SUCCESS;
+  } else if (strncmp(command, ".threads ", 9) == 0) {
+    uint32_t scan_threads;
+    char extra;
+    if (sscanf(command, ".threads %u %c", &scan_threads, &extra) != 1 ||
+        scan_threads < 1 || scan_threads > SCAN_MAX_THREADS) {
+      printf("Uso: .threads [1 a %d]\n", SCAN_MAX_THREADS);
+      return META_COMMAND_SUCCESS;
+    }
+    table->scan_threads = scan_threads;
+    return META_COMMAND_SUCCESS;
+  } else if (strcmp(command, ".simd") == 0) {
+    printf("kernels dos filtros: %s\n", table->filter_kernels->name);
+    return META_COMMAND_SUCCESS;
+  } else if (strncmp(command, ".simd ", 6) == 0) {
+    const FilterKernels* kernels = filter_kernels_named(command + 6);
+    if (kernels == NULL) {
+      printf("Erro: Kernels '%s' indisponíveis, use avx2, sse2 ou scalar.\n", command + 6);
+      return META_COMMAND_SUCCESS;
+    }
+    table->filter_kernels = kernels;
+    return META_COMMAND_SUCCESS;
+  } else if (strcmp(command, ".reindex") == 0) {
+    if (table->in_transaction) {
+      printf("Erro: O .reindex não pode ser usado dentro de uma transação.\n");
+      return META_COMMAND_SUCCESS;
+    }
+    table_reindex(table);
+    printf("Executado.\n");
+    return META_COMMAND_SUCCESS;
+  } else {
+    return META_COMMAND_UNRECOGNIZED_COMMAND;
+  }
+}
+
+// os comandos de manutenção rodam com o latch exclusivo, como os que alteram a tabela
+MetaCommandResult rql_meta_command(Table* table, const char* command) {
+  pager_release(table->pager);
+  table_unlatch_others(table);
+  TableLatch* latch = table_latch(table);
+  table_latch_exclusive(table, latch);
+  MetaCommandResult result = table_meta_command(table, command);
+  pager_release(table->pager);
+  table_unlatch_exclusive(table, latch);
+  return result;
+}
+
+bool is_parameter(const char* token) {
+  return strcmp(token, "?") == 0;
+}
+
+void statement_add_parameter(Statement* statement, ParameterTarget target, uint32_t row) {
+  statement->parameters = realloc(statement->parameters, (statement->num_parameters + 1) * sizeof(StatementParameter));
+  StatementParameter* parameter = &statement->parameters[statement->num_parameters++];
+  parameter->target = target;
+  parameter->row = row;
+  parameter->bound = false;
+}
+
+// valores de uma linha do insert; um campo '?' vira parâmetro e fica vazio até o bind
+PrepareResult prepare_row(Statement* statement, Row* row, uint32_t row_index, char* id_string, char* username, char* email) {
+  memset(row, 0, sizeof(Row));
+
+  if (is_parameter(id_string)) {
+    statement_add_parameter(statement, PARAMETER_ROW_ID, row_index);
+  } else {
+    // Converte a string do ID para inteiro
+    int id = atoi(id_string);
+    if (id < 0) {
+      return PREPARE_NEGATIVE_ID; // Retorna erro se o ID for negativo
+    }
+    row->id = id;
+  }
+
+  if (is_parameter(username)) {
+    statement_add_parameter(statement, PARAMETER_ROW_USERNAME, row_index);
+  } else if (strlen(username) > COLUMN_USERNAME_SIZE) {
+    return PREPARE_STRING_TOO_LONG; // Retorna erro se o username for muito longo
+  } else {
+    strcpy(row->username, username);
+  }
+
+  if (is_parameter(email)) {
+    statement_add_parameter(statement, PARAMETER_ROW_EMAIL, row_index);
+  } else if (strlen(email) > COLUMN_EMAIL_SIZE) {
+    return PREPARE_STRING_TOO_LONG; // Retorna erro se o email for muito longo
+  } else {
+    strcpy(row->email, email);
+  }
+
+  return PREPARE_SUCCESS;
+}
+
+// Função para preparar a instrução de inserção
+PrepareResult prepare_insert(char* sql, Statement* statement) {
+  // Define o tipo da instrução como inserção
+  statement->type = STATEMENT_INSERT;
+
+  // Divide a entrada em palavras usando espaço como delimitador
+  char* keyword = strtok(sql, " ");
+  char* id_string = strtok(NULL, " ");
+  char* username = strtok(NULL, " ");
+  char* email = strtok(NULL, " ");
+
+  // Verifica se todos os campos necessários foram fornecidos
+  if (id_string == NULL || username == NULL || email == NULL) {
+    return PREPARE_SYNTAX_ERROR; // Retorna erro de sintaxe se algum campo estiver faltando
+  }
+
+  return prepare_row(statement, &statement->row_to_insert, PARAMETER_SINGLE_ROW, id_string, username, email);
+}
+
+
+// copia o campo até o separador, sem os espaços das pontas; devolve o fim do campo
+char* insert_rows_field(char* start, char separator, char* destination, size_t capacity) {
+  char* end = strchr(start, separator);
+  if (end == NULL) {
+    return NULL;
+  }
+  while (start < end && *start == ' ') {
+    start++;
+  }
+  char* last = end;
+  while (last > start && last[-1] == ' ') {
+    last--;
+  }
+  size_t length = last - start;
+  if (length == 0 || length >= capacity) {
+    return NULL;
+  }
+  memcpy(destination, start, length);
+  destination[length] = '\0';
+  return end;
+}
+
+// insert (id, username, email), (id, username, email), ...
+PrepareResult prepare_insert_rows(char* sql, Statement* statement) {
+  statement->type = STATEMENT_INSERT_ROWS;
+  statement->num_rows_to_insert = 0;
+  uint32_t capacity = 16;
+  statement->rows_to_insert = malloc(capacity * sizeof(Row));
+
+  char id_string[16];
+  char username[COLUMN_USERNAME_SIZE + 2];
+  char email[COLUMN_EMAIL_SIZE + 2];
+  char* position = sql + strlen("insert");
+  PrepareResult result = PREPARE_SUCCESS;
+  while (result == PREPARE_SUCCESS) {
+    while (*position == ' ') {
+      position++;
+    }
+    if (*position != '(') {
+      result = PREPARE_SYNTAX_ERROR;
+      break;
+    }
+    char* end = insert_rows_field(position + 1, ',', id_string, sizeof(id_string));
+    if (end != NULL) {
+      end = insert_rows_field(end + 1, ',', username, sizeof(username));
+    }
+    if (end != NULL) {
+      end = insert_rows_field(end + 1, ')', email, sizeof(email));
+    }
+    if (end == NULL) {
+      result = PREPARE_SYNTAX_ERROR;
+      break;
+    }
+
+    if (statement->num_rows_to_insert == capacity) {
+      capacity *= 2;
+      statement->rows_to_insert = realloc(statement->rows_to_insert, capacity * sizeof(Row));
+    }
+    uint32_t row_index = statement->num_rows_to_insert++;
+    result = prepare_row(statement, &statement->rows_to_insert[row_index], row_index, id_string, username, email);
+
+    position = end + 1;
+    while (*position == ' ') {
+      position++;
+    }
+    if (*position == '\0') {
+      break;
+    }
+    if (*position != ',') {
+      result = PREPARE_SYNTAX_ERROR;
+    }
+    position++;
+  }
+
+  return result;
+}
+
+void statement_free(Statement* statement) {
+  free(statement->rows_to_insert);
+  statement->rows_to_insert = NULL;
+  free(statement->parameters);
+  statement->parameters = NULL;
+  statement->num_parameters = 0;
+}
+
+PrepareResult prepare_delete(char* sql, Statement* statement) {
+  statement->type = STATEMENT_DELETE;
+
+  char* keyword = strtok(sql, " ");
+  char* id_string = strtok(NULL, " ");
+
+  if (id_string == NULL) {
+    return PREPARE_SYNTAX_ERROR;
+  }
+  if (is_parameter(id_string)) {
+    statement_add_parameter(statement, PARAMETER_DELETE_ID, 0);
+    return PREPARE_SUCCESS;
+  }
+
+  int id = atoi(id_string);
+  if (id < 0) {
+    return PREPARE_NEGATIVE_ID;
+  }
+
+  statement->id_to_delete = id;
+
+  return PREPARE_SUCCESS;
+}
+
+// limite do select por id, limit ou offset: um número, que acima do maior id vale o maior id, ou '?'
+PrepareResult prepare_id_bound(Statement* statement, const char* token, ParameterTarget target, uint32_t* bound) {
+  if (is_parameter(token)) {
+    statement_add_parameter(statement, target, 0);
+    return PREPARE_SUCCESS;
+  }
+  char* end;
+  long long value = strtoll(token, &end, 10);
+  if (end == token || *end != '\0') {
+    return PREPARE_SYNTAX_ERROR;
+  }
+  if (value < 0) {
+    return PREPARE_NEGATIVE_ID;
+  }
+  *bound = value > UINT32_MAX ? UINT32_MAX : value;
+  return PREPARE_SUCCESS;
+}
+
+// select where id = <id> / select where id between <início> and <fim>: busca pela chave
+PrepareResult prepare_select_where_id(char* sql, Statement* statement) {
+  statement->type = STATEMENT_SELECT_BY_ID;
+  statement->id_range_start = 0;
+  statement->id_range_end = 0;
+
+  char start[32];
+  char end[32];
+  char extra;
+  if (sscanf(sql, "select where id = %31s %c", start, &extra) == 1) {
+    PrepareResult result = prepare_id_bound(statement, start, PARAMETER_SELECT_ID, &statement->id_range_start);
+    statement->id_range_end = statement->id_range_start;
+    return result;
+  }
+  if (sscanf(sql, "select where id between %31s and %31s %c", start, end, &extra) != 2) {
+    return PREPARE_SYNTAX_ERROR;
+  }
+  PrepareResult result = prepare_id_bound(statement, start, PARAMETER_RANGE_START, &statement->id_range_start);
+  if (result == PREPARE_SUCCESS) {
+    result = prepare_id_bound(statement, end, PARAMETER_RANGE_END, &statement->id_range_end);
+  }
+  return result;
+}
+
+// select where email = <valor> e select where <username|email> like <padrão>: varredura com filtro
+PrepareResult prepare_select_filter(Statement* statement, const char* column, bool like, const char* value) {
+  statement->type = STATEMENT_SELECT_BY_FILTER;
+  statement->filter_like = like;
+  if (strcmp(column, "username") == 0) {
+    statement->filter_column = COLUMN_USERNAME;
+  } else if (strcmp(column, "email") == 0) {
+    statement->filter_column = COLUMN_EMAIL;
+  } else {
+    return PREPARE_SYNTAX_ERROR;
+  }
+  if (is_parameter(value)) {
+    statement_add_parameter(statement, PARAMETER_FILTER_PATTERN, 0);
+    statement->filter_pattern[0] = '\0';
+    return PREPARE_SUCCESS;
+  }
+  if (strlen(value) > COLUMN_EMAIL_SIZE) {
+    return PREPARE_STRING_TOO_LONG;
+  }
+  strcpy(statement->filter_pattern, value);
+  return PREPARE_SUCCESS;
+}
+
+// select where username = <username>: busca pelo índice
+PrepareResult prepare_select_where(char* sql, Statement* statement) {
+  if (strncmp(sql, "select where id ", 16) == 0) {
+    return prepare_select_where_id(sql, statement);
+  }
+  statement->type = STATEMENT_SELECT_BY_USERNAME;
+
+  char column[16];
+  char operator[8];
+  char username[256];
+  char extra;
+  int matched = sscanf(sql, "select where %15s %7s %255s %c", column, operator, username, &extra);
+  if (matched != 3) {
+    return PREPARE_SYNTAX_ERROR;
+  }
+  bool like = strcmp(operator, "like") == 0;
+  if (!like && strcmp(operator, "=") != 0) {
+    return PREPARE_SYNTAX_ERROR;
+  }
+  if (like || strcmp(column, "username") != 0) {
+    return prepare_select_filter(statement, column, like, username);
+  }
+  if (is_parameter(username)) {
+    statement_add_parameter(statement, PARAMETER_FIND_USERNAME, 0);
+    statement->username_to_find[0] = '\0';
+    return PREPARE_SUCCESS;
+  }
+  if (strlen(username) > COLUMN_USERNAME_SIZE) {
+    return PREPARE_STRING_TOO_LONG;
+  }
+  strcpy(statement->username_to_find, username);
+
+  return PREPARE_SUCCESS;
+}
+
+// select count(*) [where id = <id> | where id between <início> and <fim>]: conta pelos totais dos nós internos
+PrepareResult prepare_select_count(char* sql, Statement* statement) {
+  char* rest = sql + strlen("select count(*)");
+  if (*rest == '\0') {
+    statement->type = STATEMENT_SELECT_COUNT;
+    statement->id_range_start = 0;
+    statement->id_range_end = UINT32_MAX;
+    return PREPARE_SUCCESS;
+  }
+  if (strncmp(rest, " where id ", 10) != 0) {
+    return PREPARE_SYNTAX_ERROR;
+  }
+  // sem o count(*) sobra um select por id
+  memmove(sql + strlen("select"), rest, strlen(rest) + 1);
+  PrepareResult result = prepare_select_where_id(sql, statement);
+  statement->type = STATEMENT_SELECT_COUNT;
+  return result;
+}
+
+// limit <L> offset <O>, limit <L> ou offset <O>, no fim do select da tabela ou por id
+PrepareResult prepare_select_page(char* clause, Statement* statement) {
+  if (statement->type != STATEMENT_SELECT && statement->type != STATEMENT_SELECT_BY_ID) {
+    return PREPARE_SYNTAX_ERROR;
+  }
+  char limit[32];
+  char offset[32];
+  char extra;
+  PrepareResult result = PREPARE_SUCCESS;
+  if (sscanf(clause, "limit %31s offset %31s %c", limit, offset, &extra) == 2) {
+    result = prepare_id_bound(statement, limit, PARAMETER_LIMIT, &statement->limit);
+    if (result == PREPARE_SUCCESS) {
+      result = prepare_id_bound(statement, offset, PARAMETER_OFFSET, &statement->offset);
+    }
+  } else if (sscanf(clause, "limit %31s %c", limit, &extra) == 1) {
+    result = prepare_id_bound(statement, limit, PARAMETER_LIMIT, &statement->limit);
+  } else if (sscanf(clause, "offset %31s %c", offset, &extra) == 1) {
+    result = prepare_id_bound(statement, offset, PARAMETER_OFFSET, &statement->offset);
+  } else {
+    result = PREPARE_SYNTAX_ERROR;
+  }
+  return result;
+}
+
+// select [count(*)] [where ...] [limit <L>] [offset <O>]
+PrepareResult prepare_select(char* sql, Statement* statement) {
+  // os valores não têm espaços, então o limit e o offset só podem ser o fim do comando
+  char* clause = strstr(sql, " limit ");
+  if (clause == NULL) {
+    clause = strstr(sql, " offset ");
+  }
+  if (clause != NULL) {
+    *clause++ = '\0';
+  }
+
+  PrepareResult result;
+  if (strcmp(sql, "select") == 0) {
+    statement->type = STATEMENT_SELECT;
+    result = PREPARE_SUCCESS;
+  } else if (strncmp(sql, "select where", 12) == 0) {
+    result = prepare_select_where(sql, statement);
+  } else if (strncmp(sql, "select count(*)", 15) == 0) {
+    result = prepare_select_count(sql, statement);
+  } else {
+    return PREPARE_UNRECOGNIZED_STATEMENT;
+  }
+  if (result != PREPARE_SUCCESS || clause == NULL) {
+    return result;
+  }
+  return prepare_select_page(clause, statement);
+}
+
+// processador de comandos SQL
+PrepareResult prepare_statement(char* sql, Statement* statement) {
+  statement->rows_to_insert = NULL;
+  statement->parameters = NULL;
+  statement->num_parameters = 0;
+  statement->hint_page_num = 0;
+  statement->limit = UINT32_MAX;
+  statement->offset = 0;
+  if (strncmp(sql, "insert (", 8) == 0) {
+    return prepare_insert_rows(sql, statement);
+  }
+  if (strncmp(sql, "insert", 6) == 0) {
+    return prepare_insert(sql, statement);
+  }
+  if (strcasecmp(sql, "begin") == 0) {
+    statement->type = STATEMENT_BEGIN;
+    return PREPARE_SUCCESS;
+  }
+  if (strcasecmp(sql, "commit") == 0) {
+    statement->type = STATEMENT_COMMIT;
+    return PREPARE_SUCCESS;
+  }
+  if (strcasecmp(sql, "rollback") == 0) {
+    statement->type = STATEMENT_ROLLBACK;
+    return PREPARE_SUCCESS;
+  }
+  if (strncmp(sql, "select", 6) == 0) {
+    return prepare_select(sql, statement);
+  }
+  if (strncmp(sql, "delete", 6) == 0) {
+    return prepare_delete(sql, statement);
+  }
+
+  return PREPARE_UNRECOGNIZED_STATEMENT;
+}
+
+/**
+ * reaproveita a primeira página da lista de livres;
+ * sem páginas livres, as novas paginas vão para o final do arquivo do banco de dados
+*/
+uint32_t get_unused_page_num(Pager* pager) {
+  void* header = get_page(pager, DB_HEADER_PAGE_NUM);
+  uint32_t page_num = *db_header_free_head(header);
+  if (page_num == 0) {
+    return pager->num_pages;
+  }
+
+  void* page = get_page(pager, page_num);
+  *db_header_free_head(header) = *free_page_next(page);
+  *db_header_free_count(header) -= 1;
+  pager_mark_dirty(pager, DB_HEADER_PAGE_NUM);
+  return page_num;
+}
+
+// devolve uma página que saiu da árvore para a lista de livres
+void free_page(Pager* pager, uint32_t page_num) {
+  void* header = get_page(pager, DB_HEADER_PAGE_NUM);
+  void* page = get_page(pager, page_num);
+
+  memset(page, 0, PAGE_SIZE);
+  set_node_type(page, NODE_FREE);
+  *free_page_next(page) = *db_header_free_head(header);
+  *db_header_free_head(header) = page_num;
+  *db_header_free_count(header) += 1;
+  pager_mark_dirty(pager, page_num);
+  pager_mark_dirty(pager, DB_HEADER_PAGE_NUM);
+}
+
+/**
+ * Totais das subárvores
+ * Cada célula de um nó interno sabe quantas linhas há abaixo do filho. Um insert ou
+ * delete que só mexe numa folha soma ou subtrai 1 no caminho até a raíz; as divisões,
+ * uniões e empréstimos levam os totais junto com as células e recalculam os dos nós
+ * que mudaram de filhos.
+ */
+uint32_t node_row_count(void* node) {
+  if (get_node_type(node) == NODE_LEAF) {
+    return *leaf_node_num_cells(node);
+  }
+  // os inserts e deletes pelas folhas mudam os totais com o latch compartilhado
+  uint32_t num_keys = *internal_node_num_keys(node);
+  uint32_t count = 0;
+  for (uint32_t i = 0; i <= num_keys; i++) {
+    count += __atomic_load_n(internal_node_count(node, i), __ATOMIC_RELAXED);
+  }
+  return count;
+}
+
+/**
+ * Soma delta nos totais acima da folha, subindo pelos pais. A chave da linha inserida ou
+ * removida ainda leva a cada filho pela busca, antes de qualquer separadora mudar.
+ * Guarda em page_nums os nós alterados e devolve quantos são.
+ */
+uint32_t node_counts_add(Pager* pager, uint32_t page_num, uint32_t key, int32_t delta, uint32_t* page_nums) {
+  uint32_t num_pages = 0;
+  void* node = get_page(pager, page_num);
+  while (!is_node_root(node)) {
+    uint32_t parent_page_num = *node_parent(node);
+    void* parent = get_page(pager, parent_page_num);
+    uint32_t index = internal_node_find_child(parent, key);
+    if (*internal_node_child(parent, index) != page_num) {
+      index = internal_node_child_index(parent, page_num);
+    }
+    __atomic_fetch_add(internal_node_count(parent, index), (uint32_t)delta, __ATOMIC_RELAXED);
+    page_nums[num_pages++] = parent_page_num;
+    page_num = parent_page_num;
+    node = parent;
+  }
+  return num_pages;
+}
+
+void table_counts_add(Table* table, uint32_t page_num, uint32_t key, int32_t delta) {
+  uint32_t page_nums[TABLE_MAX_DEPTH];
+  uint32_t num_pages = node_counts_add(table->pager, page_num, key, delta, page_nums);
+  for (uint32_t i = 0; i < num_pages; i++) {
+    pager_mark_dirty(table->pager, page_nums[i]);
+  }
+}
+
+/**
+ * Os inserts e deletes pelas folhas mudam os totais com o latch compartilhado e não
+ * levam os nós internos para o WAL: a página fica segura no pool e entra na lista,
+ * com o counts_lock. Ela vai para o log antes do próximo comando com o exclusivo.
+ */
+void table_counts_hold(Table* table, uint32_t page_num) {
+  if (page_num >= table->counts_pending_pages_capacity) {
+    uint32_t new_capacity = table->counts_pending_pages_capacity ? table->counts_pending_pages_capacity : 64;
+    while (new_capacity <= page_num) {
+      new_capacity *= 2;
+    }
+    table->counts_pending_pages = realloc(table->counts_pending_pages, new_capacity * sizeof(bool));
+    memset(table->counts_pending_pages + table->counts_pending_pages_capacity, 0,
+           (new_capacity - table->counts_pending_pages_capacity) * sizeof(bool));
+    table->counts_pending_pages_capacity = new_capacity;
+  }
+  if (table->counts_pending_pages[page_num]) {
+    return;
+  }
+  table->counts_pending_pages[page_num] = true;
+  pager_hold_page(table->pager, page_num);
+  if (table->num_counts_pending == table->counts_pending_capacity) {
+    table->counts_pending_capacity = table->counts_pending_capacity ? table->counts_pending_capacity * 2 : 16;
+    table->counts_pending = realloc(table->counts_pending, table->counts_pending_capacity * sizeof(uint32_t));
+  }
+  table->counts_pending[table->num_counts_pending++] = page_num;
+}
+
+/**
+ * Grava no WAL, num commit só deles, os nós da lista. Chamada com o exclusivo antes de
+ * o comando alterar alguma página, então o rollback dele não desfaz esses totais. Se o
+ * processo cair antes disso, a abertura recalcula os totais (table_counts_rebuild).
+ */
+void table_counts_flush(Table* table) {
+  if (table->num_counts_pending == 0) {
+    return;
+  }
+  Pager* pager = table->pager;
+  void** pages = malloc(table->num_counts_pending * sizeof(void*));
+  for (uint32_t i = 0; i < table->num_counts_pending; i++) {
+    uint32_t page_num = table->counts_pending[i];
+    pages[i] = get_page(pager, page_num);
+    if (!pager->use_mmap) {
+      pager_frame(pager, page_table_lookup(pager, page_num))->dirty = false;
+    }
+    table->counts_pending_pages[page_num] = false;
+  }
+  wal_commit(pager->wal, table->counts_pending, pages, table->num_counts_pending, pager->num_pages);
+  pager->pages_written += table->num_counts_pending;
+  table->num_counts_pending = 0;
+  free(pages);
+}
+
+// recalcula os totais da subárvore a partir das folhas e devolve quantas linhas ela tem
+uint32_t node_counts_rebuild(Pager* pager, uint32_t page_num) {
+  void* node = get_page(pager, page_num);
+  if (get_node_type(node) == NODE_LEAF) {
+    return *leaf_node_num_cells(node);
+  }
+  uint32_t num_keys = *internal_node_num_keys(node);
+  uint32_t total = 0;
+  bool changed = false;
+  for (uint32_t i = 0; i <= num_keys; i++) {
+    uint32_t child_page_num = i == num_keys ? *internal_node_right_child(node) : *internal_node_child(node, i);
+    uint32_t count = node_counts_rebuild(pager, child_page_num);
+    // as folhas lidas são soltas a cada filho, e o nó é obtido de novo
+    pager_release(pager);
+    node = get_page(pager, page_num);
+    if (*internal_node_count(node, i) != count) {
+      *internal_node_count(node, i) = count;
+      changed = true;
+    }
+    total += count;
+  }
+  if (changed) {
+    pager_mark_dirty(pager, page_num);
+  }
+  return total;
+}
+
+/**
+ * Na abertura depois de uma queda: as folhas alteradas com o latch compartilhado podem ter
+ * chegado ao WAL sem os totais dos pais, então eles são refeitos lendo todas as folhas.
+ */
+void table_counts_rebuild(Table* table) {
+  node_counts_rebuild(table->pager, table->root_page_num);
+  pager_commit(table->pager);
+}
+
+// refaz os totais do caminho da página até a raíz a partir do que está em cada nó
+void node_counts_refresh(Pager* pager, uint32_t page_num) {
+  void* node = get_page(pager, page_num);
+  while (!is_node_root(node)) {
+    uint32_t parent_page_num = *node_parent(node);
+    void* parent = get_page(pager, parent_page_num);
+    *internal_node_count(parent, internal_node_child_index(parent, page_num)) = node_row_count(node);
+    pager_mark_dirty(pager, parent_page_num);
+    page_num = parent_page_num;
+    node = parent;
+  }
+}
+
+void create_new_root(Table* table, uint32_t right_child_page_num) {
+  /**
+   * divide o nó raíz
+   * A antiga raíz é copiada para uma nova página e se torna o filho da esquerda
+   * O endereço do filho da direita é passado
+   * Reinicializa a página raíz para contar o a o novo nó raíz
+   * novo nó raíz aponta para os dois filhos
+  */
+
+  void* root = get_page(table->pager, table->root_page_num);
+  void* right_child = get_page(table->pager, right_child_page_num);
+  uint32_t left_child_page_num = get_unused_page_num(table->pager);
+  void* left_child = get_page(table->pager, left_child_page_num);
+  //The old root is copied to the left child so we can reuse the root page:
+
+  /**
+  * dados do filho da esquerda copiados para a nova raíz
+  */
+
+  memcpy(left_child, root, PAGE_SIZE);
+  set_node_root(left_child, false);
+
+  // a antiga raíz mudou de página: os filhos dela precisam apontar para o novo endereço
+  if (get_node_type(left_child) == NODE_INTERNAL) {
+    for (uint32_t i = 0; i <= *internal_node_num_keys(left_child); i++) {
+      uint32_t child_page_num = i < *internal_node_num_keys(left_child)
+                                    ? *internal_node_child(left_child, i)
+                                    : *internal_node_right_child(left_child);
+      *node_parent(get_page(table->pager, child_page_num)) = left_child_page_num;
+      pager_mark_dirty(table->pager, child_page_num);
+    }
+  }
+
+/**
+ * inicializa a página raíz como um nó interno com 2 filhos
+ * nó raíz é um novo nó interno com uma chave e 2 filhos
+ */
+
+  initialize_internal_node(root);
+  set_node_root(root, true);
+  *internal_node_num_keys(root) = 1;
+  *internal_node_child(root, 0) = left_child_page_num;
+  uint32_t left_child_max_key = get_node_max_key(table->pager, left_child);
+  *internal_node_key(root, 0) = left_child_max_key;
+  *internal_node_right_child(root) = right_child_page_num;
+  *internal_node_count(root, 0) = node_row_count(left_child);
+  *internal_node_right_count(root) = node_row_count(right_child);
+  *node_parent(left_child) = table->root_page_num;
+  *node_parent(right_child) = table->root_page_num;
+
+  pager_mark_dirty(table->pager, table->root_page_num);
+  pager_mark_dirty(table->pager, left_child_page_num);
+  pager_mark_dirty(table->pager, right_child_page_num);
+}
+
+
+
+void update_internal_node_key(void* node, uint32_t old_key, uint32_t new_key) {
+  uint32_t old_child_index = internal_node_find_child(node, old_key);
+  // o filho da direita não tem chave no nó
+  if (old_child_index < *internal_node_num_keys(node)) {
+    *internal_node_key(node, old_child_index) = new_key;
+  }
+}
+
+// o nó está na borda direita da árvore: ele e os seus ancestrais são o filho da direita do pai
+bool internal_node_is_rightmost(Pager* pager, uint32_t page_num) {
+  void* node = get_page(pager, page_num);
+  while (!is_node_root(node)) {
+    uint32_t parent_page_num = *node_parent(node);
+    void* parent = get_page(pager, parent_page_num);
+    if (*internal_node_right_child(parent) != page_num) {
+      return false;
+    }
+    page_num = parent_page_num;
+    node = parent;
+  }
+  return true;
+}
+
+/**
+ * Divide um nó interno cheio ao receber mais um filho.
+ * Os filhos existentes e o novo são ordenados pela maior chave e divididos ao meio:
+ * a metade da esquerda fica na página original e a da direita vai para uma página nova,
+ * cujos filhos passam a apontar para ela. Depois a nova página é inserida no pai,
+ * que pode se dividir também, ou vira filha de uma nova raíz.
+ */
+void internal_node_split_and_insert(Table* table, uint32_t page_num, uint32_t child_page_num) {
+  Pager* pager = table->pager;
+  void* node = get_page(pager, page_num);
+  uint32_t old_max = get_node_max_key(pager, node);
+  uint32_t child_max_key = get_node_max_key(pager, get_page(pager, child_page_num));
+  uint32_t child_count = node_row_count(get_page(pager, child_page_num));
+
+  uint32_t num_keys = *internal_node_num_keys(node);
+  uint32_t children[INTERNAL_NODE_MAX_CELLS + 2];
+  uint32_t keys[INTERNAL_NODE_MAX_CELLS + 2];
+  uint32_t counts[INTERNAL_NODE_MAX_CELLS + 2];
+  uint32_t total = 0;
+  bool inserted = false;
+  for (uint32_t i = 0; i <= num_keys; i++) {
+    uint32_t key = i < num_keys ? *internal_node_key(node, i) : old_max;
+    if (!inserted && child_max_key < key) {
+      children[total] = child_page_num;
+      counts[total] = child_count;
+      keys[total++] = child_max_key;
+      inserted = true;
+    }
+    children[total] = *internal_node_child(node, i);
+    counts[total] = *internal_node_count(node, i);
+    keys[total++] = key;
+  }
+  if (!inserted) {
+    children[total] = child_page_num;
+    counts[total] = child_count;
+    keys[total++] = child_max_key;
+  }
+
+  // o novo filho entrou no fim do último nó do nível, como acontece com ids crescentes:
+  // o nó velho fica cheio e o novo recebe só os dois últimos filhos
+  uint32_t left_count = total / 2;
+  if (!inserted && internal_node_is_rightmost(pager, page_num)) {
+    left_count = total - 2;
+  }
+  uint32_t new_page_num = get_unused_page_num(pager);
+  void* new_node = get_page(pager, new_page_num);
+  initialize_internal_node(new_node);
+  *node_parent(new_node) = *node_parent(node);
+
+  *internal_node_num_keys(node) = left_count - 1;
+  for (uint32_t i = 0; i < left_count; i++) {
+    *internal_node_child(node, i) = children[i];
+    *internal_node_count(node, i) = counts[i];
+    if (i < left_count - 1) {
+      *internal_node_key(node, i) = keys[i];
+    }
+  }
+
+  *internal_node_num_keys(new_node) = total - left_count - 1;
+  for (uint32_t i = left_count; i < total; i++) {
+    *internal_node_child(new_node, i - left_count) = children[i];
+    *internal_node_count(new_node, i - left_count) = counts[i];
+    if (i < total - 1) {
+      *internal_node_key(new_node, i - left_count) = keys[i];
+    }
+    *node_parent(get_page(pager, children[i])) = new_page_num;
+    pager_mark_dirty(pager, children[i]);
+  }
+  for (uint32_t i = 0; i < left_count; i++) {
+    if (children[i] == child_page_num) {
+      *node_parent(get_page(pager, child_page_num)) = page_num;
+      pager_mark_dirty(pager, child_page_num);
+    }
+  }
+  pager_mark_dirty(pager, page_num);
+  pager_mark_dirty(pager, new_page_num);
+
+  if (is_node_root(node)) {
+    create_new_root(table, new_page_num);
+  } else {
+    uint32_t parent_page_num = *node_parent(node);
+    void* parent = get_page(pager, parent_page_num);
+    // os filhos que foram para a página nova entram no pai com ela
+    *internal_node_count(parent, internal_node_child_index(parent, page_num)) = node_row_count(node);
+    update_internal_node_key(parent, old_max, keys[left_count - 1]);
+    pager_mark_dirty(pager, parent_page_num);
+    internal_node_insert(table, parent_page_num, new_page_num);
+  }
+}
+
+void internal_node_insert(Table* table, uint32_t parent_page_num,
+                          uint32_t child_page_num) {
+  void* parent = get_page(table->pager, parent_page_num);
+  void* child = get_page(table->pager, child_page_num);
+  uint32_t child_max_key = get_node_max_key(table->pager, child);
+  uint32_t index = internal_node_find_child(parent, child_max_key);
+
+  uint32_t original_num_keys = *internal_node_num_keys(parent);
+  if (original_num_keys >= INTERNAL_NODE_MAX_CELLS) {
+    internal_node_split_and_insert(table, parent_page_num, child_page_num);
+    return;
+  }
+
+  *internal_node_num_keys(parent) = original_num_keys + 1;
+  *node_parent(child) = parent_page_num;
+  pager_mark_dirty(table->pager, parent_page_num);
+  pager_mark_dirty(table->pager, child_page_num);
+
+  uint32_t right_child_page_num = *internal_node_right_child(parent);
+  void* right_child = get_page(table->pager, right_child_page_num);
+
+  if (child_max_key > get_node_max_key(table->pager, right_child)) {
+    /* Substitui o filho direito */
+    *internal_node_child(parent, original_num_keys) = right_child_page_num;
+    *internal_node_key(parent, original_num_keys) = get_node_max_key(table->pager, right_child);
+    *internal_node_count(parent, original_num_keys) = *internal_node_right_count(parent);
+    *internal_node_right_child(parent) = child_page_num;
+    *internal_node_right_count(parent) = node_row_count(child);
+  } else {
+    /* Abre espaço para uma nova célula */
+    internal_node_move_cells(parent, index + 1, parent, index, original_num_keys - index);
+    *internal_node_child(parent, index) = child_page_num;
+    *internal_node_key(parent, index) = child_max_key;
+    *internal_node_count(parent, index) = node_row_count(child);
+  }
+}
+
+
+void leaf_node_split_and_insert(Cursor* cursor, uint32_t key, Row* value) {
+/**
+  * Criar um node e move metade das celulas
+  * Insere um novo valor em um dos dois nodes
+  * atualiza o pai ou cria um novo pai
+  */  
+  void* old_node = get_page(cursor->table->pager, cursor->page_num);
+  uint32_t old_max = get_node_max_key(cursor->table->pager, old_node);
+  // a nova chave vai depois da maior da tabela: um append no fim da última folha
+  bool append = *leaf_node_next_leaf(old_node) == 0 &&
+                cursor->cell_num == *leaf_node_num_cells(old_node);
+  uint32_t new_page_num = get_unused_page_num(cursor->table->pager);
+  void* new_node = get_page(cursor->table->pager, new_page_num);
+  initialize_leaf_node(new_node);
+  *node_parent(new_node) = *node_parent(old_node);
+  *leaf_node_next_leaf(new_node) = *leaf_node_next_leaf(old_node);
+  *leaf_node_next_leaf(old_node) = new_page_num;
+  pager_mark_dirty(cursor->table->pager, cursor->page_num);
+  pager_mark_dirty(cursor->table->pager, new_page_num);
+
+  /**
+   * as células existentes mais a nova são divididas pelo espaço ocupado
+   * entre o node velho (esquerda) e o novo (direita); as linhas são lidas de
+   * uma cópia da página porque o node velho é reescrito
+  */
+  uint8_t old_copy[PAGE_SIZE];
+  memcpy(old_copy, old_node, PAGE_SIZE);
+  uint8_t record[ROW_SIZE];
+  LeafCell cells[LEAF_NODE_MAX_CELLS + 1];
+  uint32_t num_cells = leaf_cells_collect(old_copy, cells);
+  memmove(&cells[cursor->cell_num + 1], &cells[cursor->cell_num],
+          (num_cells - cursor->cell_num) * sizeof(LeafCell));
+  cells[cursor->cell_num].key = key;
+  cells[cursor->cell_num].value = record;
+  cells[cursor->cell_num].size = serialize_row(value, record);
+  num_cells++;
+
+  // no append a folha velha fica cheia e só a linha nova vai para a direita: dividida
+  // ao meio, a metade da esquerda nunca mais receberia linhas e ficaria meio vazia
+  uint32_t split = append ? num_cells - 1 : leaf_cells_split_point(cells, num_cells);
+  leaf_node_fill(old_node, cells, split);
+  leaf_node_fill(new_node, cells + split, num_cells - split);
+  if (append) {
+    cursor->table->rightmost_leaf_page_num = new_page_num;
+  }
+
+  /**
+   * Atualizar os parent nodes.
+   * se o nó original for um nó raíz, não tem pai.
+   * Nesse caso, cria um novo nó raíz para ser o pai.
+   */
+
+  if (is_node_root(old_node)) {
+    return create_new_root(cursor->table, new_page_num);
+  } else {
+    uint32_t parent_page_num = *node_parent(old_node);
+    uint32_t new_max = get_node_max_key(cursor->table->pager, old_node);
+    void* parent = get_page(cursor->table->pager, parent_page_num);
+
+    update_internal_node_key(parent, old_max, new_max);
+    *internal_node_count(parent, internal_node_child_index(parent, cursor->page_num)) = *leaf_node_num_cells(old_node);
+    pager_mark_dirty(cursor->table->pager, parent_page_num);
+    internal_node_insert(cursor->table, parent_page_num, new_page_num);
+    // a linha a mais chega aos nós acima do último que recebeu um filho
+    node_counts_refresh(cursor->table->pager, new_page_num);
+    return;
+  }
+}
+
+/**
+ * Índice secundário de username
+ * Uma segunda árvore B+ no mesmo arquivo, com a raíz guardada no cabeçalho.
+ * A chave é o par (username, id), então usernames repetidos ficam lado a lado e
+ * cada entrada é única. Como na tabela, a chave de cada célula de um nó interno é
+ * a maior chave do filho. Os nós não guardam o pai: a descida anota o caminho,
+ * usado depois para propagar as divisões e os rebalanceamentos.
+ */
+typedef struct {
+  uint32_t page_nums[INDEX_MAX_DEPTH]; // da raíz até a folha
+  uint32_t child_indexes[INDEX_MAX_DEPTH]; // posição de page_nums[i + 1] dentro de page_nums[i]
+  uint32_t depth; // page_nums[depth] é a folha
+} IndexPath;
+
+void index_key_make(IndexKey* key, const char* username, uint32_t id) {
+  memset(key->username, 0, COLUMN_USERNAME_SIZE);
+  memcpy(key->username, username, strnlen(username, COLUMN_USERNAME_SIZE));
+  key->id = id;
+}
+
+// a mesma chave, lida direto da linha serializada
+void index_key_from_record(IndexKey* key, void* record) {
+  uint8_t username_length = *(uint8_t*)(record + USERNAME_OFFSET);
+  memset(key->username, 0, COLUMN_USERNAME_SIZE);
+  memcpy(key->username, record + USERNAME_OFFSET + COLUMN_LENGTH_SIZE, username_length);
+  memcpy(&key->id, record + ID_OFFSET, ID_SIZE);
+}
+
+// o username é completado com zeros, então memcmp ordena como strcmp
+int index_key_compare(const IndexKey* a, const IndexKey* b) {
+  int result = memcmp(a->username, b->username, COLUMN_USERNAME_SIZE);
+  if (result != 0) {
+    return result;
+  }
+  return a->id < b->id ? -1 : a->id > b->id;
+}
+
+uint8_t* index_node_type(void* node) {
+  return node + NODE_TYPE_OFFSET;
+}
+
+uint32_t* index_leaf_node_num_cells(void* node) {
+  return node + INDEX_LEAF_NODE_NUM_CELLS_OFFSET;
+}
+
+uint32_t* index_leaf_node_next_leaf(void* node) {
+  return node + INDEX_LEAF_NODE_NEXT_LEAF_OFFSET;
+}
+
+IndexKey* index_leaf_node_key(void* node, uint32_t cell_num) {
+  return node + INDEX_LEAF_NODE_HEADER_SIZE + cell_num * INDEX_KEY_SIZE;
+}
+
+uint32_t* index_internal_node_num_keys(void* node) {
+  return node + INDEX_INTERNAL_NODE_NUM_KEYS_OFFSET;
+}
+
+uint32_t* index_internal_node_right_child(void* node) {
+  return node + INDEX_INTERNAL_NODE_RIGHT_CHILD_OFFSET;
+}
+
+void* index_internal_node_cell(void* node, uint32_t cell_num) {
+  return node + INDEX_INTERNAL_NODE_HEADER_SIZE + cell_num * INDEX_INTERNAL_NODE_CELL_SIZE;
+}
+
+uint32_t* index_internal_node_child(void* node, uint32_t child_num) {
+  if (child_num == *index_internal_node_num_keys(node)) {
+    return index_internal_node_right_child(node);
+  }
+  return index_internal_node_cell(node, child_num);
+}
+
+IndexKey* index_internal_node_key(void* node, uint32_t key_num) {
+  return index_internal_node_cell(node, key_num) + INDEX_INTERNAL_NODE_CHILD_SIZE;
+}
+
+void initialize_index_leaf_node(void* node) {
+  memset(node, 0, PAGE_SIZE);
+  *index_node_type(node) = INDEX_NODE_LEAF;
+}
+
+void initialize_index_internal_node(void* node) {
+  memset(node, 0, PAGE_SIZE);
+  *index_node_type(node) = INDEX_NODE_INTERNAL;
+}
+
+// reescreve a folha com as chaves dadas, zerando o resto da página
+void index_leaf_node_fill(void* node, IndexKey* keys, uint32_t num_cells) {
+  memset(node + INDEX_LEAF_NODE_HEADER_SIZE, 0, PAGE_SIZE - INDEX_LEAF_NODE_HEADER_SIZE);
+  memcpy(index_leaf_node_key(node, 0), keys, num_cells * INDEX_KEY_SIZE);
+  *index_leaf_node_num_cells(node) = num_cells;
+}
+
+// reescreve o nó interno: children tem num_keys + 1 filhos, o último vira o filho da direita
+void index_internal_node_fill(void* node, uint32_t* children, IndexKey* keys, uint32_t num_keys) {
+  memset(node + INDEX_INTERNAL_NODE_HEADER_SIZE, 0, PAGE_SIZE - INDEX_INTERNAL_NODE_HEADER_SIZE);
+  *index_internal_node_num_keys(node) = num_keys;
+  for (uint32_t i = 0; i < num_keys; i++) {
+    *index_internal_node_child(node, i) = children[i];
+    *index_internal_node_key(node, i) = keys[i];
+  }
+  *index_internal_node_right_child(node) = children[num_keys];
+}
+
+// copia os filhos e as chaves do nó para os arrays; devolve o número de chaves
+uint32_t index_internal_node_collect(void* node, uint32_t* children, IndexKey* keys) {
+  uint32_t num_keys = *index_internal_node_num_keys(node);
+  for (uint32_t i = 0; i < num_keys; i++) {
+    children[i] = *index_internal_node_child(node, i);
+    keys[i] = *index_internal_node_key(node, i);
+  }
+  children[num_keys] = *index_internal_node_right_child(node);
+  return num_keys;
+}
+
+// primeira célula da folha com chave >= key
+uint32_t index_leaf_node_find(void* node, const IndexKey* key) {
+  uint32_t min_index = 0;
+  uint32_t max_index = *index_leaf_node_num_cells(node);
+  while (min_index != max_index) {
+    uint32_t index = (min_index + max_index) / 2;
+    if (index_key_compare(index_leaf_node_key(node, index), key) < 0) {
+      min_index = index + 1;
+    } else {
+      max_index = index;
+    }
+  }
+  return min_index;
+}
+
+// primeiro filho cuja maior chave é >= key; se nenhum, o filho da direita
+uint32_t index_internal_node_find_child(void* node, const IndexKey* key) {
+  uint32_t min_index = 0;
+  uint32_t max_index = *index_internal_node_num_keys(node);
+  while (min_index != max_index) {
+    uint32_t index = (min_index + max_index) / 2;
+    if (index_key_compare(index_internal_node_key(node, index), key) < 0) {
+      min_index = index + 1;
+    } else {
+      max_index = index;
+    }
+  }
+  return min_index;
+}
+
+void index_set_root(Table* table, uint32_t page_num) {
+  table->index_root_page_num = page_num;
+  *db_header_index_root(get_page(table->pager, DB_HEADER_PAGE_NUM)) = page_num;
+  pager_mark_dirty(table->pager, DB_HEADER_PAGE_NUM);
+}
+
+// desce até a folha onde key está ou entraria, anotando o caminho
+uint32_t index_find_leaf(Table* table, const IndexKey* key, IndexPath* path) {
+  uint32_t page_num = table->index_root_page_num;
+  path->depth = 0;
+  while (true) {
+    void* node = get_page(table->pager, page_num);
+    path->page_nums[path->depth] = page_num;
+    if (*index_node_type(node) == INDEX_NODE_LEAF) {
+      return page_num;
+    }
+    uint32_t child_index = index_internal_node_find_child(node, key);
+    path->child_indexes[path->depth] = child_index;
+    path->depth++;
+    page_num = *index_internal_node_child(node, child_index);
+  }
+}
+
+/**
+ * O nó path->page_nums[level] foi dividido: ele ficou com as menores chaves, cuja maior é
+ * left_max_key, e right_page_num recebeu o resto. Insere o novo irmão no pai, dividindo
+ * o pai se preciso; se o nó dividido era a raíz, cria uma raíz nova acima dele.
+ */
+void index_insert_into_parent(Table* table, IndexPath* path, uint32_t level,
+                              IndexKey left_max_key, uint32_t right_page_num) {
+  Pager* pager = table->pager;
+  if (level == 0) {
+    uint32_t root_page_num = get_unused_page_num(pager);
+    void* root = get_page(pager, root_page_num);
+    initialize_index_internal_node(root);
+    uint32_t children[2] = {path->page_nums[0], right_page_num};
+    index_internal_node_fill(root, children, &left_max_key, 1);
+    pager_mark_dirty(pager, root_page_num);
+    index_set_root(table, root_page_num);
+    return;
+  }
+
+  uint32_t parent_page_num = path->page_nums[level - 1];
+  uint32_t index = path->child_indexes[level - 1];
+  void* parent = get_page(pager, parent_page_num);
+  pager_mark_dirty(pager, parent_page_num);
+
+  uint32_t children[INDEX_INTERNAL_NODE_MAX_CELLS + 2];
+  IndexKey keys[INDEX_INTERNAL_NODE_MAX_CELLS + 1];
+  uint32_t num_keys = index_internal_node_collect(parent, children, keys);
+
+  // o filho dividido fica com left_max_key; o novo irmão herda a chave antiga dele
+  memmove(keys + index + 1, keys + index, (num_keys - index) * INDEX_KEY_SIZE);
+  keys[index] = left_max_key;
+  memmove(children + index + 2, children + index + 1, (num_keys - index) * sizeof(uint32_t));
+  children[index + 1] = right_page_num;
+  num_keys++;
+
+  if (num_keys <= INDEX_INTERNAL_NODE_MAX_CELLS) {
+    index_internal_node_fill(parent, children, keys, num_keys);
+    return;
+  }
+
+  // keys[left_keys] é a maior chave da metade da esquerda e sobe para o avô
+  uint32_t left_keys = num_keys / 2;
+  uint32_t new_page_num = get_unused_page_num(pager);
+  void* new_node = get_page(pager, new_page_num);
+  initialize_index_internal_node(new_node);
+  index_internal_node_fill(parent, children, keys, left_keys);
+  index_internal_node_fill(new_node, children + left_keys + 1, keys + left_keys + 1,
+                           num_keys - left_keys - 1);
+  pager_mark_dirty(pager, new_page_num);
+  index_insert_into_parent(table, path, level - 1, keys[left_keys], new_page_num);
+}
+
+// insere a chave numa folha do índice que ainda tem espaço
+void index_leaf_node_insert(void* node, const IndexKey* key) {
+  uint32_t num_cells = *index_leaf_node_num_cells(node);
+  uint32_t cell_num = index_leaf_node_find(node, key);
+  memmove(index_leaf_node_key(node, cell_num + 1), index_leaf_node_key(node, cell_num),
+          (num_cells - cell_num) * INDEX_KEY_SIZE);
+  *index_leaf_node_key(node, cell_num) = *key;
+  *index_leaf_node_num_cells(node) = num_cells + 1;
+}
+
+void index_leaf_node_remove(void* node, uint32_t cell_num) {
+  uint32_t num_cells = *index_leaf_node_num_cells(node);
+  memmove(index_leaf_node_key(node, cell_num), index_leaf_node_key(node, cell_num + 1),
+          (num_cells - cell_num - 1) * INDEX_KEY_SIZE);
+  memset(index_leaf_node_key(node, num_cells - 1), 0, INDEX_KEY_SIZE);
+  *index_leaf_node_num_cells(node) = num_cells - 1;
+}
+
+// posição da chave na folha do índice, ou o número de células se ela não estiver lá
+uint32_t index_leaf_node_find_exact(void* node, const IndexKey* key) {
+  uint32_t num_cells = *index_leaf_node_num_cells(node);
+  uint32_t cell_num = index_leaf_node_find(node, key);
+  if (cell_num < num_cells && index_key_compare(index_leaf_node_key(node, cell_num), key) != 0) {
+    return num_cells;
+  }
+  return cell_num;
+}
+
+void index_insert(Table* table, const char* username, uint32_t id) {
+  Pager* pager = table->pager;
+  IndexKey key;
+  index_key_make(&key, username, id);
+  IndexPath path;
+  uint32_t page_num = index_find_leaf(table, &key, &path);
+  void* node = get_page(pager, page_num);
+  pager_mark_dirty(pager, page_num);
+
+  uint32_t num_cells = *index_leaf_node_num_cells(node);
+  uint32_t cell_num = index_leaf_node_find(node, &key);
+  if (num_cells < INDEX_LEAF_NODE_MAX_CELLS) {
+    index_leaf_node_insert(node, &key);
+    return;
+  }
+
+  // folha cheia: metade das chaves vai para uma folha nova à direita
+  IndexKey keys[INDEX_LEAF_NODE_MAX_CELLS + 1];
+  memcpy(keys, index_leaf_node_key(node, 0), cell_num * INDEX_KEY_SIZE);
+  keys[cell_num] = key;
+  memcpy(keys + cell_num + 1, index_leaf_node_key(node, cell_num), (num_cells - cell_num) * INDEX_KEY_SIZE);
+  num_cells++;
+
+  uint32_t split = num_cells / 2;
+  uint32_t new_page_num = get_unused_page_num(pager);
+  void* new_node = get_page(pager, new_page_num);
+  initialize_index_leaf_node(new_node);
+  index_leaf_node_fill(node, keys, split);
+  index_leaf_node_fill(new_node, keys + split, num_cells - split);
+  *index_leaf_node_next_leaf(new_node) = *index_leaf_node_next_leaf(node);
+  *index_leaf_node_next_leaf(node) = new_page_num;
+  pager_mark_dirty(pager, new_page_num);
+  index_insert_into_parent(table, &path, path.depth, keys[split - 1], new_page_num);
+}
+
+/**
+ * O nó path->page_nums[level] ficou abaixo do mínimo: é unido ao irmão quando os dois
+ * cabem em uma página, senão as chaves dos dois são redistribuídas. A união tira uma
+ * chave do pai, que pode ficar abaixo do mínimo também; a raíz só diminui a altura
+ * da árvore quando fica com um único filho.
+ */
+void index_rebalance(Table* table, IndexPath* path, uint32_t level) {
+  Pager* pager = table->pager;
+  uint32_t parent_page_num = path->page_nums[level - 1];
+  uint32_t index = path->child_indexes[level - 1];
+  void* parent = get_page(pager, parent_page_num);
+
+  uint32_t left_index = index > 0 ? index - 1 : index;
+  uint32_t left_page_num = *index_internal_node_child(parent, left_index);
+  uint32_t right_page_num = *index_internal_node_child(parent, left_index + 1);
+  void* left = get_page(pager, left_page_num);
+  void* right = get_page(pager, right_page_num);
+  pager_mark_dirty(pager, parent_page_num);
+  pager_mark_dirty(pager, left_page_num);
+  pager_mark_dirty(pager, right_page_num);
+
+  bool merged;
+  if (*index_node_type(left) == INDEX_NODE_LEAF) {
+    IndexKey keys[2 * INDEX_LEAF_NODE_MAX_CELLS];
+    uint32_t left_cells = *index_leaf_node_num_cells(left);
+    uint32_t right_cells = *index_leaf_node_num_cells(right);
+    memcpy(keys, index_leaf_node_key(left, 0), left_cells * INDEX_KEY_SIZE);
+    memcpy(keys + left_cells, index_leaf_node_key(right, 0), right_cells * INDEX_KEY_SIZE);
+    uint32_t num_cells = left_cells + right_cells;
+
+    merged = num_cells <= INDEX_LEAF_NODE_MAX_CELLS;
+    if (merged) {
+      index_leaf_node_fill(left, keys, num_cells);
+      *index_leaf_node_next_leaf(left) = *index_leaf_node_next_leaf(right);
+    } else {
+      uint32_t split = num_cells / 2;
+      index_leaf_node_fill(left, keys, split);
+      index_leaf_node_fill(right, keys + split, num_cells - split);
+      *index_internal_node_key(parent, left_index) = keys[split - 1];
+    }
+  } else {
+    // a chave do pai entre os dois irmãos desce para o meio da sequência
+    uint32_t children[2 * INDEX_INTERNAL_NODE_MAX_CELLS + 2];
+    IndexKey keys[2 * INDEX_INTERNAL_NODE_MAX_CELLS + 1];
+    uint32_t left_keys = index_internal_node_collect(left, children, keys);
+    keys[left_keys] = *index_internal_node_key(parent, left_index);
+    uint32_t right_keys = index_internal_node_collect(right, children + left_keys + 1, keys + left_keys + 1);
+    uint32_t num_keys = left_keys + 1 + right_keys;
+
+    merged = num_keys <= INDEX_INTERNAL_NODE_MAX_CELLS;
+    if (merged) {
+      index_internal_node_fill(left, children, keys, num_keys);
+    } else {
+      uint32_t split = num_keys / 2;
+      index_internal_node_fill(left, children, keys, split);
+      index_internal_node_fill(right, children + split + 1, keys + split + 1, num_keys - split - 1);
+      *index_internal_node_key(parent, left_index) = keys[split];
+    }
+  }
+  if (!merged) {
+    return;
+  }
+
+  // o irmão da direita saiu da árvore: a esquerda fica com a chave (ou a posição) dele
+  free_page(pager, right_page_num);
+  uint32_t children[INDEX_INTERNAL_NODE_MAX_CELLS + 1];
+  IndexKey keys[INDEX_INTERNAL_NODE_MAX_CELLS];
+  uint32_t num_keys = index_internal_node_collect(parent, children, keys);
+  memmove(keys + left_index, keys + left_index + 1, (num_keys - left_index - 1) * INDEX_KEY_SIZE);
+  memmove(children + left_index + 1, children + left_index + 2, (num_keys - left_index - 1) * sizeof(uint32_t));
+  num_keys--;
+  index_internal_node_fill(parent, children, keys, num_keys);
+
+  if (level - 1 == 0) {
+    if (num_keys == 0) {
+      index_set_root(table, left_page_num);
+      free_page(pager, parent_page_num);
+    }
+  } else if (num_keys < INDEX_INTERNAL_NODE_MIN_KEYS) {
+    index_rebalance(table, path, level - 1);
+  }
+}
+
+void index_delete(Table* table, const char* username, uint32_t id) {
+  IndexKey key;
+  index_key_make(&key, username, id);
+  IndexPath path;
+  uint32_t page_num = index_find_leaf(table, &key, &path);
+  void* node = get_page(table->pager, page_num);
+
+  uint32_t num_cells = *index_leaf_node_num_cells(node);
+  uint32_t cell_num = index_leaf_node_find_exact(node, &key);
+  if (cell_num == num_cells) {
+    return;
+  }
+  index_leaf_node_remove(node, cell_num);
+  pager_mark_dirty(table->pager, page_num);
+
+  if (path.depth > 0 && num_cells - 1 < INDEX_LEAF_NODE_MIN_CELLS) {
+    index_rebalance(table, &path, path.depth);
+  }
+}
+
+/**
+ * Construção de baixo para cima, usada pela carga em lote e pela criação do índice.
+ * Os nós de um nível recebem as entradas do nível de baixo divididas por igual, sem
+ * nenhum abaixo do mínimo da árvore; as páginas são alocadas em sequência no fim do arquivo.
+ */
+// nós para count entradas, per_node em cada; menos nós se a divisão deixar algum com menos de min_per_node
+uint32_t bulk_node_count(uint32_t count, uint32_t per_node, uint32_t min_per_node) {
+  uint32_t num_nodes = count == 0 ? 1 : (count + per_node - 1) / per_node;
+  while (num_nodes > 1 && count / num_nodes < min_per_node) {
+    num_nodes--;
+  }
+  return num_nodes;
+}
+
+// quantas entradas vão para o nó j: os primeiros count % num_nodes recebem uma a mais
+uint32_t bulk_node_size(uint32_t j, uint32_t count, uint32_t num_nodes) {
+  return count / num_nodes + (j < count % num_nodes ? 1 : 0);
+}
+
+// em qual nó cai a entrada i, na mesma divisão do bulk_node_size
+uint32_t bulk_node_of(uint32_t i, uint32_t count, uint32_t num_nodes) {
+  uint32_t size = count / num_nodes;
+  uint32_t bigger = count % num_nodes;
+  if (i < bigger * (size + 1)) {
+    return i / (size + 1);
+  }
+  return bigger + (i - bigger * (size + 1)) / size;
+}
+
+// entradas por nó interno com o preenchimento pedido, com pelo menos dois filhos
+uint32_t bulk_children_per_node(uint32_t max_cells, uint32_t fill_factor) {
+  uint32_t children = (max_cells + 1) * fill_factor / 100;
+  return children < 2 ? 2 : children;
+}
+
+/**
+ * As páginas vão para o WAL em lotes enquanto a árvore é montada, para que as páginas
+ * alteradas não acumulem no buffer pool. Nada aponta para elas até o commit final,
+ * então uma interrupção no meio deixa a árvore antiga intacta.
+ */
+void bulk_load_flush(Pager* pager) {
+  pager_release(pager);
+  if (pager->num_dirty >= BULK_LOAD_COMMIT_PAGES) {
+    pager_commit(pager);
+  }
+}
+
+int index_key_qsort_compare(const void* a, const void* b) {
+  return index_key_compare(a, b);
+}
+
+// monta um índice novo com as chaves já ordenadas e devolve a página da raíz
+uint32_t index_bulk_load(Pager* pager, IndexKey* keys, uint32_t num_keys, uint32_t fill_factor) {
+  uint32_t per_leaf = INDEX_LEAF_NODE_MAX_CELLS * fill_factor / 100;
+  uint32_t num_leaves = bulk_node_count(num_keys, per_leaf < 1 ? 1 : per_leaf, INDEX_LEAF_NODE_MIN_CELLS);
+  uint32_t first_page = pager->num_pages;
+
+  IndexKey* max_keys = malloc(num_leaves * INDEX_KEY_SIZE);
+  uint32_t start = 0;
+  for (uint32_t j = 0; j < num_leaves; j++) {
+    uint32_t count = bulk_node_size(j, num_keys, num_leaves);
+    void* node = get_page(pager, first_page + j);
+    initialize_index_leaf_node(node);
+    index_leaf_node_fill(node, keys + start, count);
+    *index_leaf_node_next_leaf(node) = j + 1 < num_leaves ? first_page + j + 1 : 0;
+    pager_mark_dirty(pager, first_page + j);
+    if (count > 0) {
+      max_keys[j] = keys[start + count - 1];
+    }
+    start += count;
+    bulk_load_flush(pager);
+  }
+
+  uint32_t per_node = bulk_children_per_node(INDEX_INTERNAL_NODE_MAX_CELLS, fill_factor);
+  uint32_t level_first = first_page;
+  uint32_t level_count = num_leaves;
+  uint32_t children[INDEX_INTERNAL_NODE_MAX_CELLS + 1];
+  while (level_count > 1) {
+    uint32_t num_nodes = bulk_node_count(level_count, per_node, INDEX_INTERNAL_NODE_MIN_KEYS + 1);
+    uint32_t node_first = level_first + level_count;
+    start = 0;
+    for (uint32_t j = 0; j < num_nodes; j++) {
+      uint32_t count = bulk_node_size(j, level_count, num_nodes);
+      for (uint32_t i = 0; i < count; i++) {
+        children[i] = level_first + start + i;
+      }
+      void* node = get_page(pager, node_first + j);
+      initialize_index_internal_node(node);
+      index_internal_node_fill(node, children, max_keys + start, count - 1);
+      pager_mark_dirty(pager, node_first + j);
+      max_keys[j] = max_keys[start + count - 1];
+      start += count;
+      bulk_load_flush(pager);
+    }
+    level_first = node_first;
+    level_count = num_nodes;
+  }
+
+  free(max_keys);
+  return level_first;
+}
+
+// chaves do índice de uma faixa da varredura, ordenadas no fim pelo próprio thread
+typedef struct {
+  IndexKey* keys;
+  uint32_t num_keys;
+  uint32_t capacity;
+} IndexBuildPart;
+
+void index_build_leaf(void* context, void* node, uint32_t begin, uint32_t end) {
+  IndexBuildPart* part = context;
+  if (part->num_keys + (end - begin) > part->capacity) {
+    part->capacity = part->capacity ? part->capacity * 2 : 1024;
+    if (part->capacity < part->num_keys + (end - begin)) {
+      part->capacity = part->num_keys + (end - begin);
+    }
+    part->keys = realloc(part->keys, (size_t)part->capacity * INDEX_KEY_SIZE);
+  }
+  for (uint32_t i = begin; i < end; i++) {
+    index_key_from_record(&part->keys[part->num_keys++], leaf_node_value(node, i));
+  }
+}
+
+void index_build_sort(void* context) {
+  IndexBuildPart* part = context;
+  qsort(part->keys, part->num_keys, INDEX_KEY_SIZE, index_key_qsort_compare);
+}
+
+// junta as faixas já ordenadas; são poucas, então a menor cabeça é procurada em todas
+IndexKey* index_build_merge(IndexBuildPart* parts, uint32_t num_parts, uint32_t* num_keys) {
+  *num_keys = 0;
+  for (uint32_t i = 0; i < num_parts; i++) {
+    *num_keys += parts[i].num_keys;
+  }
+  if (num_parts == 1) {
+    return parts[0].keys;
+  }
+  IndexKey* keys = malloc((size_t)(*num_keys ? *num_keys : 1) * INDEX_KEY_SIZE);
+  uint32_t positions[SCAN_MAX_THREADS] = {0};
+  for (uint32_t k = 0; k < *num_keys; k++) {
+    uint32_t smallest = UINT32_MAX;
+    for (uint32_t i = 0; i < num_parts; i++) {
+      if (positions[i] < parts[i].num_keys &&
+          (smallest == UINT32_MAX ||
+           index_key_compare(&parts[i].keys[positions[i]], &parts[smallest].keys[positions[smallest]]) < 0)) {
+        smallest = i;
+      }
+    }
+    keys[k] = parts[smallest].keys[positions[smallest]++];
+  }
+  for (uint32_t i = 0; i < num_parts; i++) {
+    free(parts[i].keys);
+  }
+  return keys;
+}
+
+// cria o índice a partir das linhas da tabela (vazio em um banco novo) com uma varredura
+// paralela: cada thread junta e ordena as chaves da sua faixa, e as faixas são intercaladas.
+// A raíz só vai para o cabeçalho no último commit, então uma interrupção não deixa um índice pela metade
+void index_build(Table* table) {
+  IndexBuildPart parts[SCAN_MAX_THREADS] = {0};
+  uint32_t num_parts = table_scan_parallel(table, index_build_leaf, index_build_sort, parts, sizeof(IndexBuildPart));
+  uint32_t num_keys;
+  IndexKey* keys = index_build_merge(parts, num_parts, &num_keys);
+
+  index_set_root(table, index_bulk_load(table->pager, keys, num_keys, BULK_LOAD_DEFAULT_FILL));
+  free(keys);
+  pager_commit(table->pager);
+}
+
+void print_index(Table* table) {
+  uint32_t page_num = table->index_root_page_num;
+  void* node = get_page(table->pager, page_num);
+  while (*index_node_type(node) == INDEX_NODE_INTERNAL) {
+    page_num = *index_internal_node_child(node, 0);
+    node = get_page(table->pager, page_num);
+  }
+
+  printf("Index contents:\n");
+  while (true) {
+    for (uint32_t i = 0; i < *index_leaf_node_num_cells(node); i++) {
+      IndexKey* key = index_leaf_node_key(node, i);
+      printf("%d: %.*s\n", key->id, COLUMN_USERNAME_SIZE, key->username);
+    }
+    page_num = *index_leaf_node_next_leaf(node);
+    if (page_num == 0) {
+      break;
+    }
+    pager_release(table->pager);
+    node = get_page(table->pager, page_num);
+  }
+}
+
+/**
+ * Filtros de Bloom
+ * Um filtro sobre os ids da tabela e outro sobre os usernames do índice. Ficam em
+ * memória e vão para as páginas no fechamento do banco, junto com a marca de que
+ * estão em dia; o primeiro comando que altera a tabela apaga a marca, então depois
+ * de uma interrupção os filtros são reconstruídos com uma varredura.
+ */
+uint64_t bloom_hash_id(uint32_t id) {
+  uint64_t hash = id;
+  hash ^= hash >> 33;
+  hash *= 0xff51afd7ed558ccdULL;
+  hash ^= hash >> 33;
+  hash *= 0xc4ceb9fe1a85ec53ULL;
+  hash ^= hash >> 33;
+  return hash;
+}
+
+uint64_t bloom_hash_username(const char* username) {
+  uint64_t hash = 14695981039346656037ULL;
+  for (uint32_t i = 0; i < COLUMN_USERNAME_SIZE && username[i] != '\0'; i++) {
+    hash ^= (uint8_t)username[i];
+    hash *= 1099511628211ULL; // FNV-1a de 64 bits
+  }
+  return hash;
+}
+
+void bloom_filter_init(BloomFilter* filter, uint32_t expected_items) {
+  if (expected_items < BLOOM_MIN_ITEMS) {
+    expected_items = BLOOM_MIN_ITEMS;
+  }
+  free(filter->bits);
+  filter->num_bits = (expected_items * BLOOM_BITS_PER_ITEM + 63) / 64 * 64; // bytes inteiros
+  filter->bits = calloc(filter->num_bits / 8, 1);
+  filter->num_items = 0;
+}
+
+// as posições vêm de duas metades do hash (double hashing)
+// atômico: os inserts que só travam as folhas adicionam ao mesmo tempo
+void bloom_filter_add(BloomFilter* filter, uint64_t hash) {
+  uint32_t h1 = hash;
+  uint32_t h2 = (hash >> 32) | 1;
+  for (uint32_t i = 0; i < BLOOM_NUM_HASHES; i++) {
+    uint32_t bit = (h1 + i * h2) % filter->num_bits;
+    __atomic_fetch_or(&filter->bits[bit / 8], 1 << (bit % 8), __ATOMIC_RELAXED);
+  }
+  __atomic_fetch_add(&filter->num_items, 1, __ATOMIC_RELAXED);
+}
+
+// os contadores são atômicos porque vários selects consultam o filtro ao mesmo tempo
+bool bloom_filter_may_contain(BloomFilter* filter, uint64_t hash) {
+  __atomic_fetch_add(&filter->lookups, 1, __ATOMIC_RELAXED);
+  uint32_t h1 = hash;
+  uint32_t h2 = (hash >> 32) | 1;
+  for (uint32_t i = 0; i < BLOOM_NUM_HASHES; i++) {
+    uint32_t bit = (h1 + i * h2) % filter->num_bits;
+    if (!(__atomic_load_n(&filter->bits[bit / 8], __ATOMIC_RELAXED) & (1 << (bit % 8)))) {
+      __atomic_fetch_add(&filter->negatives, 1, __ATOMIC_RELAXED);
+      return false;
+    }
+  }
+  return true;
+}
+
+bool bloom_filter_full(BloomFilter* filter) {
+  return filter->num_items > filter->num_bits / BLOOM_BITS_PER_ITEM;
+}
+
+// cabe mais um item sem passar da capacidade, ou seja, sem reconstruir o filtro
+bool bloom_filter_has_room(BloomFilter* filter) {
+  return __atomic_load_n(&filter->num_items, __ATOMIC_RELAXED) < filter->num_bits / BLOOM_BITS_PER_ITEM;
+}
+
+// primeira passada do bloom_filters_rebuild: só conta as linhas de cada faixa
+void bloom_count_leaf(void* context, void* node, uint32_t begin, uint32_t end) {
+  (void)node;
+  *(uint32_t*)context += end - begin;
+}
+
+// os bits são ligados com operações atômicas, então as faixas usam os filtros da tabela
+void bloom_add_leaf(void* context, void* node, uint32_t begin, uint32_t end) {
+  Table* table = *(Table**)context;
+  IndexKey key;
+  for (uint32_t i = begin; i < end; i++) {
+    index_key_from_record(&key, leaf_node_value(node, i));
+    bloom_filter_add(&table->id_filter, bloom_hash_id(key.id));
+    bloom_filter_add(&table->username_filter, bloom_hash_username(key.username));
+  }
+}
+
+// Refaz os dois filtros com uma varredura, com folga para o dobro das linhas atuais
+void bloom_filters_rebuild(Table* table) {
+  table->transaction_bloom_rebuilt = table->in_transaction;
+  uint32_t counts[SCAN_MAX_THREADS] = {0};
+  uint32_t num_parts = table_scan_parallel(table, bloom_count_leaf, NULL, counts, sizeof(uint32_t));
+  uint32_t num_rows = 0;
+  for (uint32_t i = 0; i < num_parts; i++) {
+    num_rows += counts[i];
+  }
+
+  bloom_filter_init(&table->id_filter, 2 * num_rows);
+  bloom_filter_init(&table->username_filter, 2 * num_rows);
+  Table* tables[SCAN_MAX_THREADS];
+  for (uint32_t i = 0; i < SCAN_MAX_THREADS; i++) {
+    tables[i] = table;
+  }
+  table_scan_parallel(table, bloom_add_leaf, NULL, tables, sizeof(Table*));
+}
+
+// O que vai para as páginas: o tamanho e a contagem de cada filtro, depois os bits
+uint32_t bloom_filters_serialized_size(Table* table) {
+  return 4 * sizeof(uint32_t) + table->id_filter.num_bits / 8 + table->username_filter.num_bits / 8;
+}
+
+/**
+ * Copia length bytes entre o buffer e a lista de páginas dos filtros. Na gravação
+ * a lista é reaproveitada, cresce com páginas novas e as páginas que sobram voltam
+ * para a lista de livres.
+ */
+bool bloom_pages_copy(Pager* pager, uint8_t* buffer, uint32_t length, bool write) {
+  const uint32_t payload = PAGE_SIZE - BLOOM_PAGE_HEADER_SIZE;
+  void* header = get_page(pager, DB_HEADER_PAGE_NUM);
+  uint32_t* link = db_header_bloom_page(header); // onde está o número da próxima página
+  uint32_t link_page_num = DB_HEADER_PAGE_NUM;
+  uint32_t offset = 0;
+
+  while (offset < length) {
+    uint32_t page_num = *link;
+    if (page_num == 0) {
+      if (!write) {
+        return false; // lista mais curta que o esperado
+      }
+      page_num = get_unused_page_num(pager);
+      void* page = get_page(pager, page_num);
+      memset(page, 0, PAGE_SIZE);
+      *link = page_num;
+      pager_mark_dirty(pager, link_page_num);
+    }
+    void* page = get_page(pager, page_num);
+    uint32_t chunk = length - offset < payload ? length - offset : payload;
+    if (write) {
+      *(uint8_t*)(page + NODE_TYPE_OFFSET) = INDEX_NODE_BLOOM;
+      memcpy(page + BLOOM_PAGE_HEADER_SIZE, buffer + offset, chunk);
+      pager_mark_dirty(pager, page_num);
+    } else {
+      memcpy(buffer + offset, page + BLOOM_PAGE_HEADER_SIZE, chunk);
+    }
+    offset += chunk;
+    link = page + BLOOM_PAGE_NEXT_OFFSET;
+    link_page_num = page_num;
+  }
+
+  if (write) {
+    uint32_t page_num = *link;
+    if (page_num != 0) {
+      *link = 0;
+      pager_mark_dirty(pager, link_page_num);
+    }
+    while (page_num != 0) {
+      uint32_t next = *(uint32_t*)(get_page(pager, page_num) + BLOOM_PAGE_NEXT_OFFSET);
+      free_page(pager, page_num);
+      page_num = next;
+    }
+  }
+  return true;
+}
+
+// Grava os filtros nas páginas e marca que estão em dia; vai no commit do fechamento
+void bloom_filters_save(Table* table) {
+  if (*db_header_bloom_clean(get_page(table->pager, DB_HEADER_PAGE_NUM))) {
+    return; // nada mudou desde que foram carregados
+  }
+  uint32_t length = bloom_filters_serialized_size(table);
+  uint8_t* buffer = malloc(length);
+  uint32_t* meta = (uint32_t*)buffer;
+  meta[0] = table->id_filter.num_bits;
+  meta[1] = table->id_filter.num_items;
+  meta[2] = table->username_filter.num_bits;
+  meta[3] = table->username_filter.num_items;
+  uint8_t* bits = buffer + 4 * sizeof(uint32_t);
+  memcpy(bits, table->id_filter.bits, table->id_filter.num_bits / 8);
+  memcpy(bits + table->id_filter.num_bits / 8, table->username_filter.bits, table->username_filter.num_bits / 8);
+
+  bloom_pages_copy(table->pager, buffer, length, true);
+  free(buffer);
+
+  *db_header_bloom_clean(get_page(table->pager, DB_HEADER_PAGE_NUM)) = 1;
+  pager_mark_dirty(table->pager, DB_HEADER_PAGE_NUM);
+}
+
+// Carrega os filtros gravados no fechamento; devolve false se precisam ser reconstruídos
+bool bloom_filters_load(Table* table) {
+  void* header = get_page(table->pager, DB_HEADER_PAGE_NUM);
+  if (!*db_header_bloom_clean(header) || *db_header_bloom_page(header) == 0) {
+    return false;
+  }
+
+  uint32_t meta[4];
+  if (!bloom_pages_copy(table->pager, (uint8_t*)meta, sizeof(meta), false)) {
+    return false;
+  }
+  if (meta[0] == 0 || meta[0] % 8 != 0 || meta[2] == 0 || meta[2] % 8 != 0) {
+    return false;
+  }
+  uint32_t length = sizeof(meta) + meta[0] / 8 + meta[2] / 8;
+  uint8_t* buffer = malloc(length);
+  if (!bloom_pages_copy(table->pager, buffer, length, false)) {
+    free(buffer);
+    return false;
+  }
+
+  free(table->id_filter.bits);
+  free(table->username_filter.bits);
+  table->id_filter.num_bits = meta[0];
+  table->id_filter.num_items = meta[1];
+  table->id_filter.bits = malloc(meta[0] / 8);
+  memcpy(table->id_filter.bits, buffer + sizeof(meta), meta[0] / 8);
+  table->username_filter.num_bits = meta[2];
+  table->username_filter.num_items = meta[3];
+  table->username_filter.bits = malloc(meta[2] / 8);
+  memcpy(table->username_filter.bits, buffer + sizeof(meta) + meta[0] / 8, meta[2] / 8);
+  free(buffer);
+  return true;
+}
+
+// Abre os filtros: usa os gravados se estiverem em dia, senão reconstrói
+void bloom_filters_open(Table* table) {
+  if (!bloom_filters_load(table)) {
+    bloom_filters_rebuild(table);
+  }
+}
+
+/**
+ * Chamada antes de um comando que altera a tabela: a partir dele as páginas dos
+ * filtros ficam para trás, então a marca sai no mesmo commit da alteração.
+ * Sessões só de leitura não gravam nada e mantêm os filtros gravados válidos.
+ */
+void bloom_filters_touch(Table* table) {
+  void* header = get_page(table->pager, DB_HEADER_PAGE_NUM);
+  if (*db_header_bloom_clean(header)) {
+    *db_header_bloom_clean(header) = 0;
+    pager_mark_dirty(table->pager, DB_HEADER_PAGE_NUM);
+  }
+}
+
+void print_bloom_filter_stats(const char* name, BloomFilter* filter) {
+  printf("%s: %d bits, %d itens\n", name, filter->num_bits, filter->num_items);
+  printf("%s consultas: %" PRIu64 "\n", name, filter->lookups);
+  printf("%s descartadas: %" PRIu64 "\n", name, filter->negatives);
+  printf("%s falsos positivos: %" PRIu64 "\n", name, filter->false_positives);
+}
+
+void print_bloom_stats(Table* table) {
+  printf("Filtros de Bloom:\n");
+  print_bloom_filter_stats("id", &table->id_filter);
+  print_bloom_filter_stats("username", &table->username_filter);
+}
+
+// posição de um filho dentro do nó interno; o filho da direita fica na posição num_keys
+uint32_t internal_node_child_index(void* node, uint32_t child_page_num) {
+  uint32_t index = 0;
+  while (*internal_node_child(node, index) != child_page_num) {
+    index++;
+  }
+  return index;
+}
+
+/**
+ * Remove um filho de um nó interno.
+ * Se o nó fica com menos de INTERNAL_NODE_MIN_KEYS chaves ele é rebalanceado com
+ * um irmão; a raíz só é eliminada quando fica com um único filho, que sobe para a
+ * página da raíz.
+ */
+void internal_node_remove_child(Table* table, uint32_t page_num, uint32_t child_page_num) {
+  Pager* pager = table->pager;
+  void* node = get_page(pager, page_num);
+  uint32_t num_keys = *internal_node_num_keys(node);
+
+  if (*internal_node_right_child(node) == child_page_num) {
+    // o último filho da esquerda vira o filho da direita
+    *internal_node_right_child(node) = *internal_node_child(node, num_keys - 1);
+    *internal_node_right_count(node) = *internal_node_count(node, num_keys - 1);
+  } else {
+    uint32_t index = internal_node_child_index(node, child_page_num);
+    internal_node_move_cells(node, index, node, index + 1, num_keys - index - 1);
+  }
+  *internal_node_num_keys(node) = num_keys - 1;
+  pager_mark_dirty(pager, page_num);
+
+  if (!is_node_root(node)) {
+    if (num_keys - 1 < INTERNAL_NODE_MIN_KEYS) {
+      uint32_t parent_page_num = *node_parent(node);
+      void* parent = get_page(pager, parent_page_num);
+      internal_node_rebalance(table, parent_page_num, internal_node_child_index(parent, page_num));
+    }
+    return;
+  }
+  if (num_keys - 1 > 0) {
+    return;
+  }
+
+  // a raíz ficou com um único filho: o filho sobe para a página da raíz
+  uint32_t only_child_page_num = *internal_node_right_child(node);
+  void* only_child = get_page(pager, only_child_page_num);
+  memcpy(node, only_child, PAGE_SIZE);
+  set_node_root(node, true);
+  if (get_node_type(node) == NODE_INTERNAL) {
+    for (uint32_t i = 0; i <= *internal_node_num_keys(node); i++) {
+      uint32_t grandchild_page_num = *internal_node_child(node, i);
+      *node_parent(get_page(pager, grandchild_page_num)) = page_num;
+      pager_mark_dirty(pager, grandchild_page_num);
+    }
+  }
+  free_page(pager, only_child_page_num);
+}
+
+/**
+ * Mesma ideia do leaf_node_rebalance para um nó interno com menos de
+ * INTERNAL_NODE_MIN_KEYS chaves: a célula emprestada passa pela chave separadora
+ * do pai, e na união a separadora desce para o nó da esquerda.
+ */
+void internal_node_rebalance(Table* table, uint32_t parent_page_num, uint32_t index) {
+  Pager* pager = table->pager;
+  void* parent = get_page(pager, parent_page_num);
+  uint32_t node_page_num = *internal_node_child(parent, index);
+  void* node = get_page(pager, node_page_num);
+  uint32_t num_keys = *internal_node_num_keys(node);
+
+  uint32_t left_index = index > 0 ? index - 1 : index;
+  uint32_t left_page_num = *internal_node_child(parent, left_index);
+  uint32_t right_page_num = *internal_node_child(parent, left_index + 1);
+  void* left = get_page(pager, left_page_num);
+  void* right = get_page(pager, right_page_num);
+  uint32_t left_keys = *internal_node_num_keys(left);
+  uint32_t right_keys = *internal_node_num_keys(right);
+  uint32_t separator = *internal_node_key(parent, left_index);
+  uint32_t moved_page_num;
+
+  if (index > 0 && left_keys > INTERNAL_NODE_MIN_KEYS) {
+    // o filho da direita da irmã da esquerda vira o primeiro filho do nó
+    moved_page_num = *internal_node_right_child(left);
+    internal_node_move_cells(node, 1, node, 0, num_keys);
+    *internal_node_num_keys(node) = num_keys + 1;
+    *internal_node_child(node, 0) = moved_page_num;
+    *internal_node_key(node, 0) = separator;
+    *internal_node_count(node, 0) = *internal_node_right_count(left);
+    *internal_node_right_child(left) = *internal_node_child(left, left_keys - 1);
+    *internal_node_right_count(left) = *internal_node_count(left, left_keys - 1);
+    *internal_node_key(parent, left_index) = *internal_node_key(left, left_keys - 1);
+    *internal_node_num_keys(left) = left_keys - 1;
+  } else if (index == 0 && right_keys > INTERNAL_NODE_MIN_KEYS) {
+    // o primeiro filho da irmã da direita vira o filho da direita do nó
+    moved_page_num = *internal_node_child(right, 0);
+    *internal_node_num_keys(node) = num_keys + 1;
+    *internal_node_child(node, num_keys) = *internal_node_right_child(node);
+    *internal_node_key(node, num_keys) = separator;
+    *internal_node_count(node, num_keys) = *internal_node_right_count(node);
+    *internal_node_right_child(node) = moved_page_num;
+    *internal_node_right_count(node) = *internal_node_count(right, 0);
+    *internal_node_key(parent, index) = *internal_node_key(right, 0);
+    internal_node_move_cells(right, 0, right, 1, right_keys - 1);
+    *internal_node_num_keys(right) = right_keys - 1;
+  } else {
+    // une o nó da direita no da esquerda, com a separadora entre os dois
+    *internal_node_num_keys(left) = left_keys + 1 + right_keys;
+    *internal_node_child(left, left_keys) = *internal_node_right_child(left);
+    *internal_node_key(left, left_keys) = separator;
+    *internal_node_count(left, left_keys) = *internal_node_right_count(left);
+    internal_node_move_cells(left, left_keys + 1, right, 0, right_keys);
+    *internal_node_right_child(left) = *internal_node_right_child(right);
+    *internal_node_right_count(left) = *internal_node_right_count(right);
+    for (uint32_t i = left_keys + 1; i <= left_keys + 1 + right_keys; i++) {
+      uint32_t child_page_num = *internal_node_child(left, i);
+      *node_parent(get_page(pager, child_page_num)) = left_page_num;
+      pager_mark_dirty(pager, child_page_num);
+    }
+    if (left_index + 1 < *internal_node_num_keys(parent)) {
+      *internal_node_key(parent, left_index) = *internal_node_key(parent, left_index + 1);
+    }
+    *internal_node_count(parent, left_index) = node_row_count(left);
+    pager_mark_dirty(pager, left_page_num);
+    pager_mark_dirty(pager, parent_page_num);
+    internal_node_remove_child(table, parent_page_num, right_page_num);
+    free_page(pager, right_page_num);
+    return;
+  }
+
+  *internal_node_count(parent, left_index) = node_row_count(left);
+  *internal_node_count(parent, left_index + 1) = node_row_count(right);
+  *node_parent(get_page(pager, moved_page_num)) = node_page_num;
+  pager_mark_dirty(pager, moved_page_num);
+  pager_mark_dirty(pager, left_page_num);
+  pager_mark_dirty(pager, right_page_num);
+  pager_mark_dirty(pager, parent_page_num);
+}
+
+void leaf_node_delete(Cursor* cursor, uint32_t key) {
+    Table* table = cursor->table;
+    void* node = get_page(table->pager, cursor->page_num);
+
+    uint32_t num_cells = *leaf_node_num_cells(node);
+    if (num_cells == 0) {
+        return; // No cells to delete
+    }
+
+    // Find the cell containing the key to delete
+    uint32_t i;
+    for (i = 0; i < num_cells; i++) {
+        if (*leaf_node_key(node, i) == key) {
+            break;
+        }
+    }
+
+    if (i == num_cells) {
+        return; // Key not found
+    }
+
+    // Remove the cell by shifting cells over
+    leaf_node_remove_value(node, i);
+    pager_mark_dirty(table->pager, cursor->page_num);
+    table_counts_add(table, cursor->page_num, key, -1);
+
+    if (is_node_root(node)) {
+        return; // a raíz pode ficar vazia
+    }
+
+    uint32_t parent_page_num = *node_parent(node);
+    void* parent = get_page(table->pager, parent_page_num);
+    uint32_t index = internal_node_child_index(parent, cursor->page_num);
+    uint32_t parent_num_keys = *internal_node_num_keys(parent);
+
+    if (leaf_node_used_space(node) >= LEAF_NODE_MIN_USED) {
+        // a chave separadora acompanha a maior chave da folha
+        if (index < parent_num_keys && i == num_cells - 1) {
+            *internal_node_key(parent, index) = get_node_max_key(table->pager, node);
+            pager_mark_dirty(table->pager, parent_page_num);
+        }
+        return;
+    }
+
+    leaf_node_rebalance(table, parent_page_num, index);
+}
+
+/**
+ * Uma folha com menos de LEAF_NODE_MIN_USED bytes ocupados é unida a uma irmã
+ * (de preferência a da esquerda) se as linhas das duas couberem em uma página;
+ * a página da direita volta para a lista de livres. Senão as linhas das duas
+ * são redistribuídas pela metade do espaço ocupado.
+ */
+void leaf_node_rebalance(Table* table, uint32_t parent_page_num, uint32_t index) {
+    Pager* pager = table->pager;
+    void* parent = get_page(pager, parent_page_num);
+
+    uint32_t left_index = index > 0 ? index - 1 : index;
+    uint32_t left_page_num = *internal_node_child(parent, left_index);
+    uint32_t right_page_num = *internal_node_child(parent, left_index + 1);
+    void* left = get_page(pager, left_page_num);
+    void* right = get_page(pager, right_page_num);
+
+    uint8_t left_copy[PAGE_SIZE];
+    uint8_t right_copy[PAGE_SIZE];
+    memcpy(left_copy, left, PAGE_SIZE);
+    memcpy(right_copy, right, PAGE_SIZE);
+    LeafCell cells[2 * LEAF_NODE_MAX_CELLS];
+    uint32_t num_cells = leaf_cells_collect(left_copy, cells);
+    num_cells += leaf_cells_collect(right_copy, cells + num_cells);
+
+    pager_mark_dirty(pager, left_page_num);
+    pager_mark_dirty(pager, parent_page_num);
+
+    if (leaf_node_used_space(left) + leaf_node_used_space(right) <= LEAF_NODE_SPACE_FOR_CELLS) {
+        // une a folha da direita na da esquerda
+        leaf_node_fill(left, cells, num_cells);
+        *leaf_node_next_leaf(left) = *leaf_node_next_leaf(right);
+        if (left_index + 1 < *internal_node_num_keys(parent)) {
+            // a esquerda herda a separadora da direita
+            *internal_node_key(parent, left_index) = *internal_node_key(parent, left_index + 1);
+        }
+        *internal_node_count(parent, left_index) = num_cells;
+        internal_node_remove_child(table, parent_page_num, right_page_num);
+        free_page(pager, right_page_num);
+        return;
+    }
+
+    uint32_t split = leaf_cells_split_point(cells, num_cells);
+    leaf_node_fill(left, cells, split);
+    leaf_node_fill(right, cells + split, num_cells - split);
+    *internal_node_key(parent, left_index) = get_node_max_key(pager, left);
+    *internal_node_count(parent, left_index) = split;
+    *internal_node_count(parent, left_index + 1) = num_cells - split;
+    pager_mark_dirty(pager, right_page_num);
+}
+
+// cursor na posição da chave: tenta a folha dada e a última folha antes de descer pela árvore
+Cursor* table_find_for_insert(Table* table, uint32_t hint_page_num, uint32_t key) {
+  Cursor* cursor = table_find_in_leaf(table, hint_page_num, key);
+  if (cursor == NULL) {
+    cursor = table_find_in_leaf(table, table->rightmost_leaf_page_num, key);
+  }
+  if (cursor == NULL) {
+    cursor = table_find(table, key);
+  }
+  if (*leaf_node_next_leaf(get_page(table->pager, cursor->page_num)) == 0) {
+    table->rightmost_leaf_page_num = cursor->page_num;
+  }
+  return cursor;
+}
+
+bool cursor_key_equals(Cursor* cursor, uint32_t key) {
+  void* node = get_page(cursor->table->pager, cursor->page_num);
+  return cursor->cell_num < *leaf_node_num_cells(node) && *leaf_node_key(node, cursor->cell_num) == key;
+}
+
+// grava a linha na posição do cursor e atualiza o índice e os filtros
+void table_insert_at(Table* table, Cursor* cursor, Row* row) {
+  leaf_node_insert(cursor, row->id, row);
+  index_insert(table, row->username, row->id);
+  bloom_filter_add(&table->id_filter, bloom_hash_id(row->id));
+  bloom_filter_add(&table->username_filter, bloom_hash_username(row->username));
+  if (bloom_filter_full(&table->id_filter) || bloom_filter_full(&table->username_filter)) {
+    bloom_filters_rebuild(table);
+  }
+}
+
+ExecuteResult execute_insert_with_index(Statement* statement, Table* table) {
+  Row* row_to_insert = &(statement->row_to_insert);
+  Cursor* cursor = table_find_for_insert(table, statement->hint_page_num, row_to_insert->id);
+  statement->hint_page_num = cursor->page_num;
+  if (cursor_key_equals(cursor, row_to_insert->id)) {
+    free(cursor);
+    return EXECUTE_DUPLICATE_KEY;
+  }
+
+  table_insert_at(table, cursor, row_to_insert);
+  free(cursor);
+
+  return EXECUTE_SUCCESS;
+}
+
+int row_id_compare(const void* a, const void* b) {
+  uint32_t id_a = (*(Row**)a)->id;
+  uint32_t id_b = (*(Row**)b)->id;
+  return id_a < id_b ? -1 : id_a > id_b;
+}
+
+/**
+ * insert com várias linhas: elas são ordenadas pelo id, então cada uma cai na folha
+ * da anterior ou logo depois dela, e quase nenhuma desce pela árvore. Os ids repetidos
+ * são procurados antes de gravar qualquer linha, e o filtro de Bloom evita a busca
+ * dos ids que com certeza não existem; o comando entra inteiro ou não entra. A ordem
+ * fica em um vetor à parte, porque os parâmetros apontam para as linhas pela posição.
+ */
+ExecuteResult execute_insert_rows(Statement* statement, Table* table) {
+  uint32_t num_rows = statement->num_rows_to_insert;
+  Row** rows = malloc(num_rows * sizeof(Row*));
+  for (uint32_t i = 0; i < num_rows; i++) {
+    rows[i] = &statement->rows_to_insert[i];
+  }
+  qsort(rows, num_rows, sizeof(Row*), row_id_compare);
+
+  ExecuteResult result = EXECUTE_SUCCESS;
+  for (uint32_t i = 0; i < num_rows && result == EXECUTE_SUCCESS; i++) {
+    if (i > 0 && rows[i]->id == rows[i - 1]->id) {
+      result = EXECUTE_DUPLICATE_KEY;
+    } else if (bloom_filter_may_contain(&table->id_filter, bloom_hash_id(rows[i]->id))) {
+      Cursor* cursor = table_find(table, rows[i]->id);
+      if (cursor_key_equals(cursor, rows[i]->id)) {
+        result = EXECUTE_DUPLICATE_KEY;
+      } else {
+        table->id_filter.false_positives++;
+      }
+      free(cursor);
+    }
+    pager_release(table->pager);
+  }
+
+  for (uint32_t i = 0; i < num_rows && result == EXECUTE_SUCCESS; i++) {
+    Cursor* cursor = table_find_for_insert(table, statement->hint_page_num, rows[i]->id);
+    table_insert_at(table, cursor, rows[i]);
+    statement->hint_page_num = cursor->page_num;
+    free(cursor);
+    pager_release(table->pager);
+  }
+
+  free(rows);
+  return result;
+}
+
+ExecuteResult execute_insert(Statement* statement, Table* table) {
+  Row* row_to_insert = &(statement->row_to_insert);
+  uint32_t key_to_insert = row_to_insert->id;
+  Cursor* cursor = table_find(table, key_to_insert);
+
+  void* node = get_page(table->pager, cursor->page_num);
+  uint32_t num_cells = *leaf_node_num_cells(node);
+
+  if (cursor->cell_num < num_cells) {
+    uint32_t key_at_index = *leaf_node_key(node, cursor->cell_num);
+    if (key_at_index == key_to_insert) {
+      return EXECUTE_DUPLICATE_KEY;
+    }
+  }
+
+  leaf_node_insert(cursor, row_to_insert->id, row_to_insert);
+
+  free(cursor);
+
+  return EXECUTE_SUCCESS;
+}
+
+// posição da primeira entrada do índice com o username procurado e id >= id
+/**
+ * Filtros sobre colunas sem índice (select where email = ..., select where <coluna>
+ * like ...). Os textos são comparados direto nos bytes da página, sem deserialize_row:
+ * cada folha produz um vetor com as células que passaram e só essas linhas são copiadas.
+ *
+ * Os kernels leem vetores inteiros que podem começar até 31 bytes antes do texto (o
+ * início de qualquer texto de uma linha fica depois do header e de um slot da folha) e
+ * nunca passam do fim dele, então não saem da página.
+ */
+bool filter_match_scalar(const uint8_t* text, const FilterSegment* segment) {
+  const uint8_t* bytes = segment->bytes + FILTER_PADDING;
+  const uint8_t* care = segment->care + FILTER_PADDING;
+  for (uint32_t i = 0; i < segment->length; i++) {
+    if ((text[i] ^ bytes[i]) & care[i]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+int64_t filter_find_scalar(const uint8_t* text, uint32_t from, uint32_t last, const FilterSegment* segment) {
+  uint8_t first = segment->bytes[FILTER_PADDING + segment->first_literal];
+  for (uint32_t position = from; position <= last; position++) {
+    if (text[position + segment->first_literal] == first && filter_match_scalar(text + position, segment)) {
+      return position;
+    }
+  }
+  return -1;
+}
+
+const FilterKernels FILTER_KERNELS_SCALAR = {"scalar", filter_match_scalar, filter_find_scalar};
+
+#ifdef FILTER_X86_KERNELS
+// do fim para o começo em blocos de 16; o último bloco pode começar antes do texto
+bool filter_match_sse2(const uint8_t* text, const FilterSegment* segment) {
+  const uint8_t* bytes = segment->bytes + FILTER_PADDING;
+  const uint8_t* care = segment->care + FILTER_PADDING;
+  for (int32_t i = (int32_t)segment->length - 16; i > -16; i -= 16) {
+    __m128i difference = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(text + i)),
+                                       _mm_loadu_si128((const __m128i*)(bytes + i)));
+    difference = _mm_and_si128(difference, _mm_loadu_si128((const __m128i*)(care + i)));
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(difference, _mm_setzero_si128())) != 0xFFFF) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * Compara 16 posições de uma vez com o primeiro e o último byte fixo do pedaço e só
+ * confere inteiras as posições em que os dois batem. O último bloco termina em last e
+ * pode repetir posições já vistas, que a máscara descarta.
+ */
+int64_t filter_find_sse2(const uint8_t* text, uint32_t from, uint32_t last, const FilterSegment* segment) {
+  __m128i first = _mm_set1_epi8(segment->bytes[FILTER_PADDING + segment->first_literal]);
+  __m128i final = _mm_set1_epi8(segment->bytes[FILTER_PADDING + segment->last_literal]);
+  int64_t start = from;
+  while (start <= last) {
+    int64_t block = start + 15 <= last ? start : (int64_t)last - 15;
+    __m128i first_equal = _mm_cmpeq_epi8(first, _mm_loadu_si128((const __m128i*)(text + block + segment->first_literal)));
+    __m128i final_equal = _mm_cmpeq_epi8(final, _mm_loadu_si128((const __m128i*)(text + block + segment->last_literal)));
+    uint32_t candidates = _mm_movemask_epi8(_mm_and_si128(first_equal, final_equal));
+    candidates &= 0xFFFFu << (start - block);
+    while (candidates != 0) {
+      int64_t position = block + __builtin_ctz(candidates);
+      if (filter_match_sse2(text + position, segment)) {
+        return position;
+      }
+      candidates &= candidates - 1;
+    }
+    start = block + 16;
+  }
+  return -1;
+}
+
+__attribute__((target("avx2")))
+bool filter_match_avx2(const uint8_t* text, const FilterSegment* segment) {
+  const uint8_t* bytes = segment->bytes + FILTER_PADDING;
+  const uint8_t* care = segment->care + FILTER_PADDING;
+  for (int32_t i = (int32_t)segment->length - 32; i > -32; i -= 32) {
+    __m256i difference = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(text + i)),
+                                          _mm256_loadu_si256((const __m256i*)(bytes + i)));
+    difference = _mm256_and_si256(difference, _mm256_loadu_si256((const __m256i*)(care + i)));
+    if (!_mm256_testz_si256(difference, difference)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+__attribute__((target("avx2")))
+int64_t filter_find_avx2(const uint8_t* text, uint32_t from, uint32_t last, const FilterSegment* segment) {
+  __m256i first = _mm256_set1_epi8(segment->bytes[FILTER_PADDING + segment->first_literal]);
+  __m256i final = _mm256_set1_epi8(segment->bytes[FILTER_PADDING + segment->last_literal]);
+  int64_t start = from;
+  while (start <= last) {
+    int64_t block = start + 31 <= last ? start : (int64_t)last - 31;
+    __m256i first_equal = _mm256_cmpeq_epi8(first, _mm256_loadu_si256((const __m256i*)(text + block + segment->first_literal)));
+    __m256i final_equal = _mm256_cmpeq_epi8(final, _mm256_loadu_si256((const __m256i*)(text + block + segment->last_literal)));
+    uint32_t candidates = _mm256_movemask_epi8(_mm256_and_si256(first_equal, final_equal));
+    candidates &= 0xFFFFFFFFu << (start - block);
+    while (candidates != 0) {
+      int64_t position = block + __builtin_ctz(candidates);
+      if (filter_match_avx2(text + position, segment)) {
+        return position;
+      }
+      candidates &= candidates - 1;
+    }
+    start = block + 32;
+  }
+  return -1;
+}
+
+const FilterKernels FILTER_KERNELS_SSE2 = {"sse2", filter_match_sse2, filter_find_sse2};
+const FilterKernels FILTER_KERNELS_AVX2 = {"avx2", filter_match_avx2, filter_find_avx2};
+#endif
+
+// kernels pelo nome do .simd; NULL se não existem ou a CPU não os suporta
+const FilterKernels* filter_kernels_named(const char* name) {
+  if (strcmp(name, "scalar") == 0) {
+    return &FILTER_KERNELS_SCALAR;
+  }
+#ifdef FILTER_X86_KERNELS
+  if (strcmp(name, "sse2") == 0) {
+    return &FILTER_KERNELS_SSE2;
+  }
+  if (strcmp(name, "avx2") == 0 && __builtin_cpu_supports("avx2")) {
+    return &FILTER_KERNELS_AVX2;
+  }
+#endif
+  return NULL;
+}
+
+const FilterKernels* filter_kernels_best() {
+  const FilterKernels* kernels = filter_kernels_named("avx2");
+  if (kernels == NULL) {
+    kernels = filter_kernels_named("sse2");
+  }
+  return kernels != NULL ? kernels : &FILTER_KERNELS_SCALAR;
+}
+
+typedef struct {
+  Column column;
+  bool exact; // sem '%': o texto inteiro é o único pedaço
+  bool anchored_start; // o padrão não começa com '%'
+  bool anchored_end; // o padrão não termina com '%'
+  FilterSegment* segments;
+  uint32_t num_segments;
+  uint32_t min_length; // soma dos pedaços
+  const FilterKernels* kernels;
+} Filter;
+
+// separa o padrão nos '%'; num '=' o valor inteiro é um pedaço só, sem curingas
+void filter_compile(Filter* filter, Statement* statement, const FilterKernels* kernels) {
+  const char* pattern = statement->filter_pattern;
+  uint32_t length = strlen(pattern);
+  filter->column = statement->filter_column;
+  filter->kernels = kernels;
+  filter->exact = !statement->filter_like || strchr(pattern, '%') == NULL;
+  filter->anchored_start = filter->exact || pattern[0] != '%';
+  filter->anchored_end = filter->exact || pattern[length - 1] != '%';
+  filter->segments = calloc(length / 2 + 1, sizeof(FilterSegment));
+  filter->num_segments = 0;
+  filter->min_length = 0;
+
+  uint32_t i = 0;
+  while (i < length) {
+    uint32_t end = i;
+    while (end < length && (!statement->filter_like || pattern[end] != '%')) {
+      end++;
+    }
+    if (end > i) {
+      FilterSegment* segment = &filter->segments[filter->num_segments++];
+      segment->length = end - i;
+      for (uint32_t j = 0; j < segment->length; j++) {
+        bool wildcard = statement->filter_like && pattern[i + j] == '_';
+        segment->bytes[FILTER_PADDING + j] = pattern[i + j];
+        segment->care[FILTER_PADDING + j] = wildcard ? 0 : 0xFF;
+        if (!wildcard) {
+          if (!segment->literal) {
+            segment->first_literal = j;
+          }
+          segment->literal = true;
+          segment->last_literal = j;
+        }
+      }
+      filter->min_length += segment->length;
     }
+    i = end + 1;
   }
 }
 
-void db_close(Table* table) {
-  Pager* pager = table->pager;
+bool filter_matches(const Filter* filter, const uint8_t* text, uint32_t length) {
+  if (length < filter->min_length) {
+    return false;
+  }
+  if (filter->exact) {
+    return length == filter->min_length &&
+           (filter->num_segments == 0 || filter->kernels->match(text, &filter->segments[0]));
+  }
 
-  for (uint32_t i = 0; i < pager->num_pages; i++) {
-    if (pager->pages[i] == NULL) {
-      continue;
+  uint32_t first = 0;
+  uint32_t count = filter->num_segments;
+  uint32_t position = 0;
+  uint32_t end = length;
+  if (filter->anchored_start && count > 0) {
+    if (!filter->kernels->match(text, &filter->segments[0])) {
+      return false;
     }
-    pager_flush(pager, i);
-    free(pager->pages[i]);
-    pager->pages[i] = NULL;
+    position = filter->segments[0].length;
+    first = 1;
   }
-
-  int result = close(pager->file_descriptor);
-  if (result == -1) {
-    printf("Erro ao fechar o banco de dados.\n");
-    exit(EXIT_FAILURE);
+  if (filter->anchored_end && count > first) {
+    const FilterSegment* segment = &filter->segments[count - 1];
+    if (!filter->kernels->match(text + length - segment->length, segment)) {
+      return false;
+    }
+    end = length - segment->length;
+    count--;
   }
-  for (uint32_t i = 0; i < TABLE_MAX_PAGES; i++) {
-    void* page = pager->pages[i];
-    if (page) {
-      free(page);
-      pager->pages[i] = NULL;
+  // os pedaços do meio, cada um na primeira posição depois do anterior
+  for (uint32_t i = first; i < count; i++) {
+    const FilterSegment* segment = &filter->segments[i];
+    if (position + segment->length > end) {
+      return false;
+    }
+    int64_t found = position;
+    if (segment->literal) {
+      found = filter->kernels->find(text, position, end - segment->length, segment);
+      if (found < 0) {
+        return false;
+      }
     }
+    position = found + segment->length;
   }
-  free(pager);
-  free(table);
+  return true;
 }
 
-
-// iniciando o event loop
-void print_prompt() { printf("rql > "); }
-
-// faz a leitura do input do usuario com o getline
-// void read_input(InputBuffer* input_buffer) {
-//   ssize_t bytes_read =
-//       getline(&(input_buffer->buffer), &(input_buffer->buffer_length), stdin);
-
-//   if (bytes_read <= 0) {
-//     printf("Error reading input\n");
-//     exit(EXIT_FAILURE);
-//   }
-
-//   // ignora novas linhas
-//   input_buffer->input_length = bytes_read - 1;
-//   input_buffer->buffer[bytes_read - 1] = 0;
-// }
-
-void read_input(InputBuffer* input_buffer) {
-  ssize_t bytes_read =
-      getline(&(input_buffer->buffer), &(input_buffer->buffer_length), stdin);
-
-  if (bytes_read <= 0) {
-    printf("Erro ao ler entrada\n");
-    exit(EXIT_FAILURE);
+// células [begin, end) da folha que passam no filtro, em ordem, no vetor de seleção
+uint32_t filter_leaf(const Filter* filter, void* node, uint32_t begin, uint32_t end, uint16_t* selection) {
+  uint32_t count = 0;
+  for (uint32_t i = begin; i < end; i++) {
+    uint8_t* length = record_column_length(leaf_node_value(node, i), filter->column);
+    selection[count] = i;
+    count += filter_matches(filter, length + COLUMN_LENGTH_SIZE, *length);
   }
-
-  // Ignore trailing newline
-  input_buffer->input_length = bytes_read - 1;
-  input_buffer->buffer[bytes_read - 1] = 0;
-}
-
-void close_input_buffer(InputBuffer* input_buffer) {
-    free(input_buffer->buffer);
-    free(input_buffer);
+  return count;
 }
 
-void print_row(Row* row) {
-  printf("(%d, %s, %s)\n", row->id, row->username, row->email);
+// linhas que passaram no filtro em uma faixa da varredura, serializadas em sequência
+typedef struct {
+  const Filter* filter;
+  uint8_t* data;
+  size_t size;
+  size_t capacity;
+} FilterScanPart;
+
+struct FilterResult {
+  FilterScanPart parts[SCAN_MAX_THREADS];
+  uint32_t num_parts;
+  uint32_t part; // faixa da próxima linha
+  size_t offset; // posição da próxima linha na faixa
+};
+
+void filter_scan_leaf(void* context, void* node, uint32_t begin, uint32_t end) {
+  FilterScanPart* part = context;
+  uint16_t selection[end - begin];
+  uint32_t count = filter_leaf(part->filter, node, begin, end, selection);
+  for (uint32_t i = 0; i < count; i++) {
+    uint32_t size = leaf_node_value_size(node, selection[i]);
+    if (part->size + size > part->capacity) {
+      part->capacity = part->capacity ? part->capacity * 2 : PAGE_SIZE;
+      part->data = realloc(part->data, part->capacity);
+    }
+    memcpy(part->data + part->size, leaf_node_value(node, selection[i]), size);
+    part->size += size;
+  }
 }
 
-// void pager_flush(Pager* pager, uint32_t page_num, uint32_t size){
-void pager_flush(Pager* pager, uint32_t page_num) {
-  if (pager->pages[page_num] == NULL) {
-    printf("Tentativa de liberar uma página null.\n");
-    exit(EXIT_FAILURE);
+void filter_result_free(PreparedStatement* prepared) {
+  FilterResult* result = prepared->filter_result;
+  if (result == NULL) {
+    return;
   }
-
-  off_t offset = lseek(pager->file_descriptor, page_num * PAGE_SIZE, SEEK_SET);
-
-  if (offset == -1) {
-    printf("Erro ao buscar: %d\n");
-    exit(EXIT_FAILURE);
+  for (uint32_t i = 0; i < result->num_parts; i++) {
+    free(result->parts[i].data);
   }
+  free(result);
+  prepared->filter_result = NULL;
+}
 
-  ssize_t bytes_written = write(pager->file_descriptor, pager->pages[page_num], PAGE_SIZE);
+/**
+ * Primeiro passo de um select com filtro: a tabela inteira é varrida em paralelo e as
+ * linhas que passam são copiadas. As faixas estão em ordem de chave, então os passos
+ * seguintes devolvem as cópias faixa a faixa, em ordem de id, sem ler páginas.
+ */
+void select_filter_scan(PreparedStatement* prepared) {
+  Table* table = prepared->table;
+  Filter filter;
+  filter_compile(&filter, &prepared->statement, table->filter_kernels);
+  FilterResult* result = calloc(1, sizeof(FilterResult));
+  for (uint32_t i = 0; i < SCAN_MAX_THREADS; i++) {
+    result->parts[i].filter = &filter;
+  }
+  result->num_parts = table_scan_parallel(table, filter_scan_leaf, NULL, result->parts, sizeof(FilterScanPart));
+  free(filter.segments);
+  prepared->filter_result = result;
+}
 
-  if (bytes_written == -1) {
-    printf("Erro ao escrever: %d\n");
-    exit(EXIT_FAILURE);
+// próxima linha copiada, NULL depois da última
+void* select_filter_next(PreparedStatement* prepared) {
+  FilterResult* result = prepared->filter_result;
+  while (result->part < result->num_parts) {
+    FilterScanPart* part = &result->parts[result->part];
+    if (result->offset < part->size) {
+      void* record = part->data + result->offset;
+      result->offset += row_serialized_size(record);
+      return record;
+    }
+    result->part++;
+    result->offset = 0;
   }
+  return NULL;
 }
 
-Index* username_index;
+void select_seek_index(PreparedStatement* prepared, uint32_t id) {
+  Table* table = prepared->table;
+  index_key_make(&prepared->index_key, prepared->statement.username_to_find, id);
+  IndexPath path;
+  prepared->index_page_num = index_find_leaf(table, &prepared->index_key, &path);
+}
 
-void print_index(Index* index) {
-    printf("Index contents:\n");
-    for (uint32_t i = 0; i < index->size; i++) {
-        printf("%d: %s\n", index->entries[i].id, index->entries[i].username);
+/**
+ * Início de um select: posiciona a varredura sem devolver linhas. Um id ou um
+ * username que o filtro de Bloom descarta termina o comando sem ler nenhuma página.
+ */
+void select_start(PreparedStatement* prepared) {
+  Table* table = prepared->table;
+  Statement* statement = &prepared->statement;
+  switch (statement->type) {
+    case (STATEMENT_SELECT):
+      prepared->cursor = statement->offset > 0 ? table_seek_rank(table, statement->offset) : table_start(table);
+      break;
+    case (STATEMENT_SELECT_BY_ID): {
+      // select por id: desce direto até o início do intervalo e para depois do fim
+      uint32_t start = statement->id_range_start;
+      uint32_t end = statement->id_range_end;
+      if (start > end || (start == end && !bloom_filter_may_contain(&table->id_filter, bloom_hash_id(start)))) {
+        prepared->done = true;
+        return;
+      }
+      if (statement->offset > 0) {
+        // as linhas puladas pelo offset são contadas nos nós internos, sem passar por elas
+        uint64_t rank = (uint64_t)table_rank(table, start) + statement->offset;
+        prepared->cursor = table_seek_rank(table, rank > UINT32_MAX ? UINT32_MAX : rank);
+      } else {
+        prepared->cursor = table_seek(table, statement->hint_page_num, start);
+      }
+      statement->hint_page_num = prepared->cursor->page_num;
+      break;
+    }
+    case (STATEMENT_SELECT_BY_USERNAME): {
+      const char* username = statement->username_to_find;
+      if (!bloom_filter_may_contain(&table->username_filter, bloom_hash_username(username))) {
+        prepared->done = true;
+        return;
+      }
+      // Desce no índice até a primeira entrada com esse username (o menor id possível)
+      select_seek_index(prepared, 0);
+      break;
     }
+    default:
+      break;
+  }
 }
 
-// comandos não sql do usuário, iniciados sempre com .
-MetaCommandResult do_meta_command(InputBuffer* input_buffer, Table* table) {
-  if (strcmp(input_buffer->buffer, ".exit") == 0) {
-    db_close(table);
-    exit(EXIT_SUCCESS);
-  } else if (strcmp(input_buffer->buffer, ".btree") == 0) {
-    printf("Tree:\n");
-    print_tree(table->pager, 0, 0, 3);
-    return META_COMMAND_SUCCESS;
-  } else if (strcmp(input_buffer->buffer, ".constants") == 0) {
-    printf("Constantes:\n");
-    print_constants();
-    return META_COMMAND_SUCCESS;
-  } else if (strcmp(input_buffer->buffer, ".print_index") == 0) {
-        print_index(username_index);
-        return META_COMMAND_SUCCESS;
-  } else {
-    return META_COMMAND_UNRECOGNIZED_COMMAND;
+// próxima linha da varredura da tabela; NULL no fim da tabela ou depois do fim do intervalo
+void* select_next_from_table(PreparedStatement* prepared) {
+  Cursor* cursor = prepared->cursor;
+  if (cursor->end_of_table) {
+    return NULL;
   }
+  // uma página por linha: o valor e o avanço saem da mesma folha
+  leaf_latch_shared(prepared->table, cursor->page_num);
+  void* node = get_page(prepared->table->pager, cursor->page_num);
+  if (prepared->statement.type == STATEMENT_SELECT_BY_ID &&
+      *leaf_node_key(node, cursor->cell_num) > prepared->statement.id_range_end) {
+    return NULL;
+  }
+  void* record = leaf_node_value(node, cursor->cell_num);
+  cursor_advance_in_leaf(cursor, node);
+  return record;
 }
 
-// Função para preparar a instrução de inserção
-PrepareResult prepare_insert(InputBuffer* input_buffer, Statement* statement) {
-  // Define o tipo da instrução como inserção
-  statement->type = STATEMENT_INSERT;
-
-  // Divide a entrada em palavras usando espaço como delimitador
-  char* keyword = strtok(input_buffer->buffer, " ");
-  char* id_string = strtok(NULL, " ");
-  char* username = strtok(NULL, " ");
-  char* email = strtok(NULL, " ");
+// Percorre as entradas do índice enquanto o username for o mesmo, seguindo as folhas
+// A folha do índice pode mudar entre os passos, então a posição vem da chave procurada e não da célula
+void* select_next_from_index(PreparedStatement* prepared) {
+  Table* table = prepared->table;
+  const char* username = prepared->statement.username_to_find;
+  while (prepared->index_page_num != 0) {
+    leaf_latch_shared(table, prepared->index_page_num);
+    void* node = get_page(table->pager, prepared->index_page_num);
+    uint32_t cell_num = index_leaf_node_find(node, &prepared->index_key);
+    if (cell_num == *index_leaf_node_num_cells(node)) {
+      prepared->index_page_num = *index_leaf_node_next_leaf(node);
+      continue;
+    }
+    IndexKey* entry = index_leaf_node_key(node, cell_num);
+    if (memcmp(entry->username, prepared->index_key.username, COLUMN_USERNAME_SIZE) != 0) {
+      return NULL;
+    }
+    uint32_t id = entry->id;
+    // depois do último id possível não há o que procurar
+    prepared->index_key.id = id + 1;
+    if (id == UINT32_MAX) {
+      prepared->index_page_num = 0;
+    }
 
-  // Verifica se todos os campos necessários foram fornecidos
-  if (id_string == NULL || username == NULL || email == NULL) {
-    return PREPARE_SYNTAX_ERROR; // Retorna erro de sintaxe se algum campo estiver faltando
+    // Busca a linha na tabela pelo ID guardado no índice. Entre soltar a folha do índice
+    // e travar a da tabela a linha pode ter sido apagada, ou inserida de novo com outro username
+    Cursor* cursor = table_find(table, id);
+    void* record = NULL;
+    if (cursor_key_equals(cursor, id)) {
+      record = cursor_value(cursor);
+      uint8_t username_length = *(uint8_t*)(record + USERNAME_OFFSET);
+      if (username_length != strlen(username) ||
+          memcmp(record + USERNAME_OFFSET + COLUMN_LENGTH_SIZE, username, username_length) != 0) {
+        record = NULL;
+      }
+    }
+    free(cursor);
+    if (record != NULL) {
+      return record;
+    }
   }
+  return NULL;
+}
 
-  // Converte a string do ID para inteiro
-  int id = atoi(id_string);
-  if (id < 0) {
-    return PREPARE_NEGATIVE_ID; // Retorna erro se o ID for negativo
+// fim do select: uma busca pontual que o filtro deixou passar e não achou nada é um falso positivo
+void select_finish(PreparedStatement* prepared) {
+  Statement* statement = &prepared->statement;
+  if (!prepared->done && prepared->num_rows == 0 && statement->limit > 0 && statement->offset == 0) {
+    if (statement->type == STATEMENT_SELECT_BY_ID && statement->id_range_start == statement->id_range_end) {
+      __atomic_fetch_add(&prepared->table->id_filter.false_positives, 1, __ATOMIC_RELAXED);
+    } else if (statement->type == STATEMENT_SELECT_BY_USERNAME) {
+      __atomic_fetch_add(&prepared->table->username_filter.false_positives, 1, __ATOMIC_RELAXED);
+    }
   }
+  prepared->done = true;
+  free(prepared->cursor);
+  prepared->cursor = NULL;
+  filter_result_free(prepared);
+}
 
-  // Verifica se o tamanho do username não excede o limite
-  if (strlen(username) > COLUMN_USERNAME_SIZE) {
-    return PREPARE_STRING_TOO_LONG; // Retorna erro se o username for muito longo
-  }
-  // Verifica se o tamanho do email não excede o limite
-  if (strlen(email) > COLUMN_EMAIL_SIZE) {
-    return PREPARE_STRING_TOO_LONG; // Retorna erro se o email for muito longo
+/**
+ * A posição do select ainda vale se a árvore não mudou de forma desde o passo anterior
+ * e, numa varredura da tabela, se a folha da linha corrente continuou travada: solta, ela
+ * pode ter ganhado ou perdido linhas antes do cursor. O início de uma folha continua
+ * certo mesmo assim, e a busca pelo índice refaz a posição a cada passo.
+ */
+bool select_position_valid(PreparedStatement* prepared) {
+  if (prepared->version != prepared->table->version) {
+    return false;
   }
-
-  // Copia os valores para a estrutura de inserção
-  statement->row_to_insert.id = id;
-  strcpy(statement->row_to_insert.username, username);
-  strcpy(statement->row_to_insert.email, email);
-
-  // Retorna sucesso na preparação da instrução de inserção
-  return PREPARE_SUCCESS;
+  return prepared->leaf_kept || prepared->statement.type == STATEMENT_SELECT_BY_USERNAME ||
+         prepared->cursor->cell_num == 0;
 }
 
-
-PrepareResult prepare_delete(InputBuffer* input_buffer, Statement* statement) {
-  statement->type = STATEMENT_DELETE;
-
-  char* keyword = strtok(input_buffer->buffer, " ");
-  char* id_string = strtok(NULL, " ");
-
-  if (id_string == NULL) {
-    return PREPARE_SYNTAX_ERROR;
+/**
+ * A posição não vale mais: o cursor pode apontar para uma página reaproveitada ou
+ * para uma célula que mudou, então a varredura procura de novo o id seguinte ao
+ * último devolvido, começando pela folha em que estava.
+ */
+void select_reposition(PreparedStatement* prepared) {
+  Statement* statement = &prepared->statement;
+  if (prepared->last_id == UINT32_MAX) {
+    select_finish(prepared);
+    return;
   }
-
-  int id = atoi(id_string);
-  if (id < 0) {
-    return PREPARE_NEGATIVE_ID;
+  if (statement->type == STATEMENT_SELECT_BY_USERNAME) {
+    select_seek_index(prepared, prepared->last_id + 1);
+    return;
   }
-
-  statement->id_to_delete = id;
-
-  return PREPARE_SUCCESS;
+  uint32_t hint_page_num = prepared->cursor->page_num;
+  free(prepared->cursor);
+  prepared->cursor = table_seek(prepared->table, hint_page_num, prepared->last_id + 1);
 }
 
-
-// processador de comandos SQL
-PrepareResult prepare_statement(InputBuffer* input_buffer, Statement* statement) {
-  if (strncmp(input_buffer->buffer, "insert", 6) == 0) {
-    return prepare_insert(input_buffer, statement);
+// um passo do select: a varredura não guarda ponteiros para páginas, só a linha corrente fica fixada
+ExecuteResult select_step(PreparedStatement* prepared) {
+  Table* table = prepared->table;
+  if (!prepared->started) {
+    prepared->started = true;
+    select_start(prepared);
+  } else if (!prepared->done && !select_position_valid(prepared)) {
+    select_reposition(prepared);
   }
-  if (strcmp(input_buffer->buffer, "select") == 0) {
-    statement->type = STATEMENT_SELECT;
-    return PREPARE_SUCCESS;
+  prepared->version = table->version;
+
+  void* record = NULL;
+  if (!prepared->done && prepared->num_rows < prepared->statement.limit) {
+    if (prepared->statement.type == STATEMENT_SELECT_BY_USERNAME) {
+      record = select_next_from_index(prepared);
+    } else {
+      record = select_next_from_table(prepared);
+    }
   }
-  if (strncmp(input_buffer->buffer, "delete", 6) == 0) {
-    return prepare_delete(input_buffer, statement);
+  if (record == NULL) {
+    select_finish(prepared);
+    return EXECUTE_SUCCESS;
   }
 
-  return PREPARE_UNRECOGNIZED_STATEMENT;
-}
-
-/**
- * as novas paginas sempre irao para o final do arquivo do banco de dados
-*/
-uint32_t get_unused_page_num(Pager* pager) { 
-  return pager->num_pages; 
+  prepared->record = record;
+  memcpy(&prepared->last_id, record + ID_OFFSET, ID_SIZE);
+  prepared->num_rows++;
+  return EXECUTE_ROW;
 }
 
+ExecuteResult execute_delete(Statement* statement, Table* table) {
+    // id que com certeza não existe: nada para apagar, sem descer na árvore
+    if (!bloom_filter_may_contain(&table->id_filter, bloom_hash_id(statement->id_to_delete))) {
+        return EXECUTE_SUCCESS;
+    }
 
+    Cursor* cursor = table_find_from_hint(table, statement->hint_page_num, statement->id_to_delete);
+    statement->hint_page_num = cursor->page_num;
 
-void create_new_root(Table* table, uint32_t right_child_page_num) {
-  /**
-   * divide o nó raíz
-   * A antiga raíz é copiada para uma nova página e se torna o filho da esquerda
-   * O endereço do filho da direita é passado
-   * Reinicializa a página raíz para contar o a o novo nó raíz
-   * novo nó raíz aponta para os dois filhos
-  */
-
-  void* root = get_page(table->pager, table->root_page_num);
-  void* right_child = get_page(table->pager, right_child_page_num);
-  uint32_t left_child_page_num = get_unused_page_num(table->pager);
-  void* left_child = get_page(table->pager, left_child_page_num);
-  //The old root is copied to the left child so we can reuse the root page:
+    void* node = get_page(cursor->table->pager, cursor->page_num);
+    uint32_t num_cells = *leaf_node_num_cells(node);
 
-  /**
-  * dados do filho da esquerda copiados para a nova raíz
-  */
+    if (cursor->cell_num < num_cells) {
+        uint32_t key_at_index = *leaf_node_key(node, cursor->cell_num);
+        if (key_at_index == statement->id_to_delete) {
+            Row row;
+            deserialize_row(leaf_node_value(node, cursor->cell_num), &row);
+            index_delete(table, row.username, row.id);
+            leaf_node_delete(cursor, statement->id_to_delete);
+            free(cursor);
+            return EXECUTE_SUCCESS;
+        }
+    }
 
-  memcpy(left_child, root, PAGE_SIZE);
-  set_node_root(left_child, false);
+    table->id_filter.false_positives++;
+    free(cursor);
+    return EXECUTE_SUCCESS; // Se a chave não for encontrada, ainda consideramos a operação bem-sucedida
+}
 
 /**
- * inicializa a página raíz como um nó interno com 2 filhos
- * nó raíz é um novo nó interno com uma chave e 2 filhos
+ * Inserts e deletes de uma linha com o latch da tabela compartilhado, travando só as
+ * duas folhas que eles alteram, a da tabela e a do índice. Fora os totais das subárvores,
+ * os nós internos só mudam com o latch exclusivo, então a descida não trava nada e a folha
+ * encontrada continua sendo a da chave até o fim do comando. Se a linha não couber na folha, se a folha ficar
+ * abaixo do mínimo, se a separadora do pai tiver que mudar ou se um filtro de Bloom
+ * tiver que ser reconstruído, a função devolve false sem ter alterado nada e o comando
+ * é refeito com o latch exclusivo.
  */
-
-  initialize_internal_node(root);
-  set_node_root(root, true);
-  *internal_node_num_keys(root) = 1;
-  *internal_node_child(root, 0) = left_child_page_num;
-  uint32_t left_child_max_key = get_node_max_key(left_child);
-  *internal_node_key(root, 0) = left_child_max_key;
-  *internal_node_right_child(root) = right_child_page_num;
-  *node_parent(left_child) = table->root_page_num;
-  *node_parent(right_child) = table->root_page_num;
+Cursor* leaf_write_find(Table* table, LeafWriteLatch* latch, uint32_t hint_page_num, uint32_t key,
+                        uint32_t other_page_num) {
+  // a dica só pode ser conferida com a folha travada
+  if (hint_page_num != 0) {
+    leaf_write_latch(table, latch, hint_page_num, other_page_num);
+    Cursor* cursor = table_find_in_leaf(table, hint_page_num, key);
+    if (cursor != NULL) {
+      return cursor;
+    }
+    leaf_write_unlatch(table, latch);
+  }
+  uint32_t page_num = table_find_leaf(table, key);
+  leaf_write_latch(table, latch, page_num, other_page_num);
+  return leaf_node_find(table, page_num, key);
 }
 
+/**
+ * As duas folhas vão para o WAL como um commit, ainda travadas. Os totais dos nós
+ * internos acima da folha da tabela mudam só na memória e ficam na lista de table_counts_hold.
+ */
+void leaf_write_commit(Table* table, uint32_t page_num, uint32_t index_page_num, uint32_t key, int32_t delta) {
+  Pager* pager = table->pager;
+  uint32_t parent_page_nums[TABLE_MAX_DEPTH];
+  pthread_mutex_lock(&table->counts_lock);
+  uint32_t num_parents = node_counts_add(pager, page_num, key, delta, parent_page_nums);
+  for (uint32_t i = 0; i < num_parents; i++) {
+    table_counts_hold(table, parent_page_nums[i]);
+  }
+  pthread_mutex_unlock(&table->counts_lock);
 
-
-void update_internal_node_key(void* node, uint32_t old_key, uint32_t new_key) {
-  uint32_t old_child_index = internal_node_find_child(node, old_key);
-  *internal_node_key(node, old_child_index) = new_key;
+  uint32_t page_nums[2] = {page_num, index_page_num};
+  void* pages[2] = {get_page(pager, page_num), get_page(pager, index_page_num)};
+  wal_commit(pager->wal, page_nums, pages, 2, __atomic_load_n(&pager->num_pages, __ATOMIC_ACQUIRE));
+  __atomic_fetch_add(&pager->pages_written, 2, __ATOMIC_RELAXED);
 }
 
-void internal_node_insert(Table* table, uint32_t parent_page_num,
-                          uint32_t child_page_num) {
-  void* parent = get_page(table->pager, parent_page_num);
-  void* child = get_page(table->pager, child_page_num);
-  uint32_t child_max_key = get_node_max_key(child);
-  uint32_t index = internal_node_find_child(parent, child_max_key);
-
-  uint32_t original_num_keys = *internal_node_num_keys(parent);
-  *internal_node_num_keys(parent) = original_num_keys + 1;
-
-  if (original_num_keys >= INTERNAL_NODE_MAX_CELLS) {
-    // Dividir o nó interno se ele estiver cheio
-    printf("Dividindo nó interno\n");
-    uint32_t new_page_num = get_unused_page_num(table->pager);
-    void* new_node = get_page(table->pager, new_page_num);
-    initialize_internal_node(new_node);
-
-    // Copiar metade das chaves e filhos para o novo nó
-    uint32_t split_index = (INTERNAL_NODE_MAX_CELLS + 1) / 2;
-    for (uint32_t i = split_index; i < INTERNAL_NODE_MAX_CELLS; i++) {
-      *internal_node_child(new_node, i - split_index) = *internal_node_child(parent, i);
-      *internal_node_key(new_node, i - split_index) = *internal_node_key(parent, i);
-    }
-    *internal_node_right_child(new_node) = *internal_node_right_child(parent);
-    *internal_node_num_keys(new_node) = INTERNAL_NODE_MAX_CELLS - split_index;
-    *internal_node_num_keys(parent) = split_index;
-
-    // Se a chave a ser inserida é maior que a maior chave do nó pai original, insira no novo nó
-    if (child_max_key > *internal_node_key(parent, split_index - 1)) {
-      internal_node_insert(table, new_page_num, child_page_num);
-    } else {
-      internal_node_insert(table, parent_page_num, child_page_num);
-    }
-
-    // Criar um novo nó pai
-    if (is_node_root(parent)) {
-      create_new_root(table, new_page_num);
-    } else {
-      uint32_t parent_page_num = *node_parent(parent);
-      uint32_t new_max = get_node_max_key(parent);
-      void* parent_node = get_page(table->pager, parent_page_num);
-
-      update_internal_node_key(parent_node, new_max, get_node_max_key(new_node));
-      internal_node_insert(table, parent_page_num, new_page_num);
-    }
-    return;
+bool execute_leaf_insert(Statement* statement, Table* table, ExecuteResult* result) {
+  Pager* pager = table->pager;
+  Row* row = &statement->row_to_insert;
+  if (!bloom_filter_has_room(&table->id_filter) || !bloom_filter_has_room(&table->username_filter)) {
+    return false;
   }
 
-  uint32_t right_child_page_num = *internal_node_right_child(parent);
-  void* right_child = get_page(table->pager, right_child_page_num);
+  IndexKey key;
+  index_key_make(&key, row->username, row->id);
+  IndexPath path;
+  uint32_t index_page_num = index_find_leaf(table, &key, &path);
 
-  if (child_max_key > get_node_max_key(right_child)) {
-    /* Substitui o filho direito */
-    *internal_node_child(parent, original_num_keys) = right_child_page_num;
-    *internal_node_key(parent, original_num_keys) = get_node_max_key(right_child);
-    *internal_node_right_child(parent) = child_page_num;
+  uint32_t hint_page_num = statement->hint_page_num;
+  if (hint_page_num == 0) {
+    hint_page_num = __atomic_load_n(&table->rightmost_leaf_page_num, __ATOMIC_RELAXED);
+  }
+  LeafWriteLatch latch;
+  Cursor* cursor = leaf_write_find(table, &latch, hint_page_num, row->id, index_page_num);
+  void* node = get_page(pager, cursor->page_num);
+  void* index_node = get_page(pager, index_page_num);
+
+  bool executed = true;
+  if (cursor_key_equals(cursor, row->id)) {
+    *result = EXECUTE_DUPLICATE_KEY;
   } else {
-    /* Abre espaço para uma nova célula */
-    for (uint32_t i = original_num_keys; i > index; i--) {
-      void* destination = internal_node_cell(parent, i);
-      void* source = internal_node_cell(parent, i - 1);
-      memcpy(destination, source, INTERNAL_NODE_CELL_SIZE);
+    uint8_t record[ROW_SIZE];
+    uint32_t size = serialize_row(row, record);
+    executed = leaf_node_free_space(node) >= LEAF_NODE_SLOT_SIZE + size &&
+               *index_leaf_node_num_cells(index_node) < INDEX_LEAF_NODE_MAX_CELLS;
+    if (executed) {
+      leaf_node_insert_value(node, cursor->cell_num, row->id, record, size);
+      index_leaf_node_insert(index_node, &key);
+      bloom_filter_add(&table->id_filter, bloom_hash_id(row->id));
+      bloom_filter_add(&table->username_filter, bloom_hash_username(row->username));
+      if (*leaf_node_next_leaf(node) == 0) {
+        __atomic_store_n(&table->rightmost_leaf_page_num, cursor->page_num, __ATOMIC_RELAXED);
+      }
+      leaf_write_commit(table, cursor->page_num, index_page_num, row->id, 1);
+      *result = EXECUTE_SUCCESS;
     }
-    *internal_node_child(parent, index) = child_page_num;
-    *internal_node_key(parent, index) = child_max_key;
   }
+  statement->hint_page_num = cursor->page_num;
+  leaf_write_unlatch(table, &latch);
+  free(cursor);
+  return executed;
 }
 
+bool execute_leaf_delete(Statement* statement, Table* table, ExecuteResult* result) {
+  Pager* pager = table->pager;
+  uint32_t id = statement->id_to_delete;
+  *result = EXECUTE_SUCCESS;
+  if (!bloom_filter_may_contain(&table->id_filter, bloom_hash_id(id))) {
+    return true;
+  }
 
-void leaf_node_split_and_insert(Cursor* cursor, uint32_t key, Row* value) {
-/**
-  * Criar um node e move metade das celulas
-  * Insere um novo valor em um dos dois nodes
-  * atualiza o pai ou cria um novo pai
-  */  
-  void* old_node = get_page(cursor->table->pager, cursor->page_num);
-  uint32_t old_max = get_node_max_key(old_node);
-  uint32_t new_page_num = get_unused_page_num(cursor->table->pager);
-  void* new_node = get_page(cursor->table->pager, new_page_num);
-  initialize_leaf_node(new_node);
-  *leaf_node_next_leaf(new_node) = *leaf_node_next_leaf(old_node);
-  *leaf_node_next_leaf(old_node) = new_page_num;
-
-  /**
-   * copia cada celula para seu lugar
-   * todas as chaves existentes mais a nova chave devem ser
-   * divididas igualmente entre nodes velhos (esquerda) e novos (direita)
-   * iniciando pela direita, move cada chave para a posicao correta
-   * 
-  */  
-  for (int32_t i = LEAF_NODE_MAX_CELLS; i >= 0; i--) {
-    void* destination_node;
-    if (i >= LEAF_NODE_LEFT_SPLIT_COUNT) {
-      destination_node = new_node;
-    } else {
-      destination_node = old_node;
+  // a folha do índice depende do username da linha: se ela vier antes na ordem dos
+  // latches, a folha da tabela é solta e as duas são travadas de novo
+  LeafWriteLatch latch;
+  Cursor* cursor;
+  IndexKey key;
+  IndexPath path;
+  uint32_t index_page_num = 0;
+  while (true) {
+    cursor = leaf_write_find(table, &latch, statement->hint_page_num, id, index_page_num);
+    statement->hint_page_num = cursor->page_num;
+    if (!cursor_key_equals(cursor, id)) {
+      __atomic_fetch_add(&table->id_filter.false_positives, 1, __ATOMIC_RELAXED);
+      leaf_write_unlatch(table, &latch);
+      free(cursor);
+      return true;
     }
-    uint32_t index_within_node = i % LEAF_NODE_LEFT_SPLIT_COUNT;
-    void* destination = leaf_node_cell(destination_node, index_within_node);
-
-    if (i == cursor->cell_num) {
-      serialize_row(value, leaf_node_value(destination_node, index_within_node));
-      *leaf_node_key(destination_node, index_within_node) = key;
-    } else if (i > cursor->cell_num) {
-      memcpy(destination, leaf_node_cell(old_node, i - 1), LEAF_NODE_CELL_SIZE);
-    } else {
-      memcpy(destination, leaf_node_cell(old_node, i), LEAF_NODE_CELL_SIZE);
+    Row row;
+    deserialize_row(leaf_node_value(get_page(pager, cursor->page_num), cursor->cell_num), &row);
+    index_key_make(&key, row.username, id);
+    index_page_num = index_find_leaf(table, &key, &path);
+    if (leaf_write_latch_add(table, &latch, index_page_num)) {
+      break;
     }
+    leaf_write_unlatch(table, &latch);
+    free(cursor);
   }
-  // Atualiza a contagem de celulas em cada header de node:
-
-  /* Atualiza a contagem de celulas em ambos os nodes */
-  *(leaf_node_num_cells(old_node)) = LEAF_NODE_LEFT_SPLIT_COUNT;
-  *(leaf_node_num_cells(new_node)) = LEAF_NODE_RIGHT_SPLIT_COUNT;
-
-  /**
-   * Atualizar os parent nodes.
-   * se o nó original for um nó raíz, não tem pai.
-   * Nesse caso, cria um novo nó raíz para ser o pai.
-   */
-
-  if (is_node_root(old_node)) {
-    return create_new_root(cursor->table, new_page_num);
-  } else {
-    uint32_t parent_page_num = *node_parent(old_node);
-    uint32_t new_max = get_node_max_key(old_node);
-    void* parent = get_page(cursor->table->pager, parent_page_num);
-
-    update_internal_node_key(parent, old_max, new_max);
-    internal_node_insert(cursor->table, parent_page_num, new_page_num);
-    return;
-  }
-}
 
-// Adiciona uma entrada ao índice
-void add_to_index(Index* index, uint32_t id, const char* username) {
-  if (index->size >= 1000) { // Limite para evitar problemas
-    printf("Índice está cheio\n");
-    return;
+  void* node = get_page(pager, cursor->page_num);
+  void* index_node = get_page(pager, index_page_num);
+  uint32_t num_cells = *leaf_node_num_cells(node);
+  uint32_t used = leaf_node_used_space(node) - LEAF_NODE_SLOT_SIZE - leaf_node_value_size(node, cursor->cell_num);
+  uint32_t index_num_cells = *index_leaf_node_num_cells(index_node);
+  uint32_t index_cell_num = index_leaf_node_find_exact(index_node, &key);
+  // a maior chave da folha é a separadora no pai, que só muda com o exclusivo
+  bool executed = (is_node_root(node) || (cursor->cell_num < num_cells - 1 && used >= LEAF_NODE_MIN_USED)) &&
+                  (path.depth == 0 || index_num_cells - 1 >= INDEX_LEAF_NODE_MIN_CELLS);
+  if (executed) {
+    if (index_cell_num < index_num_cells) {
+      index_leaf_node_remove(index_node, index_cell_num);
+    }
+    leaf_node_remove_value(node, cursor->cell_num);
+    leaf_write_commit(table, cursor->page_num, index_page_num, id, -1);
   }
-  index->entries[index->size].id = id;
-  strcpy(index->entries[index->size].username, username);
-  index->size++;
+  leaf_write_unlatch(table, &latch);
+  free(cursor);
+  return executed;
 }
 
-
-// Busca no índice por username
-int search_index(Index* index, const char* username) {
-  for (uint32_t i = 0; i < index->size; i++) {
-    if (strcmp(index->entries[i].username, username) == 0) {
-      return index->entries[i].id;
-    }
+// insert ou delete de uma linha pelas folhas; false se ele precisar do latch exclusivo
+bool execute_leaf_write(Statement* statement, Table* table, ExecuteResult* result) {
+  // a primeira alteração depois de os filtros serem salvos marca o cabeçalho, com o exclusivo
+  if (*db_header_bloom_clean(get_page(table->pager, DB_HEADER_PAGE_NUM))) {
+    return false;
   }
-  return -1;
+  if (statement->type == STATEMENT_INSERT) {
+    return execute_leaf_insert(statement, table, result);
+  }
+  return execute_leaf_delete(statement, table, result);
 }
 
-// Função para remover entrada do índice, se necessário (implementação opcional)
-void remove_from_index(Index* index, uint32_t id) {
-  for (uint32_t i = 0; i < index->size; i++) {
-    if (index->entries[i].id == id) {
-      index->entries[i] = index->entries[index->size - 1];
-      index->size--;
-      return;
-    }
+/**
+ * Carga em lote (.import): as linhas do arquivo e as que já estão na tabela ficam em
+ * memória, serializadas, e são ordenadas pelo id só se não vierem em ordem. A árvore
+ * nova é montada de baixo para cima em páginas sequenciais e troca a antiga no fim.
+ */
+typedef struct {
+  uint32_t key;
+  uint32_t size;
+  uint64_t offset; // posição da linha serializada no buffer
+} BulkRow;
+
+typedef struct {
+  BulkRow* rows;
+  uint32_t num_rows;
+  uint32_t capacity;
+  uint8_t* data;
+  uint64_t data_length;
+  uint64_t data_capacity;
+  bool sorted;
+} BulkLoad;
+
+void bulk_load_add(BulkLoad* load, uint32_t key, void* value, uint32_t size) {
+  if (load->num_rows == load->capacity) {
+    load->capacity = load->capacity ? load->capacity * 2 : 1024;
+    load->rows = realloc(load->rows, load->capacity * sizeof(BulkRow));
   }
+  while (load->data_length + size > load->data_capacity) {
+    load->data_capacity = load->data_capacity ? load->data_capacity * 2 : 64 * 1024;
+    load->data = realloc(load->data, load->data_capacity);
+  }
+  if (load->num_rows > 0 && load->rows[load->num_rows - 1].key >= key) {
+    load->sorted = false;
+  }
+  memcpy(load->data + load->data_length, value, size);
+  load->rows[load->num_rows].key = key;
+  load->rows[load->num_rows].size = size;
+  load->rows[load->num_rows].offset = load->data_length;
+  load->num_rows++;
+  load->data_length += size;
 }
 
-void create_index(Table* table, Index* index) {
-    Cursor* cursor = table_start(table);
-    Row row;
+int bulk_row_compare(const void* a, const void* b) {
+  uint32_t key_a = ((BulkRow*)a)->key;
+  uint32_t key_b = ((BulkRow*)b)->key;
+  return key_a < key_b ? -1 : key_a > key_b;
+}
 
-    while (!(cursor->end_of_table)) {
-        deserialize_row(cursor_value(cursor), &row);
-        add_to_index(index, row.id, row.username);
-        cursor_advance(cursor);
-    }
+// id,username,email; valida como o insert
+bool bulk_parse_line(char* line, Row* row) {
+  line[strcspn(line, "\r\n")] = '\0';
+  char* username = strchr(line, ',');
+  if (username == NULL) {
+    return false;
+  }
+  *username++ = '\0';
+  char* email = strchr(username, ',');
+  if (email == NULL) {
+    return false;
+  }
+  *email++ = '\0';
 
-    free(cursor);
+  char* end;
+  errno = 0;
+  unsigned long id = strtoul(line, &end, 10);
+  if (line[0] < '0' || line[0] > '9' || *end != '\0' || errno != 0 || id > UINT32_MAX) {
+    return false;
+  }
+  if (username[0] == '\0' || email[0] == '\0' ||
+      strlen(username) > COLUMN_USERNAME_SIZE || strlen(email) > COLUMN_EMAIL_SIZE) {
+    return false;
+  }
+  row->id = id;
+  strcpy(row->username, username);
+  strcpy(row->email, email);
+  return true;
 }
 
-void leaf_node_delete(Cursor* cursor, uint32_t key) {
-    void* node = get_page(cursor->table->pager, cursor->page_num);
-
-    uint32_t num_cells = *leaf_node_num_cells(node);
-    if (num_cells == 0) {
-        return; // No cells to delete
+/**
+ * Divide as linhas em folhas, enchendo cada uma até fill_factor% do espaço. Se a última
+ * ficar abaixo do mínimo, ela e a anterior dividem as linhas das duas pelo espaço.
+ * Devolve o número de linhas de cada folha.
+ */
+uint32_t* bulk_plan_leaves(BulkLoad* load, uint32_t fill_factor, uint32_t* num_leaves) {
+  uint32_t target = LEAF_NODE_SPACE_FOR_CELLS * fill_factor / 100;
+  uint32_t capacity = 64;
+  uint32_t* counts = malloc(capacity * sizeof(uint32_t));
+  *num_leaves = 0;
+  counts[0] = 0;
+  uint32_t used = 0;
+  for (uint32_t i = 0; i < load->num_rows; i++) {
+    uint32_t cell_size = LEAF_NODE_SLOT_SIZE + load->rows[i].size;
+    if (counts[*num_leaves] > 0 && used + cell_size > target) {
+      if (++(*num_leaves) == capacity) {
+        capacity *= 2;
+        counts = realloc(counts, capacity * sizeof(uint32_t));
+      }
+      counts[*num_leaves] = 0;
+      used = 0;
     }
-
-    // Find the cell containing the key to delete
-    uint32_t i;
-    for (i = 0; i < num_cells; i++) {
-        if (*leaf_node_key(node, i) == key) {
-            break;
-        }
+    counts[*num_leaves]++;
+    used += cell_size;
+  }
+  (*num_leaves)++;
+
+  if (*num_leaves > 1 && used < LEAF_NODE_MIN_USED) {
+    uint32_t last = *num_leaves - 1;
+    uint32_t first_row = load->num_rows - counts[last] - counts[last - 1];
+    uint32_t total = 0;
+    for (uint32_t i = first_row; i < load->num_rows; i++) {
+      total += LEAF_NODE_SLOT_SIZE + load->rows[i].size;
     }
-
-    if (i == num_cells) {
-        return; // Key not found
+    uint32_t left = 0;
+    uint32_t left_count = 0;
+    while (left + LEAF_NODE_SLOT_SIZE + load->rows[first_row + left_count].size <= total / 2) {
+      left += LEAF_NODE_SLOT_SIZE + load->rows[first_row + left_count].size;
+      left_count++;
     }
+    counts[last] += counts[last - 1] - left_count;
+    counts[last - 1] = left_count;
+  }
+  return counts;
+}
 
-    // Remove the cell by shifting cells over
-    for (uint32_t j = i; j < num_cells - 1; j++) {
-        memcpy(leaf_node_cell(node, j), leaf_node_cell(node, j + 1), LEAF_NODE_CELL_SIZE);
+// devolve as páginas da árvore antiga para a lista de livres, os filhos antes dos pais
+void table_free_tree(Pager* pager, uint32_t page_num) {
+  void* node = get_page(pager, page_num);
+  if (get_node_type(node) == NODE_INTERNAL) {
+    uint32_t num_keys = *internal_node_num_keys(node);
+    for (uint32_t i = 0; i <= num_keys; i++) {
+      table_free_tree(pager, *internal_node_child(get_page(pager, page_num), i));
     }
+  }
+  free_page(pager, page_num);
+  bulk_load_flush(pager);
+}
 
-    (*leaf_node_num_cells(node))--;
-
-    // Handle underflow if needed
-    if (*leaf_node_num_cells(node) == 0 && cursor->page_num == cursor->table->root_page_num) {
-        // If the root node is empty, free it
-        void* root_node = get_page(cursor->table->pager, cursor->table->root_page_num);
-        free(root_node);
-        cursor->table->root_page_num = 0;
-        initialize_leaf_node(root_node);
-        set_node_root(root_node, true);
+void index_free_tree(Pager* pager, uint32_t page_num) {
+  void* node = get_page(pager, page_num);
+  if (*index_node_type(node) == INDEX_NODE_INTERNAL) {
+    uint32_t num_keys = *index_internal_node_num_keys(node);
+    for (uint32_t i = 0; i <= num_keys; i++) {
+      index_free_tree(pager, *index_internal_node_child(get_page(pager, page_num), i));
     }
+  }
+  free_page(pager, page_num);
+  bulk_load_flush(pager);
 }
 
-ExecuteResult execute_insert_with_index(Statement* statement, Table* table) {
-  Row* row_to_insert = &(statement->row_to_insert);
-  uint32_t key_to_insert = row_to_insert->id;
-  Cursor* cursor = table_find(table, key_to_insert);
+// refaz o índice e os filtros de Bloom do zero; o índice antigo é liberado depois da troca
+void table_reindex(Table* table) {
+  uint32_t old_index_root_page_num = table->index_root_page_num;
+  bloom_filters_touch(table);
+  index_build(table);
+  index_free_tree(table->pager, old_index_root_page_num);
+  bloom_filters_rebuild(table);
+  pager_commit(table->pager);
+}
 
-  void* node = get_page(table->pager, cursor->page_num);
-  uint32_t num_cells = *leaf_node_num_cells(node);
+// monta a tabela com as linhas já ordenadas e devolve a página da raíz
+uint32_t table_bulk_build(Pager* pager, BulkLoad* load, uint32_t fill_factor) {
+  uint32_t num_leaves;
+  uint32_t* counts = bulk_plan_leaves(load, fill_factor, &num_leaves);
+
+  // as páginas de todos os níveis são conhecidas antes de gravar, então cada nó já
+  // nasce com o ponteiro para o pai
+  uint32_t per_node = bulk_children_per_node(INTERNAL_NODE_MAX_CELLS, fill_factor);
+  uint32_t level_first[32];
+  uint32_t level_count[32];
+  uint32_t top = 0;
+  level_first[0] = pager->num_pages;
+  level_count[0] = num_leaves;
+  while (level_count[top] > 1) {
+    level_count[top + 1] = bulk_node_count(level_count[top], per_node, INTERNAL_NODE_MIN_KEYS + 1);
+    level_first[top + 1] = level_first[top] + level_count[top];
+    top++;
+  }
 
-  if (cursor->cell_num < num_cells) {
-    uint32_t key_at_index = *leaf_node_key(node, cursor->cell_num);
-    if (key_at_index == key_to_insert) {
-      return EXECUTE_DUPLICATE_KEY;
+  uint32_t* max_keys = malloc(num_leaves * sizeof(uint32_t));
+  uint32_t* row_counts = malloc(num_leaves * sizeof(uint32_t)); // linhas abaixo de cada nó do nível
+  uint32_t row = 0;
+  for (uint32_t j = 0; j < num_leaves; j++) {
+    uint32_t page_num = level_first[0] + j;
+    void* node = get_page(pager, page_num);
+    initialize_leaf_node(node);
+    set_node_root(node, top == 0);
+    *node_parent(node) = top == 0 ? 0 : level_first[1] + bulk_node_of(j, num_leaves, level_count[1]);
+    *leaf_node_next_leaf(node) = j + 1 < num_leaves ? page_num + 1 : 0;
+    for (uint32_t i = 0; i < counts[j]; i++, row++) {
+      BulkRow* bulk_row = &load->rows[row];
+      leaf_node_insert_value(node, i, bulk_row->key, load->data + bulk_row->offset, bulk_row->size);
+      max_keys[j] = bulk_row->key;
     }
+    row_counts[j] = counts[j];
+    pager_mark_dirty(pager, page_num);
+    bulk_load_flush(pager);
   }
 
-  leaf_node_insert(cursor, row_to_insert->id, row_to_insert);
-  add_to_index(username_index, row_to_insert->id, row_to_insert->username);
-
-  free(cursor);
+  for (uint32_t level = 1; level <= top; level++) {
+    uint32_t start = 0;
+    for (uint32_t j = 0; j < level_count[level]; j++) {
+      uint32_t count = bulk_node_size(j, level_count[level - 1], level_count[level]);
+      uint32_t page_num = level_first[level] + j;
+      void* node = get_page(pager, page_num);
+      initialize_internal_node(node);
+      set_node_root(node, level == top);
+      *node_parent(node) = level == top ? 0
+          : level_first[level + 1] + bulk_node_of(j, level_count[level], level_count[level + 1]);
+      *internal_node_num_keys(node) = count - 1;
+      uint32_t node_rows = 0;
+      for (uint32_t i = 0; i < count; i++) {
+        *internal_node_child(node, i) = level_first[level - 1] + start + i;
+        *internal_node_count(node, i) = row_counts[start + i];
+        if (i < count - 1) {
+          *internal_node_key(node, i) = max_keys[start + i];
+        }
+        node_rows += row_counts[start + i];
+      }
+      pager_mark_dirty(pager, page_num);
+      max_keys[j] = max_keys[start + count - 1];
+      row_counts[j] = node_rows;
+      start += count;
+      bulk_load_flush(pager);
+    }
+  }
 
-  return EXECUTE_SUCCESS;
+  free(max_keys);
+  free(row_counts);
+  free(counts);
+  return level_first[top];
 }
 
-ExecuteResult execute_insert(Statement* statement, Table* table) {
-  Row* row_to_insert = &(statement->row_to_insert);
-  uint32_t key_to_insert = row_to_insert->id;
-  Cursor* cursor = table_find(table, key_to_insert);
-
-  void* node = get_page(table->pager, cursor->page_num);
-  uint32_t num_cells = *leaf_node_num_cells(node);
+// lê o arquivo; devolve false, sem alterar nada, se alguma linha for inválida
+bool bulk_load_read_file(BulkLoad* load, const char* filename) {
+  FILE* file = fopen(filename, "r");
+  if (file == NULL) {
+    printf("Não foi possível abrir o arquivo '%s'.\n", filename);
+    return false;
+  }
 
-  if (cursor->cell_num < num_cells) {
-    uint32_t key_at_index = *leaf_node_key(node, cursor->cell_num);
-    if (key_at_index == key_to_insert) {
-      return EXECUTE_DUPLICATE_KEY;
+  char line[COLUMN_USERNAME_SIZE + COLUMN_EMAIL_SIZE + 32];
+  uint8_t record[ROW_SIZE];
+  Row row;
+  uint32_t line_num = 0;
+  bool ok = true;
+  while (fgets(line, sizeof(line), file)) {
+    line_num++;
+    if (line_num == 1 && strncmp(line, "id,", 3) == 0) {
+      continue; // cabeçalho
     }
+    if (line[0] == '\n' || (line[0] == '\r' && line[1] == '\n')) {
+      continue;
+    }
+    if (strchr(line, '\n') == NULL && !feof(file)) {
+      printf("Linha %d inválida em '%s'.\n", line_num, filename);
+      ok = false;
+      break;
+    }
+    if (!bulk_parse_line(line, &row)) {
+      printf("Linha %d inválida em '%s'.\n", line_num, filename);
+      ok = false;
+      break;
+    }
+    uint32_t size = serialize_row(&row, record);
+    bulk_load_add(load, row.id, record, size);
   }
-
-  leaf_node_insert(cursor, row_to_insert->id, row_to_insert);
-
-  free(cursor);
-
-  return EXECUTE_SUCCESS;
+  fclose(file);
+  return ok;
 }
 
-// operação de select
-ExecuteResult execute_select(Statement* statement, Table* table) {
+void table_bulk_load(Table* table, const char* filename, uint32_t fill_factor) {
+  Pager* pager = table->pager;
+  BulkLoad load = {0};
+  load.sorted = true;
+
+  // as linhas que já estão na tabela entram primeiro, já em ordem
   Cursor* cursor = table_start(table);
-  Row row;
   while (!(cursor->end_of_table)) {
-    deserialize_row(cursor_value(cursor), &row);
-    print_row(&row);
+    void* node = get_page(pager, cursor->page_num);
+    bulk_load_add(&load, *leaf_node_key(node, cursor->cell_num),
+                  leaf_node_value(node, cursor->cell_num), leaf_node_value_size(node, cursor->cell_num));
     cursor_advance(cursor);
+    pager_release(pager);
   }
-
   free(cursor);
+  uint32_t num_existing = load.num_rows;
 
-  return EXECUTE_SUCCESS;
-}
+  bool ok = bulk_load_read_file(&load, filename);
+  if (ok && !load.sorted) {
+    qsort(load.rows, load.num_rows, sizeof(BulkRow), bulk_row_compare);
+  }
+  for (uint32_t i = 1; ok && i < load.num_rows; i++) {
+    if (load.rows[i].key == load.rows[i - 1].key) {
+      printf("Erro: Chave duplicada %d.\n", load.rows[i].key);
+      ok = false;
+    }
+  }
+  if (!ok) {
+    free(load.rows);
+    free(load.data);
+    return;
+  }
 
-ExecuteResult execute_delete(Statement* statement, Table* table) {
-    Cursor* cursor = table_find(table, statement->id_to_delete);
+  bloom_filters_touch(table);
+  uint32_t old_root_page_num = table->root_page_num;
+  uint32_t old_index_root_page_num = table->index_root_page_num;
 
-    void* node = get_page(cursor->table->pager, cursor->page_num);
-    uint32_t num_cells = *leaf_node_num_cells(node);
+  uint32_t root_page_num = table_bulk_build(pager, &load, fill_factor);
 
-    if (cursor->cell_num < num_cells) {
-        uint32_t key_at_index = *leaf_node_key(node, cursor->cell_num);
-        if (key_at_index == statement->id_to_delete) {
-            leaf_node_delete(cursor, statement->id_to_delete);
-            free(cursor);
-            return EXECUTE_SUCCESS;
-        }
-    }
+  // as chaves do índice e os filtros saem da mesma passada pelas linhas
+  IndexKey* keys = malloc((size_t)load.num_rows * INDEX_KEY_SIZE);
+  bloom_filter_init(&table->id_filter, 2 * load.num_rows);
+  bloom_filter_init(&table->username_filter, 2 * load.num_rows);
+  for (uint32_t i = 0; i < load.num_rows; i++) {
+    index_key_from_record(&keys[i], load.data + load.rows[i].offset);
+    bloom_filter_add(&table->id_filter, bloom_hash_id(keys[i].id));
+    bloom_filter_add(&table->username_filter, bloom_hash_username(keys[i].username));
+  }
+  qsort(keys, load.num_rows, INDEX_KEY_SIZE, index_key_qsort_compare);
+  uint32_t index_root_page_num = index_bulk_load(pager, keys, load.num_rows, fill_factor);
+  free(keys);
+
+  // a troca das raízes é um único commit; só depois as árvores antigas são liberadas
+  table->root_page_num = root_page_num;
+  *db_header_root_page(get_page(pager, DB_HEADER_PAGE_NUM)) = root_page_num;
+  index_set_root(table, index_root_page_num);
+  pager_commit(pager);
+  table_free_tree(pager, old_root_page_num);
+  index_free_tree(pager, old_index_root_page_num);
+  pager_commit(pager);
+
+  printf("%d linhas importadas.\n", load.num_rows - num_existing);
+  free(load.rows);
+  free(load.data);
+}
 
-    free(cursor);
-    return EXECUTE_SUCCESS; // Se a chave não for encontrada, ainda consideramos a operação bem-sucedida
+/**
+ * Desfaz a transação: as páginas alteradas voltam à última versão efetivada, lida do
+ * WAL ou do banco, e as páginas novas deixam de existir. As raízes são relidas do
+ * cabeçalho. Os filtros de Bloom ficam com os ids desfeitos, o que só custa falsos
+ * positivos; se foram reconstruídos durante a transação, são reconstruídos de novo.
+ */
+void table_rollback(Table* table) {
+  Pager* pager = table->pager;
+  pager_rollback(pager, table->transaction_num_pages);
+  void* header = get_page(pager, DB_HEADER_PAGE_NUM);
+  table->root_page_num = *db_header_root_page(header);
+  table->index_root_page_num = *db_header_index_root(header);
+  table->rightmost_leaf_page_num = 0;
+  table->in_transaction = false;
+  if (table->transaction_bloom_rebuilt) {
+    bloom_filters_rebuild(table);
+  }
 }
 
 // maquina virtual
 ExecuteResult execute_statement(Statement* statement, Table* table) {
+  ExecuteResult result = EXECUTE_SUCCESS;
   switch (statement->type) {
     case (STATEMENT_INSERT):
-      return execute_insert_with_index(statement, table);
+      bloom_filters_touch(table);
+      result = execute_insert_with_index(statement, table);
+      break;
     case (STATEMENT_SELECT):
-      return execute_select(statement, table);
+    case (STATEMENT_SELECT_BY_ID):
+    case (STATEMENT_SELECT_BY_USERNAME):
+    case (STATEMENT_SELECT_BY_FILTER):
+    case (STATEMENT_SELECT_COUNT):
+      // os selects devolvem uma linha por passo em rql_step
+      break;
     case (STATEMENT_DELETE):
-      return execute_delete(statement, table);
+      bloom_filters_touch(table);
+      result = execute_delete(statement, table);
+      break;
+    case (STATEMENT_INSERT_ROWS):
+      bloom_filters_touch(table);
+      result = execute_insert_rows(statement, table);
+      break;
+    case (STATEMENT_BEGIN):
+      if (table->in_transaction) {
+        return EXECUTE_TRANSACTION_ACTIVE;
+      }
+      table->in_transaction = true;
+      table->transaction_num_pages = table->pager->num_pages;
+      table->transaction_bloom_rebuilt = false;
+      break;
+    case (STATEMENT_COMMIT):
+      if (!table->in_transaction) {
+        return EXECUTE_NO_TRANSACTION;
+      }
+      table->in_transaction = false;
+      break;
+    case (STATEMENT_ROLLBACK):
+      if (!table->in_transaction) {
+        return EXECUTE_NO_TRANSACTION;
+      }
+      table_rollback(table);
+      break;
   }
+
+  // fora de um begin cada comando é uma transação: as páginas alteradas vão para o WAL
+  if (!table->in_transaction) {
+    pager_commit(table->pager);
+  }
+  return result;
 }
 
-Pager* pager_open(const char* filename){
+Pager* pager_open(const char* filename, uint32_t cache_pages, uint32_t flags) {
   int fd = open(filename, O_RDWR | // leitura e escrita
                           O_CREAT, // criar arquivo se nao existir
                           S_IWUSR | // permissao de escrita do usuario
@@ -1189,134 +6492,464 @@ Pager* pager_open(const char* filename){
     exit(EXIT_FAILURE);
   }
 
+  // o formato é escolhido na criação; depois é reconhecido pelo superbloco
   off_t file_length = lseek(fd, 0, SEEK_END);
+  CompressedFile* compressed = NULL;
+  if ((file_length == 0 && (flags & DB_OPEN_COMPRESS)) || compressed_file_detect(fd)) {
+    if (flags & DB_OPEN_MMAP) {
+      printf("O modo mmap não funciona com páginas comprimidas.\n");
+      exit(EXIT_FAILURE);
+    }
+    compressed = compressed_file_open(fd);
+  }
+
+  // a recuperação do WAL pode aumentar o arquivo, então vem antes de medir o tamanho
+  Wal* wal = wal_open(filename, fd, compressed);
+  file_length = lseek(fd, 0, SEEK_END);
 
   Pager* pager = malloc(sizeof(Pager));
   pager->file_descriptor = fd;
+  pager->wal = wal;
+  pager->compressed = compressed;
   pager->file_length = file_length;
   pager->num_pages = (file_length / PAGE_SIZE);
 
-  if (file_length % PAGE_SIZE != 0) {
+  if (compressed) {
+    pager->num_pages = compressed->num_pages;
+  } else if (file_length % PAGE_SIZE != 0) {
     printf("O arquivo de banco de dados está corrompido.\n");
     exit(EXIT_FAILURE);
   }
 
-  for (uint32_t i = 0; i < TABLE_MAX_PAGES; i++) {
-    pager->pages[i] = NULL;
+  if (cache_pages == 0) {
+    cache_pages = PAGER_DEFAULT_CACHE_PAGES;
+  }
+  pthread_mutex_init(&pager->lock, NULL);
+  pager->frame_chunks = calloc(PAGER_MAX_FRAME_CHUNKS, sizeof(Frame*));
+  pager->num_frames = 0;
+  pager->max_frames = cache_pages;
+  pager->clock_hand = 0;
+  pager->page_table = calloc(PAGE_TABLE_CHUNK_SIZE, sizeof(uint32_t*));
+  pager->cache_hits = 0;
+  pager->cache_misses = 0;
+  pager->cache_evictions = 0;
+  pager->pages_written = 0;
+  pager->use_mmap = flags & DB_OPEN_MMAP;
+  pager->map = NULL;
+  pager->mapped_pages = 0;
+  pager->dirty_pages = NULL;
+  pager->dirty_pages_capacity = 0;
+  pager->dirty_list = NULL;
+  pager->num_dirty = 0;
+  pager->dirty_capacity = 0;
+
+  if (pager->use_mmap) {
+    // reserva o espaço de endereçamento; o arquivo é mapeado sobre ele sob demanda
+    pager->map = mmap(NULL, PAGER_MMAP_RESERVE, PROT_NONE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (pager->map == MAP_FAILED) {
+      printf("Erro ao reservar memória para o mmap: %d\n", errno);
+      exit(EXIT_FAILURE);
+    }
   }
 
   return pager;
 }
 
-Table* db_open(const char* filename) {
-  Pager* pager = pager_open(filename);
+/**
+ * Abre o banco de dados com um buffer pool de até cache_pages páginas
+ * (0 usa PAGER_DEFAULT_CACHE_PAGES). flags aceita DB_OPEN_MMAP para trocar o
+ * buffer pool pelo mapeamento do arquivo e DB_OPEN_COMPRESS para criar um banco
+ * novo com as páginas comprimidas.
+ */
+Table* rql_open(const char* filename, uint32_t cache_pages, uint32_t flags) {
+  Pager* pager = pager_open(filename, cache_pages, flags);
 
   Table* table = malloc(sizeof(Table));
   table->pager = pager;
-  table->root_page_num = 0;
+  table->version = 0;
+  table->writers_waiting = 0;
+  // com preferência para o escritor, um fluxo contínuo de selects não o deixa esperando para sempre
+  pthread_rwlockattr_t latch_attributes;
+  pthread_rwlockattr_init(&latch_attributes);
+  pthread_rwlockattr_setkind_np(&latch_attributes, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+  pthread_rwlock_init(&table->latch, &latch_attributes);
+  table->page_latches = calloc(PAGE_LATCH_STRIPES, sizeof(PageLatch));
+  for (uint32_t i = 0; i < PAGE_LATCH_STRIPES; i++) {
+    pthread_rwlock_init(&table->page_latches[i].lock, &latch_attributes);
+  }
+  pthread_rwlockattr_destroy(&latch_attributes);
+  pthread_mutex_init(&table->counts_lock, NULL);
+  table->counts_pending = NULL;
+  table->num_counts_pending = table->counts_pending_capacity = 0;
+  table->counts_pending_pages = NULL;
+  table->counts_pending_pages_capacity = 0;
+  long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  table->scan_threads = num_cpus < 1 ? 1 : num_cpus > SCAN_DEFAULT_MAX_THREADS ? SCAN_DEFAULT_MAX_THREADS : num_cpus;
+  table->filter_kernels = filter_kernels_best();
 
   if (pager->num_pages == 0) {
-    // banco de dados zerado, página 0 será o leaf node
-    void* root_node = get_page(pager, 0);
+    // banco de dados zerado: página 0 é o cabeçalho e a página 1 será o leaf node raíz
+    void* header = get_page(pager, DB_HEADER_PAGE_NUM);
+    *db_header_magic(header) = DB_HEADER_MAGIC;
+    *db_header_root_page(header) = 1;
+    *db_header_free_head(header) = 0;
+    *db_header_free_count(header) = 0;
+    pager_mark_dirty(pager, DB_HEADER_PAGE_NUM);
+
+    void* root_node = get_page(pager, 1);
     initialize_leaf_node(root_node);
     set_node_root(root_node, true);
+    pager_mark_dirty(pager, 1);
+    pager_commit(pager);
+  }
+
+  void* header = get_page(pager, DB_HEADER_PAGE_NUM);
+  if (*db_header_magic(header) != DB_HEADER_MAGIC) {
+    printf("O arquivo não é um banco de dados rql.\n");
+    exit(EXIT_FAILURE);
+  }
+  table->root_page_num = *db_header_root_page(header);
+  table->index_root_page_num = *db_header_index_root(header);
+  table->rightmost_leaf_page_num = 0;
+  table->in_transaction = false;
+  if (table->index_root_page_num == 0) {
+    // banco novo ou de uma versão sem o índice no arquivo
+    index_build(table);
   }
+  // a marca dos filtros só fica zerada se o processo caiu depois de alterar a tabela; o
+  // index_build solta as páginas, então o header é lido de novo
+  if (!*db_header_bloom_clean(get_page(pager, DB_HEADER_PAGE_NUM))) {
+    table_counts_rebuild(table);
+  }
+  memset(&table->id_filter, 0, sizeof(BloomFilter));
+  memset(&table->username_filter, 0, sizeof(BloomFilter));
+  bloom_filters_open(table);
+  pager_release(pager);
 
   return table;
 }
 
 
+PrepareResult rql_prepare(Table* table, const char* sql, PreparedStatement** statement) {
+  // as funções de prepare usam strtok, que altera o texto
+  char* text = strdup(sql);
+  PreparedStatement* prepared = calloc(1, sizeof(PreparedStatement));
+  PrepareResult result = prepare_statement(text, &prepared->statement);
+  free(text);
+  if (result != PREPARE_SUCCESS) {
+    statement_free(&prepared->statement);
+    free(prepared);
+    return result;
+  }
+
+  prepared->table = table;
+  *statement = prepared;
+  return PREPARE_SUCCESS;
+}
 
-// Função para executar uma seleção de registro baseado no username
-ExecuteResult execute_select_by_username(Table* table, const char* username) {
-  // Busca o ID correspondente ao username no índice
-  int id = search_index(username_index, username);
-  
-  // Se o ID não for encontrado, informa que o registro não foi encontrado
-  if (id == -1) {
-    printf("Registro não encontrado.\n");
+void table_unlatch_shared(Table* table, TableLatch* latch) {
+  if (--latch->readers == 0) {
+    leaf_unlatch(table, latch);
+    pthread_rwlock_unlock(&table->latch);
+  }
+}
+
+void prepared_unlatch(PreparedStatement* prepared) {
+  TableLatch* latch = table_latch(prepared->table);
+  if (latch->leaf_owner == prepared) {
+    leaf_unlatch(prepared->table, latch);
+  }
+  if (!prepared->latched) {
+    return;
+  }
+  prepared->latched = false;
+  // com o epoch diferente o latch já foi solto por um comando de escrita do thread
+  if (latch->epoch == prepared->latch_epoch) {
+    table_unlatch_shared(prepared->table, latch);
+  }
+}
+
+bool statement_parameters_bound(Statement* statement) {
+  for (uint32_t i = 0; i < statement->num_parameters; i++) {
+    if (!statement->parameters[i].bound) {
+      return false;
+    }
+  }
+  return true;
+}
+
+ExecuteResult rql_step(PreparedStatement* prepared) {
+  Table* table = prepared->table;
+  // cada passo fixa as páginas que usa; libera as do passo anterior
+  pager_release(table->pager);
+  table_unlatch_others(table);
+  TableLatch* latch = table_latch(table);
+  // a folha da linha corrente fica travada para o select que a devolveu até o passo
+  // seguinte dele; um passo de outro comando do thread, ou um escritor esperando, a solta
+  if (latch->leaf_latched &&
+      (latch->leaf_owner != prepared ||
+       __atomic_load_n(&table->page_latches[latch->leaf_stripe].writers_waiting, __ATOMIC_RELAXED) > 0)) {
+    leaf_unlatch(table, latch);
+  }
+  // o select segura o latch da linha corrente até o passo seguinte, e só o solta
+  // entre os passos se houver um escritor esperando
+  if (prepared->latched && (latch->epoch != prepared->latch_epoch ||
+                            __atomic_load_n(&table->writers_waiting, __ATOMIC_RELAXED) > 0)) {
+    prepared_unlatch(prepared);
+  }
+  if (prepared->done) {
     return EXECUTE_SUCCESS;
   }
+  if (!prepared->started && !statement_parameters_bound(&prepared->statement)) {
+    return EXECUTE_MISSING_PARAMETER;
+  }
 
-  // Cria um cursor para encontrar a linha na tabela pelo ID
-  Cursor* cursor = table_find(table, id);
-  
-  // Declara uma estrutura Row para armazenar a linha desserializada
-  Row row;
-  
-  // Desserializa a linha da tabela usando o cursor
-  deserialize_row(cursor_value(cursor), &row);
-  
-  // Imprime a linha encontrada
-  print_row(&row);
+  ExecuteResult result;
+  switch (prepared->statement.type) {
+    case (STATEMENT_SELECT):
+    case (STATEMENT_SELECT_BY_ID):
+    case (STATEMENT_SELECT_BY_USERNAME):
+      if (!prepared->latched) {
+        prepared->latched = table_latch_shared(table, latch);
+        prepared->latch_epoch = latch->epoch;
+      }
+      // com o exclusivo de uma transação do próprio thread nada muda sem ele saber
+      prepared->leaf_kept = latch->exclusive || (latch->leaf_latched && latch->leaf_owner == prepared);
+      thread_state()->reading = prepared->latched ? latch : NULL;
+      result = select_step(prepared);
+      thread_state()->reading = NULL;
+      if (latch->leaf_latched) {
+        latch->leaf_owner = prepared;
+      }
+      if (result != EXECUTE_ROW) {
+        prepared_unlatch(prepared);
+      }
+      return result;
+    case (STATEMENT_SELECT_COUNT): {
+      // uma linha só: o primeiro passo conta e o seguinte termina
+      if (prepared->started) {
+        select_finish(prepared);
+        return EXECUTE_SUCCESS;
+      }
+      prepared->started = true;
+      bool latched = table_latch_shared(table, latch);
+      thread_state()->reading = latched ? latch : NULL;
+      prepared->count = table_count_range(table, prepared->statement.id_range_start,
+                                          prepared->statement.id_range_end);
+      thread_state()->reading = NULL;
+      if (latched) {
+        table_unlatch_shared(table, latch);
+      }
+      prepared->num_rows++;
+      return EXECUTE_ROW;
+    }
+    case (STATEMENT_SELECT_BY_FILTER): {
+      // só o primeiro passo lê a tabela; os seguintes devolvem as cópias, sem latches
+      if (!prepared->started) {
+        prepared->started = true;
+        bool latched = table_latch_shared(table, latch);
+        select_filter_scan(prepared);
+        if (latched) {
+          table_unlatch_shared(table, latch);
+        }
+      }
+      void* record = select_filter_next(prepared);
+      if (record == NULL) {
+        select_finish(prepared);
+        return EXECUTE_SUCCESS;
+      }
+      prepared->record = record;
+      memcpy(&prepared->last_id, record + ID_OFFSET, ID_SIZE);
+      prepared->num_rows++;
+      return EXECUTE_ROW;
+    }
+    default:
+      prepared->done = true;
+      // insert ou delete de uma linha: primeiro só com os latches das folhas
+      if ((prepared->statement.type == STATEMENT_INSERT || prepared->statement.type == STATEMENT_DELETE) &&
+          table_latch_shared(table, latch)) {
+        bool executed = execute_leaf_write(&prepared->statement, table, &result);
+        table_unlatch_shared(table, latch);
+        if (executed) {
+          return result;
+        }
+      }
+      table_latch_exclusive(table, latch);
+      result = execute_statement(&prepared->statement, table);
+      table_unlatch_exclusive(table, latch);
+      return result;
+  }
+}
 
-  // Libera a memória alocada para o cursor
-  free(cursor);
+StatementType rql_statement_type(PreparedStatement* prepared) {
+  return prepared->statement.type;
+}
 
-  // Retorna sucesso na execução da seleção
-  return EXECUTE_SUCCESS;
+// byte com o tamanho do texto da coluna, dentro da linha serializada
+uint8_t* record_column_length(void* record, Column column) {
+  uint8_t* username_length = record + USERNAME_OFFSET;
+  if (column == COLUMN_USERNAME) {
+    return username_length;
+  }
+  return username_length + COLUMN_LENGTH_SIZE + *username_length;
 }
 
+uint32_t rql_column_int(PreparedStatement* prepared, Column column) {
+  if (prepared->statement.type == STATEMENT_SELECT_COUNT) {
+    return prepared->count;
+  }
+  if (column != COLUMN_ID) {
+    return 0;
+  }
+  uint32_t id;
+  memcpy(&id, prepared->record + ID_OFFSET, ID_SIZE);
+  return id;
+}
 
-int main(int argc, char* argv[]) {
-  if (argc < 2) {
-    printf("Necessário informar o nome do banco de dados.\n");
-    exit(EXIT_FAILURE);
+const char* rql_column_text(PreparedStatement* prepared, Column column) {
+  if (column == COLUMN_ID || prepared->statement.type == STATEMENT_SELECT_COUNT) {
+    return NULL;
   }
+  return (const char*)record_column_length(prepared->record, column) + COLUMN_LENGTH_SIZE;
+}
 
-  char* filename = argv[1];
-  Table* table = db_open(filename);
-  username_index = initialize_index();
+uint32_t rql_column_bytes(PreparedStatement* prepared, Column column) {
+  if (column == COLUMN_ID || prepared->statement.type == STATEMENT_SELECT_COUNT) {
+    return 0;
+  }
+  return *record_column_length(prepared->record, column);
+}
 
-  create_index(table, username_index);
+uint32_t rql_parameter_count(PreparedStatement* prepared) {
+  return prepared->statement.num_parameters;
+}
 
+// parâmetro na posição index, contada a partir de 1; NULL se não existir
+StatementParameter* statement_parameter(Statement* statement, uint32_t index) {
+  if (index == 0 || index > statement->num_parameters) {
+    return NULL;
+  }
+  return &statement->parameters[index - 1];
+}
 
-  InputBuffer* input_buffer = new_input_buffer();
-  while (true) {
-    print_prompt();
-    read_input(input_buffer);
-
-    if (input_buffer->buffer[0] == '.') {
-      switch (do_meta_command(input_buffer, table)) {
-        case (META_COMMAND_SUCCESS):
-          continue;
-        case (META_COMMAND_UNRECOGNIZED_COMMAND):
-          printf("Comando não reconhecido '%s'\n", input_buffer->buffer);
-          continue;
-      }
-    }
+ParameterType parameter_target_type(ParameterTarget target) {
+  switch (target) {
+    case (PARAMETER_ROW_USERNAME):
+    case (PARAMETER_ROW_EMAIL):
+    case (PARAMETER_FIND_USERNAME):
+    case (PARAMETER_FILTER_PATTERN):
+      return PARAMETER_TEXT;
+    default:
+      return PARAMETER_INT;
+  }
+}
 
-    Statement statement;
-    switch (prepare_statement(input_buffer, &statement)) {
-      case (PREPARE_SUCCESS):
-        break;
-      case (PREPARE_SYNTAX_ERROR):
-        printf("Erro de sintaxe. Não foi possível interpretar a operação '%s'.\n", input_buffer->buffer);
-        continue;
-      case (PREPARE_STRING_TOO_LONG):
-        printf("String ultrapassa o tamanho máximo para o campo.\n");
-        continue;
-      case (PREPARE_UNRECOGNIZED_STATEMENT):
-        printf("Palavra chave não reconhecida '%s'.\n", input_buffer->buffer);
-        continue;
-      case (PREPARE_NEGATIVE_ID):
-        printf("ID tem que ser um inteiro positivo.\n");
-        continue;
-    }
+ParameterType rql_parameter_type(PreparedStatement* prepared, uint32_t index) {
+  StatementParameter* parameter = statement_parameter(&prepared->statement, index);
+  return parameter == NULL ? PARAMETER_INT : parameter_target_type(parameter->target);
+}
 
-    switch (execute_statement(&statement, table)) {
-      case (EXECUTE_SUCCESS):
-        printf("Executado.\n");
-        break;
-      case (EXECUTE_DUPLICATE_KEY):
-        printf("Erro: Chave duplicada.\n");
-        break;
-      case (EXECUTE_TABLE_FULL):
-        printf("Erro: A tabela está cheia.\n");
-        break;
+Row* parameter_row(Statement* statement, StatementParameter* parameter) {
+  if (parameter->row == PARAMETER_SINGLE_ROW) {
+    return &statement->row_to_insert;
+  }
+  return &statement->rows_to_insert[parameter->row];
+}
 
-      default:
-        break;
-    }
+void rql_reset(PreparedStatement* prepared) {
+  pager_release(prepared->table->pager);
+  prepared_unlatch(prepared);
+  free(prepared->cursor);
+  prepared->cursor = NULL;
+  filter_result_free(prepared);
+  prepared->started = false;
+  prepared->done = false;
+  prepared->num_rows = 0;
+  prepared->record = NULL;
+}
+
+PrepareResult rql_bind_int(PreparedStatement* prepared, uint32_t index, uint32_t value) {
+  Statement* statement = &prepared->statement;
+  StatementParameter* parameter = statement_parameter(statement, index);
+  if (parameter == NULL || parameter_target_type(parameter->target) != PARAMETER_INT) {
+    return PREPARE_INVALID_PARAMETER;
+  }
+
+  rql_reset(prepared);
+  switch (parameter->target) {
+    case (PARAMETER_ROW_ID):
+      parameter_row(statement, parameter)->id = value;
+      break;
+    case (PARAMETER_DELETE_ID):
+      statement->id_to_delete = value;
+      break;
+    case (PARAMETER_SELECT_ID):
+      statement->id_range_start = value;
+      statement->id_range_end = value;
+      break;
+    case (PARAMETER_RANGE_START):
+      statement->id_range_start = value;
+      break;
+    case (PARAMETER_RANGE_END):
+      statement->id_range_end = value;
+      break;
+    case (PARAMETER_LIMIT):
+      statement->limit = value;
+      break;
+    case (PARAMETER_OFFSET):
+      statement->offset = value;
+      break;
+    default:
+      break;
+  }
+  parameter->bound = true;
+  return PREPARE_SUCCESS;
+}
+
+PrepareResult rql_bind_text(PreparedStatement* prepared, uint32_t index, const char* text, uint32_t length) {
+  Statement* statement = &prepared->statement;
+  StatementParameter* parameter = statement_parameter(statement, index);
+  if (parameter == NULL || parameter_target_type(parameter->target) != PARAMETER_TEXT) {
+    return PREPARE_INVALID_PARAMETER;
+  }
+
+  char* destination;
+  uint32_t capacity;
+  switch (parameter->target) {
+    case (PARAMETER_ROW_USERNAME):
+      destination = parameter_row(statement, parameter)->username;
+      capacity = COLUMN_USERNAME_SIZE;
+      break;
+    case (PARAMETER_ROW_EMAIL):
+      destination = parameter_row(statement, parameter)->email;
+      capacity = COLUMN_EMAIL_SIZE;
+      break;
+    case (PARAMETER_FILTER_PATTERN):
+      destination = statement->filter_pattern;
+      capacity = COLUMN_EMAIL_SIZE;
+      break;
+    default:
+      destination = statement->username_to_find;
+      capacity = COLUMN_USERNAME_SIZE;
+      break;
+  }
+  if (length > capacity) {
+    return PREPARE_STRING_TOO_LONG;
   }
+
+  rql_reset(prepared);
+  memcpy(destination, text, length);
+  destination[length] = '\0';
+  parameter->bound = true;
+  return PREPARE_SUCCESS;
+}
+
+void rql_finalize(PreparedStatement* prepared) {
+  pager_release(prepared->table->pager);
+  prepared_unlatch(prepared);
+  free(prepared->cursor);
+  filter_result_free(prepared);
+  statement_free(&prepared->statement);
+  free(prepared);
 }
@@ -0,0 +1,152 @@
+#ifndef RQL_H
+#define RQL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * librql: o banco de dados como biblioteca, sem o REPL.
+ * O uso é em passos: rql_prepare interpreta o comando, cada rql_step executa até a
+ * próxima linha do resultado e as funções rql_column_* leem os campos direto da
+ * página, sem formatar nem copiar. Erros de E/S encerram o processo, como no REPL.
+ *
+ *   Table* table = rql_open("dados.db", 0, DB_OPEN_DEFAULT);
+ *   PreparedStatement* statement;
+ *   if (rql_prepare(table, "select where id between 1 and 10", &statement) == PREPARE_SUCCESS) {
+ *     while (rql_step(statement) == EXECUTE_ROW) {
+ *       uint32_t id = rql_column_int(statement, COLUMN_ID);
+ *       ...
+ *     }
+ *     rql_finalize(statement);
+ *   }
+ *   rql_close(table);
+ *
+ * O select da tabela inteira e o select por id aceitam "limit <L> offset <O>" no fim, e
+ * "select count(*)" conta as linhas, todas ou as de um intervalo de ids: o offset e a
+ * contagem descem pelos totais guardados nos nós internos, sem passar pelas linhas
+ * puladas. A posição de um id na tabela é "select count(*) where id between 0 and <id>".
+ *
+ * Um comando pode ter parâmetros '?' no lugar dos valores ("insert ? ? ?",
+ * "select where id = ?", "select limit ? offset ?"). Ele é preparado uma vez e executado várias, mudando só os
+ * valores com rql_bind_*: nada é interpretado de novo, e o comando guarda entre as
+ * execuções a folha em que parou, o ponto de partida da próxima busca.
+ *
+ * Vários threads podem usar a mesma Table, cada um com os seus comandos: os selects
+ * leem em paralelo; inserts e deletes de uma linha em folhas diferentes também rodam
+ * juntos, e os que dividem ou esvaziam folhas esperam a tabela inteira.
+ * Um PreparedStatement não deve ser usado por dois threads ao mesmo tempo.
+ */
+
+// só as funções da API são exportadas pela biblioteca compartilhada
+#define RQL_API __attribute__((visibility("default")))
+
+#define COLUMN_USERNAME_SIZE 32
+#define COLUMN_EMAIL_SIZE 255
+
+// Opções de abertura do banco de dados
+typedef enum {
+  DB_OPEN_DEFAULT = 0,
+  DB_OPEN_MMAP = 1 << 0, // acessa as páginas direto de um mapeamento do arquivo
+  DB_OPEN_COMPRESS = 1 << 1 // cria o arquivo com as páginas comprimidas
+} DbOpenFlags;
+
+// enum de sucesso ou erro para comandos nao sql
+typedef enum {
+  META_COMMAND_SUCCESS,
+  META_COMMAND_UNRECOGNIZED_COMMAND
+} MetaCommandResult;
+
+// enum de sucesso ou erro para comandos sql
+typedef enum {
+  PREPARE_SUCCESS,
+  PREPARE_SYNTAX_ERROR,
+  PREPARE_NEGATIVE_ID,
+  PREPARE_STRING_TOO_LONG,
+  PREPARE_UNRECOGNIZED_STATEMENT,
+  PREPARE_INVALID_PARAMETER // posição que não existe ou valor de outro tipo no rql_bind_*
+} PrepareResult;
+
+typedef enum {
+  EXECUTE_SUCCESS, // o comando terminou; num select, não há mais linhas
+  EXECUTE_ROW, // há uma linha para as funções rql_column_*
+  EXECUTE_DUPLICATE_KEY,
+  EXECUTE_TABLE_FULL,
+  EXECUTE_TRANSACTION_ACTIVE,
+  EXECUTE_NO_TRANSACTION,
+  EXECUTE_MISSING_PARAMETER // algum '?' ainda não recebeu valor
+} ExecuteResult;
+
+// enum de comandos sql
+typedef enum {
+  STATEMENT_INSERT,
+  STATEMENT_SELECT,
+  STATEMENT_SELECT_BY_USERNAME,
+  STATEMENT_SELECT_BY_ID,
+  STATEMENT_DELETE,
+  STATEMENT_INSERT_ROWS,
+  STATEMENT_BEGIN,
+  STATEMENT_COMMIT,
+  STATEMENT_ROLLBACK,
+  STATEMENT_SELECT_BY_FILTER, // select where email = ..., select where <coluna> like ...
+  STATEMENT_SELECT_COUNT // select count(*) [where id ...]: uma linha, o total em rql_column_int
+} StatementType;
+
+// colunas da tabela, na ordem
+typedef enum {
+  COLUMN_ID,
+  COLUMN_USERNAME,
+  COLUMN_EMAIL
+} Column;
+
+// tipo do valor de um parâmetro: os ids são inteiros, username e email são textos
+typedef enum {
+  PARAMETER_INT,
+  PARAMETER_TEXT
+} ParameterType;
+
+typedef struct Table Table;
+typedef struct PreparedStatement PreparedStatement;
+
+// cache_pages 0 usa o orçamento padrão do buffer pool; flags combina DbOpenFlags
+RQL_API Table* rql_open(const char* filename, uint32_t cache_pages, uint32_t flags);
+
+// desfaz uma transação aberta, faz o checkpoint final e libera a tabela
+RQL_API void rql_close(Table* table);
+
+// interpreta o comando; em caso de sucesso *statement deve ser liberado com rql_finalize
+RQL_API PrepareResult rql_prepare(Table* table, const char* sql, PreparedStatement** statement);
+
+/**
+ * Executa o comando até a próxima linha do resultado. Comandos que alteram a tabela
+ * terminam no primeiro passo. Os valores das colunas só valem até o próximo rql_step
+ * ou rql_finalize de qualquer comando do mesmo thread. Se a tabela mudar no meio de um
+ * select, ele continua do id seguinte ao da última linha devolvida.
+ */
+RQL_API ExecuteResult rql_step(PreparedStatement* statement);
+
+RQL_API StatementType rql_statement_type(PreparedStatement* statement);
+
+// no select count(*) a linha tem só o total, devolvido para qualquer coluna
+RQL_API uint32_t rql_column_int(PreparedStatement* statement, Column column);
+
+// texto direto da página: não termina com '\0', o tamanho vem de rql_column_bytes
+RQL_API const char* rql_column_text(PreparedStatement* statement, Column column);
+RQL_API uint32_t rql_column_bytes(PreparedStatement* statement, Column column);
+
+// parâmetros numerados a partir de 1, na ordem em que os '?' aparecem no comando
+RQL_API uint32_t rql_parameter_count(PreparedStatement* statement);
+RQL_API ParameterType rql_parameter_type(PreparedStatement* statement, uint32_t index);
+
+// os binds encerram a execução em andamento; os valores valem até o próximo bind do parâmetro
+RQL_API PrepareResult rql_bind_int(PreparedStatement* statement, uint32_t index, uint32_t value);
+RQL_API PrepareResult rql_bind_text(PreparedStatement* statement, uint32_t index, const char* text, uint32_t length);
+
+// volta o comando para o início, mantendo os valores dos parâmetros
+RQL_API void rql_reset(PreparedStatement* statement);
+
+RQL_API void rql_finalize(PreparedStatement* statement);
+
+// comandos de inspeção e manutenção do REPL (.btree, .flush, .import...), que escrevem no stdout
+RQL_API MetaCommandResult rql_meta_command(Table* table, const char* command);
+
+#endif